@@ -5,12 +5,30 @@
  * @date 04/22/2023
  * @brief MazeLock simulation program
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <float.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #define ENTRY 'S'
 #define EXIT 'E'
@@ -18,6 +36,23 @@
 #define CLOSED 'X'
 #define VISITED '.'
 #define PATH 'P'
+// Static tracepoints (USDT) for perf and bpftrace; without <sys/sdt.h> they compile to nothing
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MAZELOCK_HAVE_SDT 1
+#endif
+#endif
+#ifdef MAZELOCK_HAVE_SDT
+#define MAZELOCK_PROBE2(name, a, b) STAP_PROBE2(mazelock, name, a, b)
+#define MAZELOCK_PROBE3(name, a, b, c) STAP_PROBE3(mazelock, name, a, b, c)
+#define MAZELOCK_PROBE4(name, a, b, c, d) STAP_PROBE4(mazelock, name, a, b, c, d)
+#else
+// sizeof keeps the arguments referenced without evaluating them
+#define MAZELOCK_PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define MAZELOCK_PROBE3(name, a, b, c) (MAZELOCK_PROBE2(name, a, b), (void)sizeof(c))
+#define MAZELOCK_PROBE4(name, a, b, c, d) (MAZELOCK_PROBE3(name, a, b, c), (void)sizeof(d))
+#endif
 // ANSI color codes
 #define ANSI_RESET       "\033[0m"
 #define ANSI_RED         "\033[31m"
@@ -29,9 +64,78 @@ char **matrix;
 double density = 0.5;
 int ROWS = 0;
 int COLS = 0;
+int NUM_ENTRIES = 1;
+int NUM_EXITS = 1;
 static int matrix_count = 0;
+long rooms_generated = 0;
 pthread_mutex_t matrix_mutex;
 
+// Door positions (cell index row * COLS + col), refreshed by place_entry_exit_points
+int *entry_cells;
+int *exit_cells;
+
+// Scratch buffers for the breadth-first solvers, sized ROWS * COLS
+int *bfs_distance;
+int *bfs_label;
+int *bfs_queue;
+bool *bfs_is_target;
+
+// Door-to-door distances, (NUM_ENTRIES + NUM_EXITS)^2 entries, entries first
+int *door_distances;
+// Door index of every cell, -1 for cells that are not doors
+int *door_at_cell;
+
+// Articulation-point analysis over the open cells, refreshed once per frame
+#define CUT_ARTICULATION 1
+#define CUT_SEPARATES_DOORS 2
+int *cut_discovery;
+int *cut_low;
+int *cut_parent;
+int *cut_block;
+int *cut_dfs_stack;
+int *cut_block_stack;
+unsigned char *cut_next_dir;
+unsigned char *cut_flags;
+int articulation_count = 0;
+int block_count = 0;
+int largest_block = 0;
+int door_separator_count = 0;
+
+// Max-flow scratch over the node-split grid: node 2 * cell is the cell's input, 2 * cell + 1 its output
+#define FLOW_UNBOUNDED -1
+int *flow_level;
+int *flow_queue;
+int *flow_path;
+unsigned char *flow_next_arc;
+unsigned short *flow_split;
+unsigned short *flow_edge;
+int *min_cut_cells;
+int min_cut_size = 0;
+
+// A* scratch: an indexed binary heap keyed on f = g + h, cells stamped per search
+#define HEAP_CLOSED -1
+int *astar_g;
+int *astar_f;
+int *astar_heap;
+int *astar_heap_pos;
+unsigned int *astar_stamp;
+unsigned int astar_search_id = 0;
+
+// ALT heuristic: BFS distance fields from landmark cells, LANDMARK_COUNT * ROWS * COLS entries
+#define LANDMARK_COUNT 8
+int landmark_count = 0;
+int *landmark_cells;
+int *landmark_distance;
+double landmark_build_ms = 0;
+
+// Headings in clockwise order (north, east, south, west), used by the wall follower
+static const int HEADING_ROW[4] = {-1, 0, 1, 0};
+static const int HEADING_COL[4] = {0, 1, 0, -1};
+
+// Neighbour offsets (up, down, left, right), same order as dfs
+static const int ROW_STEP[4] = {-1, 1, 0, 0};
+static const int COL_STEP[4] = {0, 0, -1, 1};
+
 /**
 * @brief A structure to represent a path in the matrix (Secure room)
 */
@@ -41,16 +145,982 @@ typedef struct {
     bool found;
 } Path;
 
+/**
+* @brief A task run by the worker pool, called once per index.
+*/
+typedef void (*WorkerTask)(int index, int worker, void *context);
+
+/**
+* @brief A fixed set of threads that run indexed tasks on demand.
+*/
+typedef struct {
+    pthread_t *threads;
+    int thread_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+    WorkerTask task;
+    void *context;
+    int task_count;
+    int next_task;
+    int busy_workers;
+    unsigned long job_number;
+    bool job_active;
+    bool shutting_down;
+} WorkerPool;
+
+/**
+* @brief Per-worker scratch buffers for a breadth-first search.
+*/
+typedef struct {
+    int *distance;
+    int *queue;
+} BfsScratch;
+
+/**
+* @brief An edge of the junction graph; middle is the contracted node of a shortcut, -1 otherwise.
+*/
+typedef struct {
+    int to;
+    int weight;
+    int middle;
+} ChEdge;
+
+/**
+* @brief A node's edge list, a fixed slot of CH_NODE_EDGES edges in the shared edge arena.
+*/
+typedef struct {
+    ChEdge *edges;
+    int count;
+} ChAdjacency;
+
+/**
+* @brief Per-worker scratch for witness searches.
+*/
+typedef struct {
+    int *distance;
+    unsigned int *stamp;
+    unsigned int search;
+    int *heap_node;
+    int *heap_distance;
+} ChScratch;
+
+/**
+* @brief One level of the IDA* depth-first search stack.
+*/
+typedef struct {
+    int cell;
+    int g;
+    int next_dir;
+} IdaFrame;
+
+/**
+* @brief A transposition table slot: the lowest g seen for a cell in one IDA* iteration.
+*/
+typedef struct {
+    int cell;
+    int g;
+    unsigned int iteration;
+} IdaTableEntry;
+
+/**
+* @brief Outcome of a wall-follower walk.
+*/
+typedef struct {
+    bool found;
+    bool looped;
+    bool guaranteed;
+    long steps;
+} WallFollowResult;
+
+/**
+* @brief A node handed to the worker that owns its cell.
+*/
+typedef struct {
+    int cell;
+    int g;
+} HdaMessage;
+
+/**
+* @brief A slot of a bounded lock-free queue, stamped with the position it is valid for.
+*/
+typedef struct {
+    unsigned long sequence;
+    HdaMessage message;
+} HdaSlot;
+
+/**
+* @brief One HDA* worker: its incoming MPSC queue, open list and overflow buffers.
+*/
+typedef struct {
+    unsigned long enqueue_position __attribute__((aligned(64)));
+    unsigned long dequeue_position __attribute__((aligned(64)));
+    HdaSlot *slots;
+    int *open_cell;
+    int *open_g;
+    int *open_f;
+    int open_size;
+    int open_capacity;
+    HdaMessage **overflow;
+    int *overflow_count;
+    int *overflow_capacity;
+    long expanded;
+    int id;
+} HdaWorker;
+
+/**
+* @brief A resumable breadth-first solve: frontier, cursor and scratch live here between steps.
+*
+* Distances are not stored per cell. The queue holds one layer of the search before
+* layer_end and the next after it, so the depth of the layer is enough.
+*/
+typedef struct {
+    char **matrix;
+    int source;
+    int target;
+    int *queue;
+    int queue_capacity;
+    unsigned long long *visited;
+    int head;
+    int tail;
+    int layer_end;
+    int depth;
+    int status;
+    int result;
+    long expanded;
+} SolverState;
+
+/**
+* @brief Source of time for the simulation threads, either the real clock or a simulated one.
+*
+* Threads that take part in the simulation are numbered participants. The real clock
+* ignores the numbers; the simulated clock uses them to run one participant at a time.
+*/
+typedef struct {
+    bool simulated;
+    double (*now_ms)(void);
+    void (*sleep_until)(int participant, double deadline_ms);
+    void (*spend)(int participant, double ms);
+    void (*enter)(int participant);
+    void (*leave)(int participant);
+} Clock;
+
+/**
+* @brief One room of the fleet, with its own matrix and in-flight regenerate-and-solve job.
+*/
+typedef struct {
+    pthread_mutex_t mutex;
+    char **matrix;
+    int entry_cell;
+    int exit_cell;
+    unsigned long long fingerprint;
+    bool cached;
+    SolverState solver;
+    int job_class;
+    unsigned long job_generation;
+    double submitted_ms;
+    int queued_class;
+    unsigned long queued_generation;
+    int queue_prev;
+    int queue_next;
+} Room;
+
+/**
+* @brief One slot of the sensor ingestion queue. The change packs cell * 2 + open.
+*/
+typedef struct {
+    unsigned long sequence;
+    int change;
+} IngestSlot;
+
+// Metrics: counters and histograms recorded per thread and summed only when scraped
+enum { METRIC_FRAMES, METRIC_INGEST_REPORTS, METRIC_COUNTER_COUNT };
+enum {
+    HISTOGRAM_SOLVE_URGENT, HISTOGRAM_SOLVE_ROUTINE, HISTOGRAM_FRAME_ANALYSIS, HISTOGRAM_LOCK_MATRIX,
+    HISTOGRAM_LOCK_FLEET_QUEUE, HISTOGRAM_LOCK_ROOM, HISTOGRAM_COUNT
+};
+#define HISTOGRAM_BUCKETS 12
+
+/**
+* @brief One thread's metric values. Only the owning thread writes them.
+*/
+typedef struct {
+    unsigned long counters[METRIC_COUNTER_COUNT] __attribute__((aligned(64)));
+    unsigned long buckets[HISTOGRAM_COUNT][HISTOGRAM_BUCKETS + 1];
+    unsigned long sum_ns[HISTOGRAM_COUNT];
+} MetricSlot;
+
+// Allocation accounting: every heap block carries a header naming the subsystem that owns it
+enum { MEMORY_GRID, MEMORY_SCRATCH, MEMORY_QUEUES, MEMORY_CACHES, MEMORY_RENDER, MEMORY_RUNTIME, MEMORY_SUBSYSTEM_COUNT };
+
+/**
+* @brief One level of the occupancy pyramid. Block (r, c) of level k covers 2^k x 2^k cells.
+*/
+typedef struct {
+    int rows;
+    int cols;
+    int *open_count;
+    unsigned char *links;
+} PyramidLevel;
+
+// Stages timed in each JSON-lines frame record
+enum {
+    JSON_STAGE_GENERATE, JSON_STAGE_PYRAMID, JSON_STAGE_NEAREST, JSON_STAGE_DOORS, JSON_STAGE_ARTICULATION, JSON_STAGE_MIN_CUT,
+    JSON_STAGE_LANDMARKS, JSON_STAGE_HIERARCHY, JSON_STAGE_COUNT
+};
+
+/**
+* @brief Header placed in front of each tracked block. The offset leads back to the start of the raw block.
+*/
+typedef struct {
+    size_t size;
+    int subsystem;
+    int offset;
+} MemoryHeader;
+
+/**
+* @brief Allocation totals of one subsystem, updated atomically by every thread.
+*/
+typedef struct {
+    unsigned long calls;
+    unsigned long bytes;
+    long live;
+    long peak;
+} MemoryAccount;
+
+/**
+* @brief Growable text buffer for a metrics scrape.
+*/
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} MetricsBuffer;
+
+/**
+* @brief Admission and latency totals for one fleet job class.
+*/
+typedef struct {
+    const char *name;
+    double slo_ms;
+    long admitted;
+    long rejected;
+    long superseded;
+    long completed;
+    long reachable;
+    long within_slo;
+    double latency_total_ms;
+    double latency_max_ms;
+    double latency_window_max_ms;
+} FleetClassStats;
+
+/**
+* @brief Running totals for one benchmark stage.
+*/
+typedef struct {
+    const char *name;
+    double total_ms;
+    double max_ms;
+    long samples;
+} BenchStage;
+
+/**
+* @brief Fixed part of a checkpoint file.
+*
+* The door cells, the distances of the finished entry-exit pairs and the open-cell bits
+* of the generated rows follow it. While solving, the visited bits and the frontier
+* cells of the current pair come last. The checksum covers the whole file with the
+* checksum field zeroed.
+*/
+typedef struct {
+    char magic[8];
+    int rows;
+    int cols;
+    int entries;
+    int exits;
+    double density;
+    unsigned int seed;
+    int phase;
+    int next_row;
+    int pair;
+    unsigned long long generator_state;
+    int frontier_count;
+    int frontier_split;
+    int frontier_distance;
+    int reserved;
+    long expanded;
+    double elapsed_ms;
+    unsigned long long checksum;
+} CheckpointHeader;
+
+// Per-frame metrics kept in a recording's index
+enum {
+    RECORD_METRIC_OPEN, RECORD_METRIC_REGIONS, RECORD_METRIC_ARTICULATION, RECORD_METRIC_BLOCKS, RECORD_METRIC_MIN_CUT,
+    RECORD_METRIC_COUNT
+};
+
+/**
+* @brief Start of a recording. Frame records follow it back to back.
+*/
+typedef struct {
+    char magic[8];
+    int rows;
+    int cols;
+    int entries;
+    int exits;
+} RecordHeader;
+
+/**
+* @brief Start of one frame record, followed by the door cells, entries first, and the payload.
+*
+* A keyframe's payload is the packed open cells, words of them. A delta's payload is
+* the indices of the words that changed since the previous frame, then their XOR.
+*/
+typedef struct {
+    int kind;
+    int words;
+} RecordFrameHeader;
+
+/**
+* @brief Start of a recording index. The summary offset stays 0 until the recording is closed.
+*/
+typedef struct {
+    char magic[8];
+    int entry_size;
+    int block_frames;
+    long frames;
+    long summary_offset;
+} RecordIndexHeader;
+
+/**
+* @brief Index entry of one frame, 64 bytes so that a page holds a whole number of them.
+*/
+typedef struct {
+    long offset;
+    long keyframe_offset;
+    unsigned long long fingerprint;
+    long generation;
+    int metrics[RECORD_METRIC_COUNT];
+    int keyframe_distance;
+    int reserved[2];
+} RecordIndexEntry;
+
+/**
+* @brief One pre-generated fleet layout. Its packed open cells live in fleet_pool_words.
+*/
+typedef struct {
+    unsigned long long fingerprint;
+    int entry_cell;
+    int exit_cell;
+} FleetLayout;
+
+/**
+* @brief One slot of the fleet solution cache; a zero fingerprint marks a free slot.
+*/
+typedef struct {
+    unsigned long long fingerprint;
+    int distance;
+    int reserved;
+} SolutionCacheEntry;
+
+/**
+* @brief Start of a warm-restart snapshot: the layout pool, its packed cells and the
+* solution cache follow at the given offsets, laid out as they are used in memory.
+*/
+typedef struct {
+    char magic[8];
+    int rows;
+    int cols;
+    int entries;
+    int exits;
+    double density;
+    int pool_size;
+    int pool_count;
+    int words;
+    int cache_capacity;
+    int cache_count;
+    int step_budget;
+    double ms_per_cell;
+    long pool_offset;
+    long words_offset;
+    long cache_offset;
+    long size;
+} WarmSnapshotHeader;
+
+/**
+* @brief The progress counter of one pipeline stage.
+*
+* The sequence is the number of frames the stage has handed on. It sits on its own cache
+* line with the parked flag, so the stage that waits on it spins on one line that only
+* changes once per frame; the mutex and condition variable used to park are further on.
+*/
+typedef struct {
+    unsigned long sequence __attribute__((aligned(64)));
+    int parked;
+    pthread_mutex_t mutex __attribute__((aligned(64)));
+    pthread_cond_t cond;
+} StageCounter;
+
+/**
+* @brief One frame slot of the pipeline ring: the room, its doors and solution, and the time
+* it was handed to the next stage.
+*/
+typedef struct {
+    char **matrix;
+    int entry_cell;
+    int exit_cell;
+    int distance;
+    double handoff_us;
+} PipelineSlot;
+
+/**
+* @brief Smallest and largest value of each metric over one block of index entries.
+*/
+typedef struct {
+    int min[RECORD_METRIC_COUNT];
+    int max[RECORD_METRIC_COUNT];
+} RecordBlockSummary;
+
+int WORKER_COUNT = 1;
+WorkerPool worker_pool;
+BfsScratch *worker_scratch;
+
+// Contraction hierarchy over the corridor-collapsed junction graph, one node per junction cell
+#define CH_REMAINING 0
+#define CH_SELECTED 1
+#define CH_CONTRACTED 2
+#define CH_SETTLE_LIMIT 64
+#define CH_HEAP_CAPACITY 1024
+#define CH_NODE_EDGES 8
+#define CH_LOOP_SPACING 8
+int junction_count = 0;
+int *junction_cell;
+int *junction_of_cell;
+ChEdge *ch_edge_arena;
+ChAdjacency *ch_adjacency;
+int *ch_pending;
+int ch_core_rank = 0;
+int *ch_shortcut_first;
+int *ch_shortcut_count;
+int *ch_shortcut_from;
+int *ch_shortcut_to;
+int *ch_shortcut_weight;
+int *ch_rank;
+int *ch_priority;
+int *ch_deleted_neighbors;
+int *ch_selected;
+int *ch_dirty;
+unsigned char *ch_state;
+unsigned char *ch_is_dirty;
+ChScratch *ch_scratch;
+int ch_edge_count = 0;
+int ch_shortcut_total = 0;
+int ch_rounds = 0;
+double ch_build_ms = 0;
+
+// Bidirectional query scratch, index 0 searches from the source and 1 from the target
+int *ch_query_distance[2];
+int *ch_query_parent[2];
+unsigned int *ch_query_stamp[2];
+unsigned int ch_query_id = 0;
+int *ch_query_heap_node[2];
+int *ch_query_heap_distance[2];
+int ch_query_heap_capacity = 0;
+int *ch_unpack_stack;
+int *ch_query_chain;
+int *ch_path;
+int *ch_remaining_list;
+
+// IDA*: the stack grows with the path length, the transposition table has a fixed size
+#define IDA_GAVE_UP -2
+int IDA_TABLE_SIZE = 4096;
+IdaFrame *ida_stack;
+int ida_stack_capacity = 0;
+int ida_peak_depth = 0;
+IdaTableEntry *ida_table;
+unsigned int ida_iteration = 0;
+
+// HDA*: each cell belongs to the worker its hashed index selects, only that worker touches hda_g
+#define HDA_QUEUE_SIZE 16384
+int *hda_g;
+unsigned int *hda_stamp;
+unsigned int hda_search_id = 0;
+HdaWorker *hda_workers;
+int hda_thread_count = 0;
+char **hda_matrix;
+int hda_target;
+int hda_incumbent;
+long hda_outstanding;
+
+// Resumable solver states report one of these
+#define SOLVER_IDLE 0
+#define SOLVER_RUNNING 1
+#define SOLVER_FOUND 2
+#define SOLVER_UNREACHABLE 3
+#define SOLVER_STEP_BUDGET 4096
+SolverState bfs_solver;
+
+// Fleet mode: FLEET_SIZE rooms regenerated by one thread and solved in time slices by a few others
+int FLEET_SIZE = 0;
+Room *fleet;
+pthread_t fleet_generation_thread;
+pthread_t *fleet_solver_threads;
+int fleet_solver_count = 0;
+volatile bool fleet_stopping = false;
+#define FLEET_ROTATION_MS 2000.0
+#define FLEET_POLL_MS 100.0
+volatile double fleet_next_event_ms = 0;
+
+// Fleet jobs are urgent (security events, -u or the 'u' key) or routine (rotations); urgent ones are served first
+#define JOB_NONE -1
+#define JOB_URGENT 0
+#define JOB_ROUTINE 1
+#define JOB_CLASS_COUNT 2
+#define URGENT_SLO_MS 100.0
+double URGENT_RATE = 0;
+volatile bool fleet_urgent_requested = false;
+pthread_mutex_t fleet_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+int fleet_queue_head[JOB_CLASS_COUNT];
+int fleet_queue_tail[JOB_CLASS_COUNT];
+int fleet_urgent_in_flight = 0;
+FleetClassStats fleet_stats[JOB_CLASS_COUNT];
+
+// Sensor ingestion: producers push cell changes without locking, one thread applies them in coalesced batches
+#define INGEST_QUEUE_SIZE 65536
+#define INGEST_BATCH_MS 10
+double INGEST_RATE = 0;
+IngestSlot *ingest_slots;
+unsigned long ingest_enqueue_position __attribute__((aligned(64)));
+unsigned long ingest_dequeue_position __attribute__((aligned(64)));
+unsigned int *ingest_stamp;
+unsigned int ingest_batch = 0;
+bool *ingest_open;
+int *ingest_batch_cells;
+bool *reachable;
+int *reach_queue;
+long reach_generation = -1;
+volatile long matrix_generation = 0;
+volatile bool ingest_stopping = false;
+pthread_t ingest_thread;
+pthread_t sensor_thread;
+long ingest_dropped = 0;
+long ingest_events = 0;
+long ingest_batches = 0;
+long ingest_distinct = 0;
+long ingest_applied = 0;
+long ingest_full_updates = 0;
+double ingest_update_ms = 0;
+
+// Metrics registry: each thread claims a slot on first use; the last slot is shared once they run out
+#define METRIC_SLOTS 64
+const double HISTOGRAM_BOUNDS[HISTOGRAM_BUCKETS] = {
+    0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0
+};
+const char *HISTOGRAM_NAMES[HISTOGRAM_COUNT] = {
+    "mazelock_solve_seconds{class=\"urgent\"}", "mazelock_solve_seconds{class=\"routine\"}",
+    "mazelock_frame_analysis_seconds", "mazelock_lock_wait_seconds{lock=\"matrix\"}",
+    "mazelock_lock_wait_seconds{lock=\"fleet_queue\"}", "mazelock_lock_wait_seconds{lock=\"room\"}"
+};
+MetricSlot metric_slots[METRIC_SLOTS];
+int metric_slots_used = 0;
+__thread int metric_slot = -1;
+char *METRICS_ENDPOINT = NULL;
+int metrics_socket = -1;
+pthread_t metrics_thread;
+volatile bool metrics_stopping = false;
+int fleet_queue_length[JOB_CLASS_COUNT];
+
+// Fleet layout pool (-G): rooms are drawn from pre-generated layouts, one in FLEET_POOL_REFRESH draws is replaced
+// by a fresh one. Solved layouts go into a fingerprint-keyed cache, so a repeat is answered without a search.
+#define FLEET_POOL_REFRESH 64
+#define FLEET_SLICE_TARGET_MS 0.2
+#define FLEET_MIN_STEP_BUDGET 256
+#define FLEET_MAX_STEP_BUDGET 65536
+#define FLEET_TUNE_MIN_CELLS 64
+#define WARM_SNAPSHOT_MAGIC "MAZEWARM"
+int FLEET_POOL_SIZE = 0;
+char *WARM_SNAPSHOT_PATH = NULL;
+FleetLayout *fleet_pool;
+unsigned long long *fleet_pool_words;
+int fleet_pool_count = 0;
+int fleet_layout_words = 0;
+long fleet_pool_draws = 0;
+long fleet_pool_generated = 0;
+SolutionCacheEntry *solution_cache;
+int solution_cache_capacity = 0;
+int solution_cache_count = 0;
+long solution_cache_hits = 0;
+long solution_cache_misses = 0;
+pthread_mutex_t solution_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Solver slices are tuned to take about FLEET_SLICE_TARGET_MS; 0 ms per cell means not measured yet
+int fleet_step_budget = SOLVER_STEP_BUDGET;
+double fleet_ms_per_cell = 0;
+unsigned char *warm_mapping = NULL;
+size_t warm_mapping_size = 0;
+
+// Low-latency pipeline (-L): pinned generator, solver and publisher threads pass frames around a ring of
+// PIPELINE_DEPTH slots. Each stage waits on the counter of the stage before it, spinning for up to
+// pipeline_spin_budget checks before it parks.
+#define PIPELINE_DEPTH 4
+#define PIPELINE_DEFAULT_SPINS 20000
+#define PIPELINE_SAMPLES 65536
+#define PIPELINE_BENCH_FRAMES 5000
+#define PIPELINE_BENCH_MS 2000.0
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+enum { PIPELINE_GENERATOR, PIPELINE_SOLVER, PIPELINE_PUBLISHER, PIPELINE_STAGES };
+const char *PIPELINE_STAGE_NAMES[PIPELINE_STAGES] = {"generator", "solver", "publisher"};
+long PIPELINE_SPINS = -1;
+long pipeline_spin_budget;
+PipelineSlot pipeline_slots[PIPELINE_DEPTH];
+StageCounter pipeline_counters[PIPELINE_STAGES];
+SolverState pipeline_solver;
+int pipeline_cpus[PIPELINE_STAGES];
+pthread_t pipeline_threads[PIPELINE_STAGES];
+// The generator stops at pipeline_frame_limit frames or when asked to, and then sets pipeline_end
+long pipeline_frame_limit;
+long pipeline_end;
+bool pipeline_stopping;
+bool pipeline_quiet;
+// Handoff latency of each frame, generator to solver and solver to publisher, indexed by frame
+double *pipeline_latency_us[PIPELINE_STAGES - 1];
+double *pipeline_sorted_us;
+long pipeline_parks[PIPELINE_STAGES];
+
+// Simulated clock: time jumps to the earliest deadline and participants run one at a time
+#define SIM_ARRIVING 0
+#define SIM_WAITING 1
+#define SIM_RUNNING 2
+#define SIM_GONE 3
+#define SIMULATED_CELL_COST_MS 0.00005
+pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+double sim_now_ms = 0;
+int sim_participants = 0;
+int sim_running = -1;
+int *sim_state;
+double *sim_deadline;
+double simulation_end_ms = DBL_MAX;
+
+// Tile generator: 4x4 tiles with closed corners that obey the placement rules alone and across shared edges
+#define TILE_SIZE 4
+#define TILE_MAX_OPEN 8
+#define TILE_FREE_CELLS 12
+bool use_tile_generator = false;
+int tile_count = 0;
+int tile_words = 0;
+unsigned short *tile_mask;
+unsigned long long *tile_fits_right;
+unsigned long long *tile_fits_below;
+unsigned long long *tile_bucket;
+unsigned long long *tile_candidates;
+int *tile_row_above;
+double tile_library_ms = 0;
+
+// Allocation accounting
+#define MEMORY_HEADER_SIZE 16
+const char *MEMORY_SUBSYSTEM_NAMES[MEMORY_SUBSYSTEM_COUNT] = {"grid", "scratch", "queues", "caches", "render", "runtime"};
+MemoryAccount memory_accounts[MEMORY_SUBSYSTEM_COUNT];
+int ALLOCATION_WARMUP = -1;
+volatile bool allocations_frozen = false;
+long allocations_after_warmup = 0;
+
+// JSON-lines output: one object per frame, formatted by hand into a fixed buffer and written in batches
+#define JSON_BUFFER_SIZE 65536
+#define JSON_FLUSH_MS 1000.0
+char *JSON_OUTPUT = NULL;
+int json_fd = -1;
+char json_buffer[JSON_BUFFER_SIZE];
+int json_length = 0;
+double json_flushed_ms = 0;
+unsigned int run_seed = 0;
+double last_generate_ms = 0;
+const char *JSON_STAGE_NAMES[JSON_STAGE_COUNT] = {
+    "generate", "pyramid", "nearest", "doors", "articulation", "min_cut", "landmarks", "hierarchy"
+};
+
+// Render modes: one square per cell, half blocks for two rows per character, braille for 2x4 cells, or a zoomed view
+#define RENDER_CLASSIC 0
+#define RENDER_HALF 1
+#define RENDER_BRAILLE 2
+#define RENDER_ZOOM 3
+// Worst case per cell in classic mode: color, square, reset and a space
+#define RENDER_CELL_BYTES 13
+#define RENDER_SLICES_PER_WORKER 4
+#define RENDER_MAX_SLICES 256
+int RENDER_MODE = RENDER_CLASSIC;
+int render_words = 0;
+unsigned long long *render_open;
+unsigned long long *render_door;
+char *render_buffer;
+size_t render_header_bytes = 0;
+size_t render_line_bytes = 0;
+int render_slice_count = 0;
+struct iovec render_iov[RENDER_MAX_SLICES + 2];
+// Last UTF-8 byte of U+2580 upper half, U+2584 lower half and U+2588 full block, indexed by the lit halves
+const unsigned char HALF_BLOCK_LAST_BYTE[4] = {0x00, 0x80, 0x84, 0x88};
+// Braille dot bits for row k of a block, indexed by its left and right cells as bits 0 and 1
+const unsigned char BRAILLE_DOTS[4][4] = {
+    {0x00, 0x01, 0x08, 0x09}, {0x00, 0x02, 0x10, 0x12}, {0x00, 0x04, 0x20, 0x24}, {0x00, 0x40, 0x80, 0xC0}
+};
+
+// Occupancy pyramid: open counts and edge links per block at every power-of-two scale; level 0 is the packed rows,
+// kept apart from the render rows so the display can pack its own rows while the pyramid is built
+#define PYRAMID_MAX_LEVELS 32
+#define PYRAMID_LABEL_LEVEL 3
+#define PYRAMID_EAST 1
+#define PYRAMID_SOUTH 2
+PyramidLevel pyramid[PYRAMID_MAX_LEVELS];
+unsigned long long *pyramid_open;
+int pyramid_levels = 0;
+int pyramid_label_level = 0;
+int *pyramid_label;
+int *pyramid_queue;
+unsigned int *pyramid_mark;
+unsigned int pyramid_stamp = 0;
+int pyramid_components = 0;
+int pyramid_rejected_entries = 0;
+bool pyramid_valid = false;
+double pyramid_build_ms = 0;
+
+// Zoomed view: a window of pyramid blocks, one character each; view_level -1 fits the whole room
+#define VIEW_COLS 120
+#define VIEW_LINES 40
+volatile int view_level = -1;
+volatile int view_row = 0;
+volatile int view_col = 0;
+int view_door[VIEW_LINES * VIEW_COLS];
+int view_door_stamp = 0;
+int view_zoom = 0;
+int view_top = 0;
+int view_left = 0;
+int view_width = 0;
+int view_height = 0;
+// Last UTF-8 byte of the shades U+2591 to U+2593 and the full block U+2588, by quarters of open cells
+const unsigned char SHADE_LAST_BYTE[5] = {0x00, 0x91, 0x92, 0x93, 0x88};
+
+// Generator random stream (xorshift64*), apart from rand() so that a checkpoint can save and restore it
+#define GENERATOR_RANDOM_MAX 0x7FFFFFFF
+unsigned long long generator_state = 1;
+
+// Checkpointed run (-C): one room generated in bands of rows, then solved pair by pair in budgeted steps.
+// Snapshots are taken on the solving thread and written, synced and renamed into place by a background thread.
+#define CHECKPOINT_MAGIC "MAZECKP1"
+#define CHECKPOINT_BAND_CELLS (1 << 20)
+#define CHECKPOINT_STEP_BUDGET (1L << 20)
+#define CHECKPOINT_GENERATING 0
+#define CHECKPOINT_SOLVING 1
+char *CHECKPOINT_PATH = NULL;
+double CHECKPOINT_INTERVAL_S = 10.0;
+char checkpoint_temp_path[PATH_MAX];
+CheckpointHeader checkpoint_progress;
+int *checkpoint_results;
+unsigned char *checkpoint_grid_bits;
+int checkpoint_packed_rows = 0;
+unsigned char *checkpoint_visited_bits;
+int checkpoint_visited_pair = -1;
+int checkpoint_visited_tail = 0;
+unsigned char *checkpoint_resume = NULL;
+size_t checkpoint_resume_length = 0;
+pthread_t checkpoint_writer;
+pthread_mutex_t checkpoint_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t checkpoint_cond = PTHREAD_COND_INITIALIZER;
+unsigned char *checkpoint_buffer = NULL;
+size_t checkpoint_capacity = 0;
+size_t checkpoint_length = 0;
+bool checkpoint_pending = false;
+bool checkpoint_writer_stop = false;
+volatile sig_atomic_t checkpoint_interrupted = 0;
+long checkpoints_written = 0;
+long checkpoints_deferred = 0;
+long checkpoint_failures = 0;
+double checkpoint_snapshot_ms = 0;
+double checkpoint_write_ms = 0;
+bool checkpoint_overdue = false;
+
+// Recordings (-W): frame records appended to the file, one fixed-size index entry per frame in the file plus .idx.
+// Every RECORD_INDEX_BLOCK entries, one page, get a min/max summary per metric, written when the recording is closed.
+#define RECORD_MAGIC "MAZEREC1"
+#define RECORD_INDEX_MAGIC "MAZEIDX1"
+#define RECORD_KEYFRAME 0
+#define RECORD_DELTA 1
+#define RECORD_KEYFRAME_INTERVAL 64
+#define RECORD_INDEX_BLOCK 64
+#define RECORD_MATCHES_SHOWN 20
+const char *RECORD_METRIC_NAMES[RECORD_METRIC_COUNT] = {"open", "regions", "articulation", "blocks", "min_cut"};
+char *RECORD_PATH = NULL;
+char *PLAY_PATH = NULL;
+char *PLAY_QUERY = NULL;
+int record_fd = -1;
+int record_index_fd = -1;
+long record_offset = 0;
+long record_keyframe_offset = 0;
+long record_frames = 0;
+long record_delta_frames = 0;
+int record_since_keyframe = 0;
+unsigned long long *record_current;
+unsigned long long *record_previous;
+int *record_delta_index;
+unsigned long long *record_delta_words;
+RecordBlockSummary *record_summaries = NULL;
+long record_summary_capacity = 0;
+
 /**
  *   function prototypes for the MazeLock simulation program
  */
+void allocate_grid(int rows, int cols);
+void free_grid(int rows);
 void allocate_matrix(int rows, int cols);
 void free_matrix(int rows);
 void randomize_matrix(char **matrix, double density);
+void randomize_matrix_classic(char **matrix, double density);
+void randomize_rows(char **matrix, double density, int first_row, int last_row);
+unsigned int generator_random(void);
+void build_tile_library(void);
+void assemble_tile_matrix(char **matrix, double density);
+void compare_generators(int frames);
 void display_matrix(char **matrix);
+void pack_rows(char **matrix, int first_row, int last_row, unsigned long long *open_rows, unsigned long long *door_rows);
+size_t render_classic(char **matrix, int first_line, int last_line, char *out);
+char *render_door_color(char *cursor, bool door, bool *in_door);
+size_t render_half_blocks(int first_line, int last_line, char *out);
+size_t render_braille(int first_line, int last_line, char *out);
+int view_zoom_level(void);
+void place_view(void);
+size_t render_zoom(int first_line, int last_line, char *out);
+int render_width(void);
+int render_lines(void);
+void render_slice_task(int slice, int worker, void *context);
+int render_frame(char **matrix, int number, size_t *length);
+bool write_gathered(int fd, struct iovec *iov, int count);
+void compare_renderers(int frames);
 void find_path(char **matrix);
+void build_pyramid(char **matrix);
+int pyramid_label_of(int cell);
+bool pyramid_rejects(int source, int target);
+void report_pyramid(void);
+int find_nearest_exits(char **matrix, int *nearest_exit, int *exit_distance);
+void report_nearest_exits(char **matrix);
+void start_worker_pool(int thread_count);
+void stop_worker_pool(void);
+void run_on_workers(int task_count, WorkerTask task, void *context);
+void compute_door_distances(char **matrix);
+void report_door_distances(void);
+void analyze_articulation_points(char **matrix);
+bool closing_cell_disconnects(int row, int col);
+void report_articulation_points(void);
+int find_minimum_cut(char **matrix);
+void report_minimum_cut(void);
+double monotonic_ms(void);
+int astar_search(char **matrix, int source, int target, bool use_landmarks, long *expanded);
+void build_landmarks(char **matrix);
+void report_landmark_queries(char **matrix);
+void build_junction_graph(char **matrix);
+void build_contraction_hierarchy(char **matrix);
+int ch_query(int source, int target, int *path, int *path_nodes);
+void report_contraction_hierarchy(void);
+void run_benchmark(int frames);
+long benchmark_hierarchy_loops(int frames);
+int bfs_search(char **matrix, int source, int target, long *expanded);
+int ida_star_search(char **matrix, int source, int target, long max_expansions, long *expanded);
+WallFollowResult wall_follow(char **matrix, int start, int target, bool right_hand, bool pledge, long max_steps);
+void report_wall_follower(char **matrix);
+int hda_star_search(char **matrix, int source, int target, int thread_count, long *expanded);
+void release_hda_workers(void);
+void solver_alloc(SolverState *state, int queue_capacity);
+void solver_free(SolverState *state);
+void solver_reserve(SolverState *state, int count);
+void solver_init(SolverState *state, char **matrix, int source, int target);
+int solver_step(SolverState *state, long budget);
+void start_fleet(void);
+void simulated_clock_setup(int participants);
+void simulated_clock_release(void);
+double real_now_ms(void);
+void real_sleep_until(int participant, double deadline_ms);
+void real_spend(int participant, double ms);
+void real_participant_noop(int participant);
+double simulated_now_ms(void);
+void simulated_sleep_until(int participant, double deadline_ms);
+void simulated_spend(int participant, double ms);
+void simulated_enter(int participant);
+void simulated_leave(int participant);
+void stop_fleet(void);
+long pack_open_cells(char **matrix, unsigned long long *words);
+unsigned long long fingerprint_words(const unsigned long long *words, size_t count);
+void fleet_place_layout(Room *room);
+bool solution_cache_lookup(unsigned long long fingerprint, int *distance);
+void solution_cache_insert(unsigned long long fingerprint, int distance);
+void fleet_tune_step_budget(long expanded, double slice_ms);
+bool load_warm_snapshot(const char *path);
+void write_warm_snapshot(const char *path);
+bool pipeline_ready(StageCounter *counter, unsigned long target, long frame);
+void pipeline_wait(int stage, StageCounter *counter, unsigned long target, long frame);
+void pipeline_advance(StageCounter *counter);
+void pipeline_wake_all(void);
+int compare_doubles(const void *a, const void *b);
+void report_handoff_latency(long first, long last);
+void *pipeline_stage_func(void *arg);
+void start_pipeline(long spin_budget, long frame_limit, bool quiet);
+long stop_pipeline(void);
+void free_pipeline(void);
+void benchmark_handoff(void);
+bool ingest_cell_change(int row, int col, bool open);
+int ingest_drain_batch(int max_events);
+void ingest_apply_batch(char **matrix, int count);
+void report_ingestion(void);
+void start_ingestion(void);
+void stop_ingestion(void);
+void benchmark_ingestion(void);
+void metrics_count(int counter, unsigned long amount);
+void metrics_observe(int histogram, double seconds);
+void metrics_lock(pthread_mutex_t *mutex, int histogram);
+bool start_metrics_server(const char *endpoint);
+void stop_metrics_server(void);
+void account_allocation(int subsystem, size_t old_size, size_t new_size);
+void *tracked_malloc(int subsystem, size_t size);
+void *tracked_calloc(int subsystem, size_t count, size_t size);
+void *tracked_realloc(int subsystem, void *pointer, size_t size);
+void *tracked_aligned_alloc(int subsystem, size_t alignment, size_t size);
+void tracked_free(void *pointer);
+void report_allocations(void);
+bool open_json_output(const char *path);
+void close_json_output(void);
+void json_flush(void);
+void json_text(const char *text);
+void json_integer(long value);
+void json_key(const char *key);
+void write_frame_json(long frame, int *nearest_exit, int *exit_distance, const double *stage_ms);
+void analyze_frame_json(char **matrix);
 void* matrix_generation_thread_func(void* arg);
 void* path_finding_thread_func(void *arg);
+size_t checkpoint_size(const CheckpointHeader *header);
+unsigned long long checkpoint_checksum(const unsigned char *data, size_t length);
+int load_checkpoint(const char *path);
+void restore_checkpoint(SolverState *solver);
+void snapshot_checkpoint(SolverState *solver);
+bool write_checkpoint_file(unsigned char *data, size_t length);
+void *checkpoint_writer_func(void *arg);
+void wait_for_checkpoint_writer(void);
+bool checkpoint_tick(SolverState *solver, double *next_checkpoint_ms, double run_start_ms);
+void handle_checkpoint_signal(int signal_number);
+int run_checkpointed(void);
+bool open_recording(const char *path);
+unsigned long long record_fingerprint(const unsigned long long *words, size_t count);
+void record_frame(char **matrix);
+void close_recording(void);
+const unsigned char *map_file(const char *path, size_t *size);
+void print_record_entry(long frame, const RecordIndexEntry *entry);
+bool record_value_matches(int value, char op, int bound);
+bool record_doors_valid(const unsigned char *doors, int rows, int cols, int count);
+int play_recording(const char *path, const char *query);
+
+Clock real_clock = {false, real_now_ms, real_sleep_until, real_spend, real_participant_noop, real_participant_noop};
+Clock simulated_clock = {true, simulated_now_ms, simulated_sleep_until, simulated_spend, simulated_enter,
+                         simulated_leave};
+Clock *active_clock = &real_clock;
 
 
 /**
@@ -58,371 +1128,7476 @@ void* path_finding_thread_func(void *arg);
  * @return 0 on successful execution, non-zero on error.
  */
 
-int main() {
-    srand(time(NULL));
-    printf("Welcome to the MazeLock simulation!\n");
-    printf("Enter the number of rows: ");
-    scanf("%d", &ROWS);
-    getchar();
-    printf("Enter the number of columns: ");
-    scanf("%d", &COLS);
-    getchar();
-    printf("Enter the density of open cells (between 0 and 1, e.g., 0.5): ");
-    scanf("%lf", &density);
-    getchar();
+int main(int argc, char *argv[]) {
+    bool density_set = false, entries_set = false, exits_set = false;
+    int benchmark_frames = 0;
+    int worker_override = 0;
+    unsigned int seed = 0;
+    bool seed_set = false;
+    int option;
+
+    // Settings given on the command line are not prompted for
+    while ((option = getopt(argc, argv, "r:c:d:e:x:b:t:w:F:G:H:L:g:s:S:u:I:M:A:J:R:C:K:W:P:p:")) != -1) {
+        switch (option) {
+            case 'r':
+                ROWS = atoi(optarg);
+                break;
+            case 'c':
+                COLS = atoi(optarg);
+                break;
+            case 'd':
+                density = atof(optarg);
+                density_set = true;
+                break;
+            case 'e':
+                NUM_ENTRIES = atoi(optarg);
+                entries_set = true;
+                break;
+            case 'x':
+                NUM_EXITS = atoi(optarg);
+                exits_set = true;
+                break;
+            case 'b':
+                benchmark_frames = atoi(optarg);
+                break;
+            case 't':
+                IDA_TABLE_SIZE = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'w':
+                worker_override = atoi(optarg);
+                break;
+            case 'F':
+                FLEET_SIZE = atoi(optarg);
+                break;
+            case 'G':
+                FLEET_POOL_SIZE = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+            case 'H':
+                WARM_SNAPSHOT_PATH = optarg;
+                break;
+            case 'L':
+                PIPELINE_SPINS = atol(optarg) > 0 ? atol(optarg) : 0;
+                break;
+            case 'g':
+                if (strcmp(optarg, "tiles") == 0) {
+                    use_tile_generator = true;
+                } else if (strcmp(optarg, "classic") != 0) {
+                    fprintf(stderr, "Unknown generator '%s', expected 'classic' or 'tiles'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                seed = (unsigned int)strtoul(optarg, NULL, 10);
+                seed_set = true;
+                break;
+            case 'M':
+                METRICS_ENDPOINT = optarg;
+                break;
+            case 'A':
+                ALLOCATION_WARMUP = atoi(optarg);
+                break;
+            case 'J':
+                JSON_OUTPUT = optarg;
+                break;
+            case 'R':
+                if (strcmp(optarg, "half") == 0) {
+                    RENDER_MODE = RENDER_HALF;
+                } else if (strcmp(optarg, "braille") == 0) {
+                    RENDER_MODE = RENDER_BRAILLE;
+                } else if (strcmp(optarg, "zoom") == 0) {
+                    RENDER_MODE = RENDER_ZOOM;
+                } else if (strcmp(optarg, "classic") != 0) {
+                    fprintf(stderr, "Unknown render mode '%s', expected 'classic', 'half', 'braille' or 'zoom'\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case 'C':
+                CHECKPOINT_PATH = optarg;
+                break;
+            case 'K':
+                CHECKPOINT_INTERVAL_S = atof(optarg);
+                break;
+            case 'W':
+                RECORD_PATH = optarg;
+                break;
+            case 'P':
+                PLAY_PATH = optarg;
+                break;
+            case 'p':
+                PLAY_QUERY = optarg;
+                break;
+            case 'I':
+                INGEST_RATE = atof(optarg);
+                break;
+            case 'u':
+                URGENT_RATE = atof(optarg);
+                break;
+            case 'S':
+                simulation_end_ms = atof(optarg) * 1000.0;
+                active_clock = &simulated_clock;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rows] [-c cols] [-d density] [-e entries] [-x exits] [-b frames] "
+                        "[-t table entries] [-w workers] [-F rooms] [-G pooled layouts] [-H warm snapshot file] "
+                        "[-L spin budget] "
+                        "[-g classic|tiles] [-s seed] "
+                        "[-S simulated seconds] [-u urgent per second] [-I sensor events per second] "
+                        "[-M metrics port or socket path] [-A warm-up frames] [-J JSON-lines file or -] "
+                        "[-R classic|half|braille|zoom] [-C checkpoint file] [-K seconds between checkpoints] "
+                        "[-W recording file] [-P recording file [-p frame or metric<=>value]]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (PLAY_PATH != NULL) {
+        return play_recording(PLAY_PATH, PLAY_QUERY != NULL ? PLAY_QUERY : "1");
+    }
+
+    if (CHECKPOINT_PATH != NULL) {
+        if (use_tile_generator) {
+            fprintf(stderr, "Checkpointed runs use the classic generator\n");
+            return 1;
+        }
+        int loaded = load_checkpoint(CHECKPOINT_PATH);
+        if (loaded < 0) {
+            return 1;
+        }
+        if (loaded > 0) {
+            const CheckpointHeader *saved = (const CheckpointHeader *)checkpoint_resume;
+            if ((ROWS != 0 && ROWS != saved->rows) || (COLS != 0 && COLS != saved->cols) ||
+                (density_set && density != saved->density) || (entries_set && NUM_ENTRIES != saved->entries) ||
+                (exits_set && NUM_EXITS != saved->exits) || (seed_set && seed != saved->seed)) {
+                fprintf(stderr, "Checkpoint %s belongs to a different room; remove it to start over\n",
+                        CHECKPOINT_PATH);
+                return 1;
+            }
+            // The room settings come from the checkpoint, so nothing is prompted for
+            ROWS = saved->rows;
+            COLS = saved->cols;
+            density = saved->density;
+            NUM_ENTRIES = saved->entries;
+            NUM_EXITS = saved->exits;
+            seed = saved->seed;
+            density_set = entries_set = exits_set = seed_set = true;
+        }
+    }
+
+    run_seed = seed_set ? seed : (unsigned int)time(NULL);
+    srand(run_seed);
+    generator_state = (run_seed + 1ULL) * 0x9E3779B97F4A7C15ULL;
+    // With JSON lines on standard output, nothing else is printed there unless a setting has to be prompted for
+    bool quiet = JSON_OUTPUT != NULL && strcmp(JSON_OUTPUT, "-") == 0;
+    if (!quiet) {
+        printf("Welcome to the MazeLock simulation!\n");
+    }
+    if (ROWS == 0) {
+        printf("Enter the number of rows: ");
+        scanf("%d", &ROWS);
+        getchar();
+    }
+    if (COLS == 0) {
+        printf("Enter the number of columns: ");
+        scanf("%d", &COLS);
+        getchar();
+    }
+    if (!density_set) {
+        printf("Enter the density of open cells (between 0 and 1, e.g., 0.5): ");
+        scanf("%lf", &density);
+        getchar();
+    }
+    if (!entries_set) {
+        printf("Enter the number of entry points (e.g., 1): ");
+        scanf("%d", &NUM_ENTRIES);
+        getchar();
+    }
+    if (!exits_set) {
+        printf("Enter the number of exit points (e.g., 1): ");
+        scanf("%d", &NUM_EXITS);
+        getchar();
+    }
+
+    // Every cell of a thinner room is an edge cell twice over, which the perimeter walks do not expect
+    if (ROWS < 2 || COLS < 2) {
+        printf("The room must be at least 2 rows by 2 columns.\n");
+        return 1;
+    }
+    if (NUM_ENTRIES < 1 || NUM_EXITS < 1 || NUM_ENTRIES + NUM_EXITS > 2 * (ROWS + COLS) - 4) {
+        printf("The room perimeter cannot hold %d entry and %d exit points.\n", NUM_ENTRIES, NUM_EXITS);
+        return 1;
+    }
+
+    WORKER_COUNT = worker_override > 0 ? worker_override : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (WORKER_COUNT < 1) {
+        WORKER_COUNT = 1;
+    }
+
+    if (CHECKPOINT_PATH != NULL) {
+        return run_checkpointed();
+    }
+
+    if (benchmark_frames > 0) {
+        allocate_matrix(ROWS, COLS);
+        start_worker_pool(WORKER_COUNT);
+        run_benchmark(benchmark_frames);
+        stop_worker_pool();
+        free_matrix(ROWS);
+        return allocations_after_warmup > 0 ? 1 : 0;
+    }
 
-    printf("Press Enter to start the simulation.\n");
-    printf("Press 'q' to quit the simulation at any time.\n");
-    getchar();
+    // A simulated run replays at full speed and ends by itself, so it does not wait for keys
+    if (!active_clock->simulated) {
+        if (!quiet) {
+            printf("Press Enter to start the simulation.\n");
+            printf("Press 'q' to quit the simulation at any time.\n");
+        }
+        getchar();
+    }
+    if (JSON_OUTPUT != NULL && !open_json_output(JSON_OUTPUT)) {
+        return 1;
+    }
 
     allocate_matrix(ROWS, COLS);
+    start_worker_pool(WORKER_COUNT);
+    double wall_start_ms = monotonic_ms();
+    if (METRICS_ENDPOINT != NULL && !start_metrics_server(METRICS_ENDPOINT)) {
+        stop_worker_pool();
+        free_matrix(ROWS);
+        return 1;
+    }
+
+    if (FLEET_SIZE > 0) {
+        start_fleet();
+        int key;
+        while (!active_clock->simulated && (key = getchar()) != 'q' && key != EOF) {
+            if (key == 'u') {
+                fleet_urgent_requested = true;
+            }
+            usleep(100);
+        }
+        stop_fleet();
+        if (active_clock->simulated) {
+            printf("Simulated %.0f s in %.2f s of wall time\n", simulation_end_ms / 1000.0,
+                   (monotonic_ms() - wall_start_ms) / 1000.0);
+        }
+        stop_metrics_server();
+        stop_worker_pool();
+        free_matrix(ROWS);
+        return 0;
+    }
+
+    if (PIPELINE_SPINS >= 0) {
+        start_pipeline(PIPELINE_SPINS, LONG_MAX, false);
+        int key;
+        while ((key = getchar()) != 'q' && key != EOF) {
+            usleep(100);
+        }
+        long frames = stop_pipeline();
+        printf("Pipeline total: %ld frames, parked %ld/%ld/%ld times\n", frames, pipeline_parks[PIPELINE_GENERATOR],
+               pipeline_parks[PIPELINE_SOLVER], pipeline_parks[PIPELINE_PUBLISHER]);
+        free_pipeline();
+        stop_metrics_server();
+        stop_worker_pool();
+        free_matrix(ROWS);
+        return 0;
+    }
+
+    if (RECORD_PATH != NULL && !open_recording(RECORD_PATH)) {
+        stop_metrics_server();
+        stop_worker_pool();
+        free_matrix(ROWS);
+        return 1;
+    }
 
     pthread_t matrix_generation_thread;
     pthread_t path_finding_thread;
     pthread_mutex_init(&matrix_mutex, NULL);
+    if (active_clock->simulated) {
+        simulated_clock_setup(2);
+    }
     pthread_create(&matrix_generation_thread, NULL, matrix_generation_thread_func, NULL);
     pthread_create(&path_finding_thread, NULL, path_finding_thread_func, NULL);
 
-    char input;
-    while ((input = getchar()) != 'q') {
+    if (active_clock->simulated) {
+        pthread_join(matrix_generation_thread, NULL);
+        pthread_join(path_finding_thread, NULL);
+        simulated_clock_release();
+        close_json_output();
+        close_recording();
+        if (!quiet) {
+            printf("Simulated %.0f s in %.2f s of wall time\n", simulation_end_ms / 1000.0,
+                   (monotonic_ms() - wall_start_ms) / 1000.0);
+        }
+        pthread_mutex_destroy(&matrix_mutex);
+        stop_metrics_server();
+        stop_worker_pool();
+        free_matrix(ROWS);
+        return 0;
+    }
+
+    if (INGEST_RATE > 0) {
+        start_ingestion();
+    }
+
+    // In the zoomed view, + and - change the scale and w, a, s, d move the window by half a screen
+    int input;
+    while ((input = getchar()) != 'q' && input != EOF) {
+        int level = view_zoom_level();
+        if (input == '+' && level > 0) {
+            view_level = level - 1;
+        } else if (input == '-') {
+            view_level = level + 1;
+        } else if (input == 'w' || input == 's') {
+            int row = view_row + (input == 's' ? 1 : -1) * (VIEW_LINES / 2 << level);
+            view_row = row < 0 ? 0 : row >= ROWS ? ROWS - 1 : row;
+        } else if (input == 'a' || input == 'd') {
+            int col = view_col + (input == 'd' ? 1 : -1) * (VIEW_COLS / 2 << level);
+            view_col = col < 0 ? 0 : col >= COLS ? COLS - 1 : col;
+        }
         usleep(100);
     }
 
+    if (INGEST_RATE > 0) {
+        stop_ingestion();
+    }
     pthread_cancel(matrix_generation_thread);
     pthread_cancel(path_finding_thread);
 
     pthread_join(matrix_generation_thread, NULL);
     pthread_join(path_finding_thread, NULL);
+    close_json_output();
+    close_recording();
 
     pthread_mutex_destroy(&matrix_mutex);
+    stop_metrics_server();
+    stop_worker_pool();
     free_matrix(ROWS);
 
     return 0;
 }
 
 /**
- * @brief Allocate memory for the matrix.
- * @param rows The number of rows in the matrix.
- * @param cols The number of columns in the matrix.
+ * @brief Records one allocation against a subsystem and enforces the warm-up freeze.
+ * @param subsystem The subsystem that owns the block.
+ * @param old_size The size of the block being replaced, or 0.
+ * @param new_size The size of the new block.
  */
-void allocate_matrix(int rows, int cols) {
-    matrix = (char **)malloc(rows * sizeof(char *));
-    for (int i = 0; i < rows; i++) {
-        matrix[i] = (char *)malloc(cols * sizeof(char));
+void account_allocation(int subsystem, size_t old_size, size_t new_size) {
+    MemoryAccount *account = &memory_accounts[subsystem];
+    __atomic_add_fetch(&account->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&account->bytes, new_size, __ATOMIC_RELAXED);
+    long live = __atomic_add_fetch(&account->live, (long)new_size - (long)old_size, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&account->peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&account->peak, &peak, live, true, __ATOMIC_RELAXED,
+                                                       __ATOMIC_RELAXED)) {
+    }
+    if (allocations_frozen && __atomic_fetch_add(&allocations_after_warmup, 1, __ATOMIC_RELAXED) == 0) {
+        fprintf(stderr, "allocation of %zu bytes in %s after warm-up\n", new_size,
+                MEMORY_SUBSYSTEM_NAMES[subsystem]);
     }
 }
+
 /**
- * @brief Free memory allocated for the matrix.
- * @param rows The number of rows in the matrix.
+ * @brief Allocates a block charged to a subsystem.
+ * @param subsystem The subsystem that owns the block.
+ * @param size The size of the block in bytes.
+ * @return The block, or NULL if the allocation failed.
  */
-void free_matrix(int rows) {
-    for (int i = 0; i < rows; i++) {
-        free(matrix[i]);
+void *tracked_malloc(int subsystem, size_t size) {
+    if (size > SIZE_MAX - MEMORY_HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
     }
-    free(matrix);
+    char *raw = (char *)malloc(MEMORY_HEADER_SIZE + size);
+    if (raw == NULL) {
+        return NULL;
+    }
+    MemoryHeader *header = (MemoryHeader *)raw;
+    header->size = size;
+    header->subsystem = subsystem;
+    header->offset = MEMORY_HEADER_SIZE;
+    account_allocation(subsystem, 0, size);
+    return raw + MEMORY_HEADER_SIZE;
 }
 
 /**
- * @brief Place entry and exit points on the edge of the matrix.
- * @param matrix The matrix to place entry and exit points in.
+ * @brief Allocates a zeroed array charged to a subsystem.
+ * @param subsystem The subsystem that owns the block.
+ * @param count The number of elements.
+ * @param size The size of each element in bytes.
+ * @return The block, or NULL if the allocation failed or count * size does not fit in a size_t.
  */
-void place_entry_exit_points(char **matrix) {
-    int edge_length = 2 * (ROWS + COLS) - 4;
-    int entry_position = rand() % edge_length;
-    int exit_position;
+void *tracked_calloc(int subsystem, size_t count, size_t size) {
+    if (size != 0 && count > (SIZE_MAX - MEMORY_HEADER_SIZE) / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *raw = (char *)calloc(1, MEMORY_HEADER_SIZE + count * size);
+    if (raw == NULL) {
+        return NULL;
+    }
+    MemoryHeader *header = (MemoryHeader *)raw;
+    header->size = count * size;
+    header->subsystem = subsystem;
+    header->offset = MEMORY_HEADER_SIZE;
+    account_allocation(subsystem, 0, count * size);
+    return raw + MEMORY_HEADER_SIZE;
+}
 
-    do {
-        exit_position = rand() % edge_length;
-    } while (exit_position == entry_position);
+/**
+ * @brief Resizes a block from tracked_malloc or tracked_calloc; NULL allocates a new one.
+ * @param subsystem The subsystem that owns the block.
+ * @param pointer The block to resize, or NULL.
+ * @param size The new size in bytes.
+ * @return The resized block, or NULL if the allocation failed.
+ */
+void *tracked_realloc(int subsystem, void *pointer, size_t size) {
+    if (pointer == NULL) {
+        return tracked_malloc(subsystem, size);
+    }
+    if (size > SIZE_MAX - MEMORY_HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *raw = (char *)pointer - MEMORY_HEADER_SIZE;
+    size_t old_size = ((MemoryHeader *)raw)->size;
+    raw = (char *)realloc(raw, MEMORY_HEADER_SIZE + size);
+    if (raw == NULL) {
+        return NULL;
+    }
+    ((MemoryHeader *)raw)->size = size;
+    account_allocation(subsystem, old_size, size);
+    return raw + MEMORY_HEADER_SIZE;
+}
 
-    int counter = 0;
-    bool entry_placed = false;
-    bool exit_placed = false;
+/**
+ * @brief Allocates a block aligned to a power of two of at least MEMORY_HEADER_SIZE bytes.
+ * @param subsystem The subsystem that owns the block.
+ * @param alignment The alignment in bytes.
+ * @param size The size of the block in bytes.
+ * @return The block, or NULL if the allocation failed.
+ */
+void *tracked_aligned_alloc(int subsystem, size_t alignment, size_t size) {
+    void *raw;
+    if (size > SIZE_MAX - alignment || posix_memalign(&raw, alignment, alignment + size) != 0) {
+        return NULL;
+    }
+    char *block = (char *)raw + alignment;
+    MemoryHeader *header = (MemoryHeader *)(block - MEMORY_HEADER_SIZE);
+    header->size = size;
+    header->subsystem = subsystem;
+    header->offset = (int)alignment;
+    account_allocation(subsystem, 0, size);
+    return block;
+}
+
+/**
+ * @brief Frees a tracked block and returns its bytes to the owning subsystem.
+ * @param pointer The block, or NULL.
+ */
+void tracked_free(void *pointer) {
+    if (pointer == NULL) {
+        return;
+    }
+    MemoryHeader *header = (MemoryHeader *)((char *)pointer - MEMORY_HEADER_SIZE);
+    __atomic_sub_fetch(&memory_accounts[header->subsystem].live, (long)header->size, __ATOMIC_RELAXED);
+    free((char *)pointer - header->offset);
+}
+
+/**
+ * @brief Prints allocation calls, bytes and peak footprint per subsystem.
+ */
+void report_allocations(void) {
+    unsigned long calls = 0;
+    long peak = 0;
+    printf("Allocations by subsystem:\n");
+    printf("  %-8s %10s %14s %14s %14s\n", "", "calls", "bytes", "live", "peak");
+    for (int subsystem = 0; subsystem < MEMORY_SUBSYSTEM_COUNT; subsystem++) {
+        MemoryAccount *account = &memory_accounts[subsystem];
+        printf("  %-8s %10lu %14lu %14ld %14ld\n", MEMORY_SUBSYSTEM_NAMES[subsystem], account->calls,
+               account->bytes, account->live, account->peak);
+        calls += account->calls;
+        peak += account->peak;
+    }
+    printf("  %lu calls, peak footprint at most %.1f MiB\n", calls, peak / 1048576.0);
+}
+
+/**
+ * @brief Allocate the matrix rows and the door positions, without any solver scratch.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in the matrix.
+ */
+void allocate_grid(int rows, int cols) {
+    matrix = (char **)tracked_malloc(MEMORY_GRID, rows * sizeof(char *));
+    for (int i = 0; i < rows; i++) {
+        matrix[i] = (char *)tracked_malloc(MEMORY_GRID, cols * sizeof(char));
+    }
+    entry_cells = (int *)tracked_calloc(MEMORY_GRID, NUM_ENTRIES, sizeof(int));
+    exit_cells = (int *)tracked_calloc(MEMORY_GRID, NUM_EXITS, sizeof(int));
+}
+
+/**
+ * @brief Free memory allocated by allocate_grid.
+ * @param rows The number of rows in the matrix.
+ */
+void free_grid(int rows) {
+    for (int i = 0; i < rows; i++) {
+        tracked_free(matrix[i]);
+    }
+    tracked_free(matrix);
+    tracked_free(entry_cells);
+    tracked_free(exit_cells);
+}
+
+/**
+ * @brief Allocate memory for the matrix.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in the matrix.
+ */
+void allocate_matrix(int rows, int cols) {
+    allocate_grid(rows, cols);
+    bfs_distance = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    bfs_label = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    bfs_queue = (int *)tracked_malloc(MEMORY_QUEUES, (size_t)rows * cols * sizeof(int));
+    bfs_is_target = (bool *)tracked_calloc(MEMORY_SCRATCH, (size_t)rows * cols, sizeof(bool));
+    int door_count = NUM_ENTRIES + NUM_EXITS;
+    door_distances = (int *)tracked_malloc(MEMORY_CACHES, (size_t)door_count * door_count * sizeof(int));
+    door_at_cell = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    for (int cell = 0; cell < rows * cols; cell++) {
+        door_at_cell[cell] = -1;
+    }
+    cut_discovery = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    cut_low = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    cut_parent = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    cut_block = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    cut_dfs_stack = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    cut_block_stack = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    cut_next_dir = (unsigned char *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols);
+    cut_flags = (unsigned char *)tracked_calloc(MEMORY_SCRATCH, (size_t)rows * cols, 1);
+    flow_level = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)2 * rows * cols * sizeof(int));
+    flow_queue = (int *)tracked_malloc(MEMORY_QUEUES, (size_t)2 * rows * cols * sizeof(int));
+    flow_path = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)2 * rows * cols * sizeof(int));
+    flow_next_arc = (unsigned char *)tracked_malloc(MEMORY_SCRATCH, (size_t)2 * rows * cols);
+    flow_split = (unsigned short *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(unsigned short));
+    flow_edge = (unsigned short *)tracked_malloc(MEMORY_SCRATCH, (size_t)4 * rows * cols * sizeof(unsigned short));
+    min_cut_cells = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)4 * NUM_ENTRIES * sizeof(int));
+    astar_g = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    astar_f = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    astar_heap = (int *)tracked_malloc(MEMORY_QUEUES, (size_t)rows * cols * sizeof(int));
+    astar_heap_pos = (int *)tracked_malloc(MEMORY_QUEUES, (size_t)rows * cols * sizeof(int));
+    astar_stamp = (unsigned int *)tracked_calloc(MEMORY_SCRATCH, (size_t)rows * cols, sizeof(unsigned int));
+    landmark_cells = (int *)tracked_malloc(MEMORY_CACHES, LANDMARK_COUNT * sizeof(int));
+    landmark_distance = (int *)tracked_malloc(MEMORY_CACHES, (size_t)LANDMARK_COUNT * rows * cols * sizeof(int));
+    junction_cell = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    junction_of_cell = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    // Every node gets its worst-case edge slot up front: a junction has at most four corridors, and contraction
+    // only adds shortcuts to a node while its slot has room for them
+    ch_edge_arena = (ChEdge *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * CH_NODE_EDGES * sizeof(ChEdge));
+    ch_adjacency = (ChAdjacency *)tracked_calloc(MEMORY_CACHES, (size_t)rows * cols, sizeof(ChAdjacency));
+    for (int node = 0; node < rows * cols; node++) {
+        ch_adjacency[node].edges = ch_edge_arena + (size_t)node * CH_NODE_EDGES;
+    }
+    ch_pending = (int *)tracked_calloc(MEMORY_CACHES, (size_t)rows * cols, sizeof(int));
+    ch_rank = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    ch_priority = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    ch_deleted_neighbors = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    ch_selected = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    ch_dirty = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    ch_state = (unsigned char *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols);
+    ch_is_dirty = (unsigned char *)tracked_calloc(MEMORY_CACHES, (size_t)rows * cols, 1);
+    ch_scratch = (ChScratch *)tracked_calloc(MEMORY_SCRATCH, WORKER_COUNT, sizeof(ChScratch));
+    for (int worker = 0; worker < WORKER_COUNT; worker++) {
+        ch_scratch[worker].distance = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+        ch_scratch[worker].stamp = (unsigned int *)tracked_calloc(MEMORY_SCRATCH, (size_t)rows * cols, sizeof(unsigned int));
+        ch_scratch[worker].heap_node = (int *)tracked_malloc(MEMORY_QUEUES, CH_HEAP_CAPACITY * sizeof(int));
+        ch_scratch[worker].heap_distance = (int *)tracked_malloc(MEMORY_QUEUES, CH_HEAP_CAPACITY * sizeof(int));
+    }
+    // A round promises each node at most its free edge slots, and every shortcut uses two of them
+    ch_shortcut_first = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    ch_shortcut_count = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    ch_shortcut_from = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * CH_NODE_EDGES / 2 * sizeof(int));
+    ch_shortcut_to = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * CH_NODE_EDGES / 2 * sizeof(int));
+    ch_shortcut_weight = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * CH_NODE_EDGES / 2 * sizeof(int));
+    for (int side = 0; side < 2; side++) {
+        ch_query_distance[side] = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+        ch_query_parent[side] = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+        ch_query_stamp[side] = (unsigned int *)tracked_calloc(MEMORY_SCRATCH, (size_t)rows * cols, sizeof(unsigned int));
+    }
+    ch_unpack_stack = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    ch_query_chain = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    ch_path = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    ida_table = (IdaTableEntry *)tracked_calloc(MEMORY_CACHES, IDA_TABLE_SIZE, sizeof(IdaTableEntry));
+    ingest_slots = (IngestSlot *)tracked_malloc(MEMORY_QUEUES, INGEST_QUEUE_SIZE * sizeof(IngestSlot));
+    for (unsigned long position = 0; position < INGEST_QUEUE_SIZE; position++) {
+        ingest_slots[position].sequence = position;
+    }
+    ingest_enqueue_position = ingest_dequeue_position = 0;
+    ingest_stamp = (unsigned int *)tracked_calloc(MEMORY_QUEUES, (size_t)rows * cols, sizeof(unsigned int));
+    ingest_batch = 0;
+    ingest_open = (bool *)tracked_malloc(MEMORY_QUEUES, (size_t)rows * cols * sizeof(bool));
+    ingest_batch_cells = (int *)tracked_malloc(MEMORY_QUEUES, (size_t)rows * cols * sizeof(int));
+    reachable = (bool *)tracked_calloc(MEMORY_SCRATCH, (size_t)rows * cols, sizeof(bool));
+    reach_queue = (int *)tracked_malloc(MEMORY_QUEUES, (size_t)rows * cols * sizeof(int));
+    reach_generation = -1;
+    hda_g = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+    hda_stamp = (unsigned int *)tracked_calloc(MEMORY_SCRATCH, (size_t)rows * cols, sizeof(unsigned int));
+    solver_alloc(&bfs_solver, rows * cols);
+    tile_row_above = (int *)tracked_malloc(MEMORY_SCRATCH, ((cols + TILE_SIZE - 1) / TILE_SIZE) * sizeof(int));
+    render_words = (cols + 63) / 64;
+    render_open = (unsigned long long *)tracked_malloc(MEMORY_RENDER, (size_t)rows * render_words * sizeof(unsigned long long));
+    render_door = (unsigned long long *)tracked_malloc(MEMORY_RENDER, (size_t)rows * render_words * sizeof(unsigned long long));
+    // The title and rule come first, then every output line gets a region large enough for any mode
+    render_header_bytes = 64 + 2 * (size_t)cols;
+    render_line_bytes = ((size_t)cols + 1) * RENDER_CELL_BYTES + 1;
+    render_buffer = (char *)tracked_malloc(MEMORY_RENDER, render_header_bytes + (size_t)rows * render_line_bytes);
+    pyramid_open = (unsigned long long *)tracked_malloc(MEMORY_CACHES, (size_t)rows * render_words * sizeof(unsigned long long));
+    pyramid_levels = 1;
+    pyramid[0].rows = rows;
+    pyramid[0].cols = cols;
+    while (pyramid[pyramid_levels - 1].rows > 1 || pyramid[pyramid_levels - 1].cols > 1) {
+        PyramidLevel *level = &pyramid[pyramid_levels++];
+        level->rows = (level[-1].rows + 1) / 2;
+        level->cols = (level[-1].cols + 1) / 2;
+        level->open_count = (int *)tracked_malloc(MEMORY_CACHES, (size_t)level->rows * level->cols * sizeof(int));
+        level->links = (unsigned char *)tracked_malloc(MEMORY_CACHES, (size_t)level->rows * level->cols);
+    }
+    pyramid_label_level = pyramid_levels - 1 < PYRAMID_LABEL_LEVEL ? pyramid_levels - 1 : PYRAMID_LABEL_LEVEL;
+    int label_blocks = pyramid[pyramid_label_level].rows * pyramid[pyramid_label_level].cols;
+    pyramid_label = (int *)tracked_malloc(MEMORY_CACHES, label_blocks * sizeof(int));
+    pyramid_queue = (int *)tracked_malloc(MEMORY_QUEUES, label_blocks * sizeof(int));
+    pyramid_mark = (unsigned int *)tracked_calloc(MEMORY_SCRATCH, label_blocks, sizeof(unsigned int));
+    build_tile_library();
+    ch_remaining_list = (int *)tracked_malloc(MEMORY_CACHES, (size_t)rows * cols * sizeof(int));
+    worker_scratch = (BfsScratch *)tracked_malloc(MEMORY_SCRATCH, WORKER_COUNT * sizeof(BfsScratch));
+    for (int worker = 0; worker < WORKER_COUNT; worker++) {
+        worker_scratch[worker].distance = (int *)tracked_malloc(MEMORY_SCRATCH, (size_t)rows * cols * sizeof(int));
+        worker_scratch[worker].queue = (int *)tracked_malloc(MEMORY_QUEUES, (size_t)rows * cols * sizeof(int));
+    }
+}
+/**
+ * @brief Free memory allocated for the matrix.
+ * @param rows The number of rows in the matrix.
+ */
+void free_matrix(int rows) {
+    free_grid(rows);
+    tracked_free(bfs_distance);
+    tracked_free(bfs_label);
+    tracked_free(bfs_queue);
+    tracked_free(bfs_is_target);
+    tracked_free(door_distances);
+    tracked_free(door_at_cell);
+    tracked_free(cut_discovery);
+    tracked_free(cut_low);
+    tracked_free(cut_parent);
+    tracked_free(cut_block);
+    tracked_free(cut_dfs_stack);
+    tracked_free(cut_block_stack);
+    tracked_free(cut_next_dir);
+    tracked_free(cut_flags);
+    tracked_free(flow_level);
+    tracked_free(flow_queue);
+    tracked_free(flow_path);
+    tracked_free(flow_next_arc);
+    tracked_free(flow_split);
+    tracked_free(flow_edge);
+    tracked_free(min_cut_cells);
+    tracked_free(astar_g);
+    tracked_free(astar_f);
+    tracked_free(astar_heap);
+    tracked_free(astar_heap_pos);
+    tracked_free(astar_stamp);
+    tracked_free(landmark_cells);
+    tracked_free(landmark_distance);
+    tracked_free(ch_edge_arena);
+    tracked_free(ch_adjacency);
+    tracked_free(ch_pending);
+    tracked_free(junction_cell);
+    tracked_free(junction_of_cell);
+    tracked_free(ch_rank);
+    tracked_free(ch_priority);
+    tracked_free(ch_deleted_neighbors);
+    tracked_free(ch_selected);
+    tracked_free(ch_dirty);
+    tracked_free(ch_state);
+    tracked_free(ch_is_dirty);
+    for (int worker = 0; worker < WORKER_COUNT; worker++) {
+        tracked_free(ch_scratch[worker].distance);
+        tracked_free(ch_scratch[worker].stamp);
+        tracked_free(ch_scratch[worker].heap_node);
+        tracked_free(ch_scratch[worker].heap_distance);
+    }
+    tracked_free(ch_scratch);
+    tracked_free(ch_shortcut_first);
+    tracked_free(ch_shortcut_count);
+    tracked_free(ch_shortcut_from);
+    tracked_free(ch_shortcut_to);
+    tracked_free(ch_shortcut_weight);
+    for (int side = 0; side < 2; side++) {
+        tracked_free(ch_query_distance[side]);
+        tracked_free(ch_query_parent[side]);
+        tracked_free(ch_query_stamp[side]);
+        tracked_free(ch_query_heap_node[side]);
+        tracked_free(ch_query_heap_distance[side]);
+        ch_query_heap_node[side] = NULL;
+        ch_query_heap_distance[side] = NULL;
+    }
+    ch_query_heap_capacity = 0;
+    tracked_free(ch_unpack_stack);
+    tracked_free(ch_query_chain);
+    tracked_free(ch_path);
+    tracked_free(ida_table);
+    tracked_free(ida_stack);
+    ida_stack = NULL;
+    ida_stack_capacity = 0;
+    tracked_free(hda_g);
+    tracked_free(hda_stamp);
+    release_hda_workers();
+    solver_free(&bfs_solver);
+    tracked_free(tile_mask);
+    tracked_free(tile_fits_right);
+    tracked_free(tile_fits_below);
+    tracked_free(tile_bucket);
+    tracked_free(tile_candidates);
+    tracked_free(tile_row_above);
+    tracked_free(render_open);
+    tracked_free(render_door);
+    tracked_free(render_buffer);
+    tracked_free(pyramid_open);
+    for (int level = 1; level < pyramid_levels; level++) {
+        tracked_free(pyramid[level].open_count);
+        tracked_free(pyramid[level].links);
+    }
+    tracked_free(pyramid_label);
+    tracked_free(pyramid_queue);
+    tracked_free(pyramid_mark);
+    tracked_free(ingest_slots);
+    tracked_free(ingest_stamp);
+    tracked_free(ingest_open);
+    tracked_free(ingest_batch_cells);
+    tracked_free(reachable);
+    tracked_free(reach_queue);
+    tracked_free(ch_remaining_list);
+    for (int worker = 0; worker < WORKER_COUNT; worker++) {
+        tracked_free(worker_scratch[worker].distance);
+        tracked_free(worker_scratch[worker].queue);
+    }
+    tracked_free(worker_scratch);
+}
+
+/**
+ * @brief Place entry and exit points on the edge of the matrix.
+ *
+ * NUM_ENTRIES entry points and NUM_EXITS exit points are placed on distinct
+ * edge cells; their cell indices are stored in entry_cells and exit_cells.
+ * @param matrix The matrix to place entry and exit points in.
+ */
+void place_entry_exit_points(char **matrix) {
+    int edge_length = 2 * (ROWS + COLS) - 4;
+    int door_count = NUM_ENTRIES + NUM_EXITS;
+    int door_positions[door_count];
+
+    // Entries come first in door_positions, exits after them
+    for (int door = 0; door < door_count; door++) {
+        bool taken;
+        do {
+            door_positions[door] = generator_random() % edge_length;
+            taken = false;
+            for (int other = 0; other < door; other++) {
+                if (door_positions[other] == door_positions[door]) {
+                    taken = true;
+                    break;
+                }
+            }
+        } while (taken);
+    }
+
+    int counter = 0;
+
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            if (row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1) {
+                for (int door = 0; door < door_count; door++) {
+                    if (door_positions[door] != counter) {
+                        continue;
+                    }
+                    if (door < NUM_ENTRIES) {
+                        matrix[row][col] = ENTRY;
+                        entry_cells[door] = row * COLS + col;
+                    } else {
+                        matrix[row][col] = EXIT;
+                        exit_cells[door - NUM_ENTRIES] = row * COLS + col;
+                    }
+                    break;
+                }
+                counter++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Count the number of open cells adjacent to the given cell.
+ * @param matrix The matrix containing the cells.
+ * @param row The row index of the cell to check.
+ * @param col The column index of the cell to check.
+ * @return The number of open cells adjacent to the given cell.
+ */
+int count_adjacent_open_cells(char **matrix, int row, int col) {
+    int count = 0;
+    // Check adjacent cells (up, down, left, and right)
+    if (row > 0 && matrix[row - 1][col] == OPEN) count++;
+    if (row < ROWS - 1 && matrix[row + 1][col] == OPEN) count++;
+    if (col > 0 && matrix[row][col - 1] == OPEN) count++;
+    if (col < COLS - 1 && matrix[row][col + 1] == OPEN) count++;
+
+    return count;
+}
+
+/**
+ * @brief Checks if placing an open cell at the specified location is valid.
+ * @param matrix The maze matrix.
+ * @param row Row index of the cell.
+ * @param col Column index of the cell.
+ * @return true if the placement is valid, false otherwise.
+ */
+bool is_valid_open_cell_placement(char **matrix, int row, int col) {
+    if (matrix[row][col] == ENTRY || matrix[row][col] == EXIT) {
+        return false;
+    }
+
+    int adjacent_open_cells = count_adjacent_open_cells(matrix, row, col);
+    if (adjacent_open_cells > 1) {
+        return false;
+    }
+
+    // New check: Ensure that no more than two open cells are in a straight line or diagonal.
+    if ((row > 0 && row < ROWS - 1 && matrix[row - 1][col] == OPEN && matrix[row + 1][col] == OPEN) ||
+        (col > 0 && col < COLS - 1 && matrix[row][col - 1] == OPEN && matrix[row][col + 1] == OPEN) ||
+        (row > 0 && row < ROWS - 1 && col > 0 && col < COLS - 1 && matrix[row - 1][col - 1] == OPEN && matrix[row + 1][col + 1] == OPEN) ||
+        (row > 0 && row < ROWS - 1 && col > 0 && col < COLS - 1 && matrix[row - 1][col + 1] == OPEN && matrix[row + 1][col - 1] == OPEN)) {
+        return false;
+    }
+
+    // Check cells two steps away
+    if (row > 1 && matrix[row - 2][col] == OPEN && matrix[row - 1][col] == OPEN) {
+        return false;
+    }
+
+    if (row < ROWS - 2 && matrix[row + 2][col] == OPEN && matrix[row + 1][col] == OPEN) {
+        return false;
+    }
+
+    if (col > 1 && matrix[row][col - 2] == OPEN && matrix[row][col - 1] == OPEN) {
+        return false;
+    }
+
+    if (col < COLS - 2 && matrix[row][col + 2] == OPEN && matrix[row][col + 1] == OPEN) {
+        return false;
+    }
+
+    return true;
+}
+
+
+
+/**
+ * @brief Randomizes the given matrix based on the density, with the generator picked by -g.
+ * @param matrix The maze matrix.
+ * @param density The density of open cells in the matrix.
+ */
+void randomize_matrix(char **matrix, double density) {
+    long room = __atomic_add_fetch(&rooms_generated, 1, __ATOMIC_RELAXED);
+
+    MAZELOCK_PROBE3(generate__start, room, ROWS, COLS);
+    if (use_tile_generator) {
+        assemble_tile_matrix(matrix, density);
+    } else {
+        randomize_matrix_classic(matrix, density);
+    }
+    MAZELOCK_PROBE3(generate__done, room, ROWS, COLS);
+}
+
+/**
+ * @brief Randomizes the given matrix cell by cell, checking the placement rules at every cell.
+ * @param matrix The maze matrix.
+ * @param density The density of open cells in the matrix.
+ */
+void randomize_matrix_classic(char **matrix, double density) {
+    // The pyramid describes the previous room until it is rebuilt
+    pyramid_valid = false;
+    // Fill the matrix with open and closed cells based on the density
+    randomize_rows(matrix, density, 0, ROWS);
+
+    // Remove the previous entry and exit points
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            if (matrix[row][col] == ENTRY || matrix[row][col] == EXIT) {
+                matrix[row][col] = CLOSED;
+            }
+        }
+    }
+    // Place new entry and exit points
+    place_entry_exit_points(matrix);
+}
+
+/**
+ * @brief Fills a band of rows with open and closed cells, in the order the classic generator visits them.
+ *
+ * Entry and exit points on the edge are left in place. Generating the rows in several
+ * bands draws the same random numbers as generating them in one.
+ * @param matrix The maze matrix.
+ * @param density The density of open cells in the matrix.
+ * @param first_row The first row to fill.
+ * @param last_row One past the last row to fill.
+ */
+void randomize_rows(char **matrix, double density, int first_row, int last_row) {
+    for (int row = first_row; row < last_row; row++) {
+        for (int col = 0; col < COLS; col++) {
+            if ((row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1) &&
+                (matrix[row][col] == ENTRY || matrix[row][col] == EXIT)) {
+                continue;
+            }
+            double random_value = (double)generator_random() / (double)GENERATOR_RANDOM_MAX;
+            if (random_value <= density && is_valid_open_cell_placement(matrix, row, col)) {
+                matrix[row][col] = OPEN;
+            } else {
+                matrix[row][col] = CLOSED;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Draws the next number of the generator's random stream (xorshift64*).
+ * @return A number between 0 and GENERATOR_RANDOM_MAX.
+ */
+unsigned int generator_random(void) {
+    generator_state ^= generator_state >> 12;
+    generator_state ^= generator_state << 25;
+    generator_state ^= generator_state >> 27;
+    return (unsigned int)((generator_state * 2685821657736338717ULL) >> 33);
+}
+
+/**
+ * @brief Checks the placement rules on a small pattern of open cells.
+ *
+ * The pattern holds up to 8x8 cells, one bit each, with a row stride of 8 bits.
+ * An open cell may not have both its upper and left neighbours open, and no three
+ * open cells may be in line horizontally, vertically or diagonally.
+ * @param bits The pattern.
+ * @return true if the pattern obeys the rules, false otherwise.
+ */
+bool tile_pattern_is_valid(unsigned long long bits) {
+    const unsigned long long first_col = 0x0101010101010101ULL, last_col = first_col << 7;
+    // Each mask has a cell's bit set when the named neighbour is open
+    unsigned long long left = (bits & ~last_col) << 1, left2 = (left & ~last_col) << 1;
+    unsigned long long right = (bits & ~first_col) >> 1, right2 = (right & ~first_col) >> 1;
+    unsigned long long up = bits << 8, up2 = bits << 16;
+
+    return !(bits & up & left) && !(bits & left & left2) && !(bits & up & up2) &&
+           !(bits & (left << 8) & (left2 << 16)) && !(bits & (right << 8) & (right2 << 16));
+}
+
+/**
+ * @brief Spreads a 4x4 tile into the 8-bit row stride used by tile_pattern_is_valid.
+ * @param mask The tile, one bit per cell with a row stride of 4 bits.
+ * @param row_offset Row of the tile's top-left cell in the pattern.
+ * @param col_offset Column of the tile's top-left cell in the pattern.
+ * @return The pattern.
+ */
+unsigned long long tile_pattern(unsigned short mask, int row_offset, int col_offset) {
+    unsigned long long bits = 0;
+    for (int row = 0; row < TILE_SIZE; row++) {
+        bits |= (unsigned long long)((mask >> (row * TILE_SIZE)) & 0xF) << ((row + row_offset) * 8 + col_offset);
+    }
+    return bits;
+}
+
+/**
+ * @brief Enumerates every valid 4x4 tile and the tables used to assemble rooms from them.
+ *
+ * Tile corners are always closed, so any line of three cells that spans more than two
+ * tiles passes through a closed corner. Checking each pair of tiles that share an edge
+ * is then enough for the whole room to obey the placement rules. Compatible tiles and
+ * tiles with the same open-cell count are kept as bitsets over the library.
+ */
+void build_tile_library(void) {
+    const unsigned short corners = (1 << 0) | (1 << 3) | (1 << 12) | (1 << 15);
+    double start = monotonic_ms();
+
+    tile_mask = (unsigned short *)tracked_malloc(MEMORY_CACHES, (1 << 16) * sizeof(unsigned short));
+    tile_count = 0;
+    for (int mask = 0; mask < (1 << 16); mask++) {
+        if (!(mask & corners) && tile_pattern_is_valid(tile_pattern(mask, 0, 0))) {
+            tile_mask[tile_count++] = (unsigned short)mask;
+        }
+    }
+    tile_words = (tile_count + 63) / 64;
+    tile_fits_right = (unsigned long long *)tracked_calloc(MEMORY_CACHES, (size_t)tile_count * tile_words, sizeof(unsigned long long));
+    tile_fits_below = (unsigned long long *)tracked_calloc(MEMORY_CACHES, (size_t)tile_count * tile_words, sizeof(unsigned long long));
+    tile_bucket = (unsigned long long *)tracked_calloc(MEMORY_CACHES, (size_t)(TILE_MAX_OPEN + 1) * tile_words, sizeof(unsigned long long));
+    tile_candidates = (unsigned long long *)tracked_malloc(MEMORY_SCRATCH, tile_words * sizeof(unsigned long long));
+
+    for (int a = 0; a < tile_count; a++) {
+        unsigned long long pattern = tile_pattern(tile_mask[a], 0, 0);
+        tile_bucket[__builtin_popcount(tile_mask[a]) * tile_words + a / 64] |= 1ULL << (a % 64);
+        for (int b = 0; b < tile_count; b++) {
+            if (tile_pattern_is_valid(pattern | tile_pattern(tile_mask[b], 0, TILE_SIZE))) {
+                tile_fits_right[(size_t)a * tile_words + b / 64] |= 1ULL << (b % 64);
+            }
+            if (tile_pattern_is_valid(pattern | tile_pattern(tile_mask[b], TILE_SIZE, 0))) {
+                tile_fits_below[(size_t)a * tile_words + b / 64] |= 1ULL << (b % 64);
+            }
+        }
+    }
+    tile_library_ms = monotonic_ms() - start;
+}
+
+/**
+ * @brief Picks a random tile that fits its left and upper neighbours.
+ *
+ * Tiles with open_target open cells are preferred, then the nearest count that has
+ * a fitting tile. The all-closed tile fits anywhere, so a tile is always found.
+ * @param left The tile to the left, or -1 at the left edge.
+ * @param above The tile above, or -1 at the top edge.
+ * @param open_target The preferred number of open cells.
+ * @return The tile index.
+ */
+int pick_tile(int left, int above, int open_target) {
+    for (int delta = 0; delta <= TILE_MAX_OPEN; delta++) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            int open = open_target + sign * delta;
+            if (open < 0 || open > TILE_MAX_OPEN || (delta == 0 && sign == 1)) {
+                continue;
+            }
+            int total = 0;
+            for (int word = 0; word < tile_words; word++) {
+                unsigned long long fits = tile_bucket[open * tile_words + word];
+                if (left != -1) {
+                    fits &= tile_fits_right[(size_t)left * tile_words + word];
+                }
+                if (above != -1) {
+                    fits &= tile_fits_below[(size_t)above * tile_words + word];
+                }
+                tile_candidates[word] = fits;
+                total += __builtin_popcountll(fits);
+            }
+            if (total == 0) {
+                continue;
+            }
+            int chosen = generator_random() % total;
+            for (int word = 0;; word++) {
+                int in_word = __builtin_popcountll(tile_candidates[word]);
+                if (chosen < in_word) {
+                    unsigned long long fits = tile_candidates[word];
+                    while (chosen-- > 0) {
+                        fits &= fits - 1;
+                    }
+                    return word * 64 + __builtin_ctzll(fits);
+                }
+                chosen -= in_word;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Randomizes the given matrix by assembling it from the tile library.
+ *
+ * The open-cell count of each tile is drawn from a binomial distribution over the
+ * twelve non-corner cells, so the density setting keeps its meaning. Tiles on the
+ * right and bottom edges are cropped, which cannot break the placement rules.
+ * @param matrix The maze matrix.
+ * @param density The density of open cells in the matrix.
+ */
+void assemble_tile_matrix(char **matrix, double density) {
+    double cumulative[TILE_FREE_CELLS + 1], probability = 1.0, sum = 0;
+    pyramid_valid = false;
+    for (int cell = 0; cell < TILE_FREE_CELLS; cell++) {
+        probability *= 1.0 - density;
+    }
+    for (int open = 0; open <= TILE_FREE_CELLS; open++) {
+        sum += probability;
+        cumulative[open] = sum;
+        if (density < 1.0) {
+            probability *= (double)(TILE_FREE_CELLS - open) / (open + 1) * density / (1.0 - density);
+        }
+    }
+
+    for (int tile_row = 0; tile_row * TILE_SIZE < ROWS; tile_row++) {
+        int left = -1;
+        for (int tile_col = 0; tile_col * TILE_SIZE < COLS; tile_col++) {
+            double random_value = (double)generator_random() / (double)GENERATOR_RANDOM_MAX;
+            int open_target = 0;
+            while (open_target < TILE_FREE_CELLS && cumulative[open_target] < random_value) {
+                open_target++;
+            }
+            if (open_target > TILE_MAX_OPEN) {
+                open_target = TILE_MAX_OPEN;
+            }
+            int tile = pick_tile(left, tile_row > 0 ? tile_row_above[tile_col] : -1, open_target);
+            tile_row_above[tile_col] = left = tile;
+
+            for (int row = 0; row < TILE_SIZE && tile_row * TILE_SIZE + row < ROWS; row++) {
+                for (int col = 0; col < TILE_SIZE && tile_col * TILE_SIZE + col < COLS; col++) {
+                    bool open = (tile_mask[tile] >> (row * TILE_SIZE + col)) & 1;
+                    matrix[tile_row * TILE_SIZE + row][tile_col * TILE_SIZE + col] = open ? OPEN : CLOSED;
+                }
+            }
+        }
+    }
+
+    // Every cell was overwritten, so the previous entry and exit points are already gone
+    place_entry_exit_points(matrix);
+}
+
+/**
+ * @brief Generates a new matrix.
+ * @param matrix The matrix.
+ */
+void generate_matrix(char **matrix) {
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            matrix[row][col] = CLOSED;
+        }
+    }
+    randomize_matrix(matrix, density);
+}
+
+/**
+ * @brief Packs the open and door cells of a range of rows into bit rows, one bit per column.
+ * @param matrix The matrix.
+ * @param first_row The first row to pack.
+ * @param last_row One past the last row to pack.
+ * @param open_rows Receives the open bits, render_words words per row.
+ * @param door_rows Receives the door bits in the same layout, or NULL to skip them.
+ */
+void pack_rows(char **matrix, int first_row, int last_row, unsigned long long *open_rows, unsigned long long *door_rows) {
+    for (int row = first_row; row < last_row; row++) {
+        unsigned long long *open = &open_rows[(size_t)row * render_words];
+        for (int word = 0; word < render_words; word++) {
+            unsigned long long open_bits = 0, door_bits = 0;
+            int last = word * 64 + 64 < COLS ? word * 64 + 64 : COLS;
+            for (int col = word * 64; col < last; col++) {
+                char cell = matrix[row][col];
+                open_bits |= (unsigned long long)(cell != CLOSED) << (col & 63);
+                door_bits |= (unsigned long long)(cell == ENTRY || cell == EXIT) << (col & 63);
+            }
+            open[word] = open_bits;
+            if (door_rows != NULL) {
+                door_rows[(size_t)row * render_words + word] = door_bits;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Formats rows with one colored square and a space per cell.
+ * @param matrix The matrix.
+ * @param first_line The first row to format.
+ * @param last_line One past the last row to format.
+ * @param out The buffer to write to.
+ * @return The number of bytes written.
+ */
+size_t render_classic(char **matrix, int first_line, int last_line, char *out) {
+    char *cursor = out;
+    for (int row = first_line; row < last_line; row++) {
+        for (int col = 0; col < COLS; col++) {
+            const char *glyph = " ";
+            switch (matrix[row][col]) {
+                case OPEN:
+                    glyph = ANSI_BRIGHT_WHITE "■" ANSI_RESET " ";
+                    break;
+                case CLOSED:
+                    glyph = ANSI_BRIGHT_BLACK "■" ANSI_RESET " ";
+                    break;
+                case ENTRY:
+                case EXIT:
+                    glyph = ANSI_GREEN "■" ANSI_RESET " ";
+                    break;
+                case PATH:
+                    glyph = ANSI_RED "■" ANSI_RESET " ";
+                    break;
+                case VISITED:
+                    glyph = ANSI_RESET "■ ";
+                    break;
+            }
+            size_t length = strlen(glyph);
+            memcpy(cursor, glyph, length);
+            cursor += length;
+        }
+        *cursor++ = '\n';
+    }
+    return cursor - out;
+}
+
+/**
+ * @brief Appends a color code when a character's color differs from the previous one.
+ * @param cursor Where to write.
+ * @param door Whether the character holds a door.
+ * @param in_door Whether the previous character held a door; updated.
+ * @return The position after the code.
+ */
+char *render_door_color(char *cursor, bool door, bool *in_door) {
+    if (door != *in_door) {
+        const char *code = door ? ANSI_GREEN : ANSI_BRIGHT_WHITE;
+        size_t length = strlen(code);
+        memcpy(cursor, code, length);
+        cursor += length;
+        *in_door = door;
+    }
+    return cursor;
+}
+
+/**
+ * @brief Formats packed rows with one half-block character per column and pair of rows.
+ *
+ * The upper half shows the first row and the lower half the second; open cells are lit.
+ * @param first_line The first pair of rows to format.
+ * @param last_line One past the last pair of rows to format.
+ * @param out The buffer to write to.
+ * @return The number of bytes written.
+ */
+size_t render_half_blocks(int first_line, int last_line, char *out) {
+    char *cursor = out;
+    bool in_door = false;
+    memcpy(cursor, ANSI_BRIGHT_WHITE, sizeof(ANSI_BRIGHT_WHITE) - 1);
+    cursor += sizeof(ANSI_BRIGHT_WHITE) - 1;
+    for (int row = 2 * first_line; row < 2 * last_line && row < ROWS; row += 2) {
+        const unsigned long long *top_open = &render_open[(size_t)row * render_words];
+        const unsigned long long *top_door = &render_door[(size_t)row * render_words];
+        bool has_bottom = row + 1 < ROWS;
+        for (int word = 0; word < render_words; word++) {
+            unsigned long long top = top_open[word];
+            unsigned long long bottom = has_bottom ? top_open[render_words + word] : 0;
+            unsigned long long doors = top_door[word] | (has_bottom ? top_door[render_words + word] : 0);
+            int count = COLS - word * 64 < 64 ? COLS - word * 64 : 64;
+            for (int bit = 0; bit < count; bit++) {
+                cursor = render_door_color(cursor, (doors >> bit) & 1, &in_door);
+                int glyph = (int)((top >> bit) & 1) | (int)((bottom >> bit) & 1) << 1;
+                // The three blocks share their first two UTF-8 bytes
+                if (glyph == 0) {
+                    *cursor++ = ' ';
+                } else {
+                    *cursor++ = (char)0xE2;
+                    *cursor++ = (char)0x96;
+                    *cursor++ = (char)HALF_BLOCK_LAST_BYTE[glyph];
+                }
+            }
+        }
+        *cursor++ = '\n';
+    }
+    return cursor - out;
+}
+
+/**
+ * @brief Formats packed rows with one braille character per 2x4 block of cells; open cells are dots.
+ * @param first_line The first band of four rows to format.
+ * @param last_line One past the last band of four rows to format.
+ * @param out The buffer to write to.
+ * @return The number of bytes written.
+ */
+size_t render_braille(int first_line, int last_line, char *out) {
+    char *cursor = out;
+    bool in_door = false;
+    memcpy(cursor, ANSI_BRIGHT_WHITE, sizeof(ANSI_BRIGHT_WHITE) - 1);
+    cursor += sizeof(ANSI_BRIGHT_WHITE) - 1;
+    for (int row = 4 * first_line; row < 4 * last_line && row < ROWS; row += 4) {
+        int band = ROWS - row < 4 ? ROWS - row : 4;
+        for (int word = 0; word < render_words; word++) {
+            unsigned long long open[4] = {0, 0, 0, 0}, doors = 0;
+            for (int k = 0; k < band; k++) {
+                open[k] = render_open[(size_t)(row + k) * render_words + word];
+                doors |= render_door[(size_t)(row + k) * render_words + word];
+            }
+            int count = COLS - word * 64 < 64 ? COLS - word * 64 : 64;
+            // Column pairs never straddle a word because 64 is even
+            for (int bit = 0; bit < count; bit += 2) {
+                cursor = render_door_color(cursor, (doors >> bit) & 3, &in_door);
+                unsigned int dots = BRAILLE_DOTS[0][(open[0] >> bit) & 3] | BRAILLE_DOTS[1][(open[1] >> bit) & 3] |
+                                    BRAILLE_DOTS[2][(open[2] >> bit) & 3] | BRAILLE_DOTS[3][(open[3] >> bit) & 3];
+                // UTF-8 of U+2800 + dots
+                *cursor++ = (char)0xE2;
+                *cursor++ = (char)(0xA0 | dots >> 6);
+                *cursor++ = (char)(0x80 | (dots & 0x3F));
+            }
+        }
+        *cursor++ = '\n';
+    }
+    return cursor - out;
+}
+
+/**
+ * @brief Returns the pyramid level the zoomed view shows.
+ * @return The chosen level, or the finest level at which the whole room fits the view.
+ */
+int view_zoom_level(void) {
+    int level = view_level;
+    if (level < 0) {
+        level = 0;
+        while (level + 1 < pyramid_levels && (pyramid[level].rows > VIEW_LINES || pyramid[level].cols > VIEW_COLS)) {
+            level++;
+        }
+    }
+    return level < pyramid_levels ? level : pyramid_levels - 1;
+}
+
+/**
+ * @brief Fixes the level, window and door marks of the zoomed view for the next frame.
+ *
+ * The window is clamped to the room, and doors are marked with one pass over the door list,
+ * so the cost depends on the screen and door count, not on the room size.
+ */
+void place_view(void) {
+    PyramidLevel *level;
+    view_zoom = view_zoom_level();
+    level = &pyramid[view_zoom];
+    view_height = level->rows < VIEW_LINES ? level->rows : VIEW_LINES;
+    view_width = level->cols < VIEW_COLS ? level->cols : VIEW_COLS;
+    view_top = view_row >> view_zoom;
+    view_left = view_col >> view_zoom;
+    view_top = view_top > level->rows - view_height ? level->rows - view_height : view_top < 0 ? 0 : view_top;
+    view_left = view_left > level->cols - view_width ? level->cols - view_width : view_left < 0 ? 0 : view_left;
+
+    view_door_stamp++;
+    for (int door = 0; door < NUM_ENTRIES + NUM_EXITS; door++) {
+        int cell = door < NUM_ENTRIES ? entry_cells[door] : exit_cells[door - NUM_ENTRIES];
+        int line = ((cell / COLS) >> view_zoom) - view_top, column = ((cell % COLS) >> view_zoom) - view_left;
+        if (line >= 0 && line < view_height && column >= 0 && column < view_width) {
+            view_door[line * VIEW_COLS + column] = view_door_stamp;
+        }
+    }
+}
+
+/**
+ * @brief Formats lines of the zoomed view, shading each block by its share of open cells.
+ * @param first_line The first view line to format.
+ * @param last_line One past the last view line to format.
+ * @param out The buffer to write to.
+ * @return The number of bytes written.
+ */
+size_t render_zoom(int first_line, int last_line, char *out) {
+    char *cursor = out;
+    bool in_door = false;
+    int side = 1 << view_zoom;
+    memcpy(cursor, ANSI_BRIGHT_WHITE, sizeof(ANSI_BRIGHT_WHITE) - 1);
+    cursor += sizeof(ANSI_BRIGHT_WHITE) - 1;
+    for (int line = first_line; line < last_line; line++) {
+        int block_row = view_top + line;
+        int height = ROWS - block_row * side < side ? ROWS - block_row * side : side;
+        for (int column = 0; column < view_width; column++) {
+            int block_col = view_left + column, count;
+            int width = COLS - block_col * side < side ? COLS - block_col * side : side;
+            if (view_zoom == 0) {
+                count = (int)((pyramid_open[(size_t)block_row * render_words + block_col / 64] >> (block_col & 63)) & 1);
+            } else {
+                count = pyramid[view_zoom].open_count[block_row * pyramid[view_zoom].cols + block_col];
+            }
+            int shade = (count * 4 + height * width - 1) / (height * width);
+            cursor = render_door_color(cursor, view_door[line * VIEW_COLS + column] == view_door_stamp, &in_door);
+            if (shade == 0) {
+                *cursor++ = ' ';
+            } else {
+                *cursor++ = (char)0xE2;
+                *cursor++ = (char)0x96;
+                *cursor++ = (char)SHADE_LAST_BYTE[shade];
+            }
+        }
+        *cursor++ = '\n';
+    }
+    return cursor - out;
+}
+
+/**
+ * @brief Returns the number of terminal columns a frame takes in the current render mode.
+ * @return The width in characters.
+ */
+int render_width(void) {
+    if (RENDER_MODE == RENDER_ZOOM) {
+        return view_width;
+    }
+    return RENDER_MODE == RENDER_HALF ? COLS : RENDER_MODE == RENDER_BRAILLE ? (COLS + 1) / 2 : 2 * COLS;
+}
+
+/**
+ * @brief Returns the number of terminal lines a frame takes in the current render mode, without its title.
+ * @return The height in lines.
+ */
+int render_lines(void) {
+    if (RENDER_MODE == RENDER_ZOOM) {
+        return view_height;
+    }
+    return RENDER_MODE == RENDER_HALF ? (ROWS + 1) / 2 : RENDER_MODE == RENDER_BRAILLE ? (ROWS + 3) / 4 : ROWS;
+}
+
+/**
+ * @brief Worker task: packs and formats one slice of output lines into its own region of the render buffer.
+ *
+ * Each line has a fixed worst-case size, so a slice's region starts at a precomputed offset and
+ * slices never share memory.
+ * @param slice The slice index.
+ * @param worker Unused worker index.
+ * @param context The matrix.
+ */
+void render_slice_task(int slice, int worker, void *context) {
+    (void)worker;
+    char **matrix = (char **)context;
+    int lines = render_lines();
+    int first_line = (int)((long)slice * lines / render_slice_count);
+    int last_line = (int)((long)(slice + 1) * lines / render_slice_count);
+    char *out = render_buffer + render_header_bytes + (size_t)first_line * render_line_bytes;
+    size_t length;
+
+    if (RENDER_MODE == RENDER_CLASSIC) {
+        length = render_classic(matrix, first_line, last_line, out);
+    } else if (RENDER_MODE == RENDER_ZOOM) {
+        length = render_zoom(first_line, last_line, out);
+    } else {
+        int rows_per_line = RENDER_MODE == RENDER_HALF ? 2 : 4;
+        int last_row = last_line * rows_per_line < ROWS ? last_line * rows_per_line : ROWS;
+        pack_rows(matrix, first_line * rows_per_line, last_row, render_open, render_door);
+        length = RENDER_MODE == RENDER_HALF ? render_half_blocks(first_line, last_line, out)
+                                            : render_braille(first_line, last_line, out);
+    }
+    render_iov[slice + 1].iov_base = out;
+    render_iov[slice + 1].iov_len = length;
+}
+
+/**
+ * @brief Formats a frame in the current render mode on the worker pool, with its title and rule.
+ *
+ * The pieces are left in render_iov, ready for one gathered write. The zoomed view needs an
+ * up-to-date pyramid.
+ * @param matrix The matrix.
+ * @param number The frame number shown in the title.
+ * @param length Set to the total number of bytes.
+ * @return The number of entries of render_iov in use.
+ */
+int render_frame(char **matrix, int number, size_t *length) {
+    size_t header;
+    if (RENDER_MODE == RENDER_ZOOM) {
+        place_view();
+        header = (size_t)sprintf(render_buffer, "\nMatrix %d, 1:%d from (%d,%d)\n", number, 1 << view_zoom,
+                                 view_top << view_zoom, view_left << view_zoom);
+    } else {
+        header = (size_t)sprintf(render_buffer, "\nMatrix %d\n", number);
+    }
+    int width = render_width();
+    int lines = render_lines();
+    memset(render_buffer + header, '-', width);
+    header += width;
+    render_buffer[header++] = '\n';
+    render_iov[0].iov_base = render_buffer;
+    render_iov[0].iov_len = header;
+
+    render_slice_count = WORKER_COUNT * RENDER_SLICES_PER_WORKER;
+    if (render_slice_count > RENDER_MAX_SLICES) {
+        render_slice_count = RENDER_MAX_SLICES;
+    }
+    if (render_slice_count > lines) {
+        render_slice_count = lines;
+    }
+    run_on_workers(render_slice_count, render_slice_task, matrix);
+
+    int count = render_slice_count + 1;
+    if (RENDER_MODE != RENDER_CLASSIC) {
+        render_iov[count].iov_base = (void *)ANSI_RESET;
+        render_iov[count++].iov_len = sizeof(ANSI_RESET) - 1;
+    }
+    *length = 0;
+    for (int k = 0; k < count; k++) {
+        *length += render_iov[k].iov_len;
+    }
+    return count;
+}
+
+/**
+ * @brief Writes all pieces of a gathered buffer, resuming after partial writes.
+ * @param fd The file descriptor.
+ * @param iov The pieces; advanced in place on partial writes.
+ * @param count The number of pieces.
+ * @return true if everything was written.
+ */
+bool write_gathered(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            return false;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Displays the matrix (room) on the console.
+ * @param matrix The matrix.
+ */
+void display_matrix(char **matrix) {
+    size_t length;
+    matrix_count++;
+    MAZELOCK_PROBE3(render__start, matrix_count, ROWS, COLS);
+    int count = render_frame(matrix, matrix_count, &length);
+    // Text printed earlier must reach the terminal before the frame
+    fflush(stdout);
+    write_gathered(STDOUT_FILENO, render_iov, count);
+    MAZELOCK_PROBE3(render__done, matrix_count, ROWS, COLS);
+}
+
+/**
+ * @brief Thread function to generate and display the matrix.
+ * @param arg Unused argument.
+ * @return Unused return value.
+ */
+void* matrix_generation_thread_func(void* arg) {
+    (void)arg;
+    active_clock->enter(0);
+    // Generate the initial matrix
+    metrics_lock(&matrix_mutex, HISTOGRAM_LOCK_MATRIX);
+    double start = monotonic_ms();
+    generate_matrix(matrix);
+    last_generate_ms = monotonic_ms() - start;
+    pthread_mutex_unlock(&matrix_mutex);
+    while (active_clock->now_ms() < simulation_end_ms) {
+        metrics_lock(&matrix_mutex, HISTOGRAM_LOCK_MATRIX);
+        start = monotonic_ms();
+        randomize_matrix(matrix, density);
+        last_generate_ms = monotonic_ms() - start;
+        matrix_generation++;
+        // The zoomed view reads the pyramid, which the path thread rebuilds under the same lock
+        if (json_fd < 0 && RENDER_MODE == RENDER_ZOOM) {
+            build_pyramid(matrix);
+            display_matrix(matrix);
+        }
+        pthread_mutex_unlock(&matrix_mutex);
+        MAZELOCK_PROBE3(frame__publish, matrix_generation, ROWS, COLS);
+        if (json_fd < 0 && RENDER_MODE != RENDER_ZOOM) {
+            display_matrix(matrix);
+        }
+        metrics_count(METRIC_FRAMES, 1);
+        active_clock->sleep_until(0, active_clock->now_ms() + 2000.0);
+    }
+    active_clock->leave(0);
+    return NULL;
+}
+
+/**
+ * @brief Performs a depth-first search to find a path through the maze.
+ * @param matrix The matrix.
+ * @param row Row index of the starting cell.
+ * @param col Column index of the starting cell.
+ * @return A Path structure representing the found path, or an invalid path if not found.
+ */
+
+Path dfs(char **matrix, int row, int col) {
+    Path path = {.found = false};
+
+    if (row < 0 || row >= ROWS || col < 0 || col >= COLS) {
+        return path;
+    }
+    if (matrix[row][col] == EXIT) {
+        path.start_x = row;
+        path.start_y = col;
+        path.end_x = row;
+        path.end_y = col;
+        path.found = true;
+        return path;
+    } else if (matrix[row][col] == CLOSED || matrix[row][col] == VISITED) {
+        return path;
+    }
+    matrix[row][col] = VISITED;
+    Path directions[] = {dfs(matrix, row - 1, col), dfs(matrix, row + 1, col),
+                         dfs(matrix, row, col - 1), dfs(matrix, row, col + 1)};
+
+    for (int i = 0; i < 4; i++) {
+        if (directions[i].found) {
+            path.start_x = row;
+            path.start_y = col;
+            path.end_x = directions[i].end_x;
+            path.end_y = directions[i].end_y;
+            path.found = true;
+            break;
+        }
+    }
+
+    return path;
+}
+
+/**
+ * @brief Finds a path through the maze and prints the result.
+ * @param matrix The maze matrix.
+ */
+void find_path(char **matrix) {
+    int entry_row = -1, entry_col = -1;
+    bool entry_found = false;
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            if (row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1) {
+                if (matrix[row][col] == ENTRY) {
+                    entry_row = row;
+                    entry_col = col;
+                    entry_found = true;
+                    break;
+                }
+            }
+        }
+        if (entry_found) {
+            break;
+        }
+    }
+    if (entry_row != -1 && entry_col != -1) {
+        MAZELOCK_PROBE2(dfs__start, entry_row, entry_col);
+        Path path = dfs(matrix, entry_row, entry_col);
+        MAZELOCK_PROBE3(dfs__done, entry_row, entry_col, path.found);
+        if (path.found) {
+            printf("Partial path found from (%d,%d) to (%d,%d)\n", path.start_x, path.start_y, path.end_x, path.end_y);
+        } else {
+            printf("No path found.\n");
+        }
+    } else {
+        printf("Entry point not found.\n");
+    }
+}
+
+/**
+ * @brief Builds the occupancy pyramid of the matrix and labels the connected blocks of the label level.
+ *
+ * Level 1 is read from the packed rows, two bits per row at a time. Each higher level adds up the
+ * open counts of four blocks and keeps an edge link if either half of that edge has one. Block
+ * connectivity over-approximates cell connectivity, so cells in blocks with different labels
+ * cannot reach each other.
+ * @param matrix The matrix.
+ */
+void build_pyramid(char **matrix) {
+    static const unsigned char PAIR_COUNT[4] = {0, 1, 1, 2};
+    double start = monotonic_ms();
+    pack_rows(matrix, 0, ROWS, pyramid_open, NULL);
+
+    PyramidLevel *first = &pyramid[1];
+    for (int block_row = 0; block_row < first->rows; block_row++) {
+        int row = 2 * block_row;
+        const unsigned long long *upper = &pyramid_open[(size_t)row * render_words];
+        const unsigned long long *lower = row + 1 < ROWS ? upper + render_words : NULL;
+        const unsigned long long *below = row + 2 < ROWS ? upper + 2 * render_words : NULL;
+        for (int word = 0; word < render_words; word++) {
+            unsigned long long top = upper[word], bottom = lower ? lower[word] : 0;
+            unsigned long long top_next = word + 1 < render_words ? upper[word + 1] : 0;
+            unsigned long long bottom_next = lower && word + 1 < render_words ? lower[word + 1] : 0;
+            // Bit c of across is set when cells c and c + 1 are open in the same row
+            unsigned long long across = (top & (top >> 1 | top_next << 63)) | (bottom & (bottom >> 1 | bottom_next << 63));
+            unsigned long long down = below ? bottom & below[word] : 0;
+            int last = first->cols - word * 32 < 32 ? first->cols - word * 32 : 32;
+            for (int j = 0; j < last; j++) {
+                int bit = 2 * j, block = block_row * first->cols + word * 32 + j;
+                first->open_count[block] = PAIR_COUNT[(top >> bit) & 3] + PAIR_COUNT[(bottom >> bit) & 3];
+                first->links[block] = (unsigned char)(((across >> (bit + 1)) & 1) * PYRAMID_EAST |
+                                                      (((down >> bit) & 3) != 0) * PYRAMID_SOUTH);
+            }
+        }
+    }
+
+    for (int level = 2; level < pyramid_levels; level++) {
+        PyramidLevel *fine = &pyramid[level - 1], *coarse = &pyramid[level];
+        for (int block_row = 0; block_row < coarse->rows; block_row++) {
+            for (int block_col = 0; block_col < coarse->cols; block_col++) {
+                int count = 0, links = 0;
+                for (int k = 0; k < 4; k++) {
+                    int row = 2 * block_row + k / 2, col = 2 * block_col + k % 2;
+                    if (row >= fine->rows || col >= fine->cols) {
+                        continue;
+                    }
+                    int child = row * fine->cols + col;
+                    count += fine->open_count[child];
+                    // Only the right children hold the east edge and only the bottom children the south edge
+                    links |= fine->links[child] & ((k % 2 ? PYRAMID_EAST : 0) | (k / 2 ? PYRAMID_SOUTH : 0));
+                }
+                coarse->open_count[block_row * coarse->cols + block_col] = count;
+                coarse->links[block_row * coarse->cols + block_col] = (unsigned char)links;
+            }
+        }
+    }
+
+    PyramidLevel *labelled = &pyramid[pyramid_label_level];
+    int blocks = labelled->rows * labelled->cols;
+    for (int block = 0; block < blocks; block++) {
+        pyramid_label[block] = -1;
+    }
+    pyramid_components = 0;
+    for (int seed = 0; seed < blocks; seed++) {
+        if (pyramid_label[seed] != -1 || labelled->open_count[seed] == 0) {
+            continue;
+        }
+        int head = 0, tail = 0;
+        pyramid_label[seed] = pyramid_components;
+        pyramid_queue[tail++] = seed;
+        while (head < tail) {
+            int block = pyramid_queue[head++];
+            int row = block / labelled->cols, col = block % labelled->cols;
+            int neighbours[4] = {
+                labelled->links[block] & PYRAMID_EAST ? block + 1 : -1,
+                col > 0 && labelled->links[block - 1] & PYRAMID_EAST ? block - 1 : -1,
+                labelled->links[block] & PYRAMID_SOUTH ? block + labelled->cols : -1,
+                row > 0 && labelled->links[block - labelled->cols] & PYRAMID_SOUTH ? block - labelled->cols : -1
+            };
+            for (int d = 0; d < 4; d++) {
+                if (neighbours[d] != -1 && pyramid_label[neighbours[d]] == -1) {
+                    pyramid_label[neighbours[d]] = pyramid_components;
+                    pyramid_queue[tail++] = neighbours[d];
+                }
+            }
+        }
+        pyramid_components++;
+    }
+    pyramid_valid = true;
+    pyramid_build_ms = monotonic_ms() - start;
+}
+
+/**
+ * @brief Returns the pyramid label of the block holding a cell.
+ * @param cell The cell index.
+ * @return The label, or -1 if the block has no open cell.
+ */
+int pyramid_label_of(int cell) {
+    int row = (cell / COLS) >> pyramid_label_level, col = (cell % COLS) >> pyramid_label_level;
+    return pyramid_label[row * pyramid[pyramid_label_level].cols + col];
+}
+
+/**
+ * @brief Tells whether the pyramid proves that no path joins two cells.
+ * @param source The source cell.
+ * @param target The target cell.
+ * @return true if the cells lie in blocks that are not connected; false if they may be connected
+ *         or the pyramid is out of date.
+ */
+bool pyramid_rejects(int source, int target) {
+    return pyramid_valid && pyramid_label_of(source) != pyramid_label_of(target);
+}
+
+/**
+ * @brief Prints the pyramid size, build time, block components and the entries it ruled out.
+ */
+void report_pyramid(void) {
+    printf("Pyramid: %d levels, built in %.2f ms, %d connected groups of %dx%d blocks, "
+           "%d entries ruled out before the exit search\n", pyramid_levels, pyramid_build_ms, pyramid_components,
+           1 << pyramid_label_level, 1 << pyramid_label_level, pyramid_rejected_entries);
+}
+
+/**
+ * @brief Finds the nearest exit for every entry with a single multi-source BFS.
+ *
+ * The search is seeded from all exit points at once, so the first exit to reach
+ * an entry is its nearest one. It stops as soon as every entry has been reached. Entries that
+ * an up-to-date occupancy pyramid separates from every exit are not searched for.
+ * @param matrix The maze matrix.
+ * @param nearest_exit Output array of NUM_ENTRIES exit indices, -1 if unreachable.
+ * @param exit_distance Output array of NUM_ENTRIES distances in steps, -1 if unreachable.
+ * @return The number of entries that can reach an exit.
+ */
+int find_nearest_exits(char **matrix, int *nearest_exit, int *exit_distance) {
+    MAZELOCK_PROBE2(nearest__start, NUM_ENTRIES, NUM_EXITS);
+    int cell_count = ROWS * COLS;
+    int head = 0, tail = 0;
+    int remaining = NUM_ENTRIES;
+
+    // Entries whose pyramid block is not connected to any exit's block are not waited for
+    pyramid_rejected_entries = 0;
+    if (pyramid_valid) {
+        pyramid_stamp++;
+        for (int j = 0; j < NUM_EXITS; j++) {
+            pyramid_mark[pyramid_label_of(exit_cells[j])] = pyramid_stamp;
+        }
+    }
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        nearest_exit[i] = -1;
+        exit_distance[i] = -1;
+        if (pyramid_valid && pyramid_mark[pyramid_label_of(entry_cells[i])] != pyramid_stamp) {
+            pyramid_rejected_entries++;
+            remaining--;
+            continue;
+        }
+        bfs_is_target[entry_cells[i]] = true;
+    }
+    int candidates = remaining;
+    if (candidates == 0) {
+        MAZELOCK_PROBE3(nearest__done, NUM_ENTRIES, NUM_EXITS, 0);
+        return 0;
+    }
+    for (int cell = 0; cell < cell_count; cell++) {
+        bfs_distance[cell] = -1;
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        bfs_distance[exit_cells[j]] = 0;
+        bfs_label[exit_cells[j]] = j;
+        bfs_queue[tail++] = exit_cells[j];
+    }
+
+    while (head < tail && remaining > 0) {
+        int cell = bfs_queue[head++];
+        if (bfs_is_target[cell]) {
+            for (int i = 0; i < NUM_ENTRIES; i++) {
+                if (entry_cells[i] == cell) {
+                    nearest_exit[i] = bfs_label[cell];
+                    exit_distance[i] = bfs_distance[cell];
+                    remaining--;
+                }
+            }
+            bfs_is_target[cell] = false;
+        }
+        int row = cell / COLS, col = cell % COLS;
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            if (matrix[next_row][next_col] == CLOSED || bfs_distance[next] != -1) {
+                continue;
+            }
+            bfs_distance[next] = bfs_distance[cell] + 1;
+            bfs_label[next] = bfs_label[cell];
+            bfs_queue[tail++] = next;
+        }
+    }
+
+    // Entries never dequeued keep their flag; clear them for the next search
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        bfs_is_target[entry_cells[i]] = false;
+    }
+    MAZELOCK_PROBE3(nearest__done, NUM_ENTRIES, NUM_EXITS, candidates - remaining);
+    return candidates - remaining;
+}
+
+/**
+ * @brief Prints the nearest exit of every entry point.
+ * @param matrix The maze matrix.
+ */
+void report_nearest_exits(char **matrix) {
+    int nearest_exit[NUM_ENTRIES];
+    int exit_distance[NUM_ENTRIES];
+
+    find_nearest_exits(matrix, nearest_exit, exit_distance);
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        int entry_row = entry_cells[i] / COLS, entry_col = entry_cells[i] % COLS;
+        if (nearest_exit[i] == -1) {
+            printf("Entry %d (%d,%d): no exit reachable.\n", i, entry_row, entry_col);
+        } else {
+            int exit_cell = exit_cells[nearest_exit[i]];
+            printf("Entry %d (%d,%d): nearest exit %d (%d,%d) at distance %d\n", i, entry_row, entry_col,
+                   nearest_exit[i], exit_cell / COLS, exit_cell % COLS, exit_distance[i]);
+        }
+    }
+}
+
+/**
+ * @brief Opens the JSON-lines output. "-" selects standard output.
+ * @param path The file to append to, or "-".
+ * @return true if the output is ready.
+ */
+bool open_json_output(const char *path) {
+    if (strcmp(path, "-") == 0) {
+        fflush(stdout);
+        json_fd = STDOUT_FILENO;
+    } else {
+        json_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (json_fd < 0) {
+            perror("JSON output");
+            return false;
+        }
+    }
+    json_flushed_ms = monotonic_ms();
+    return true;
+}
+
+/**
+ * @brief Writes out what is still buffered and closes the JSON-lines output.
+ */
+void close_json_output(void) {
+    if (json_fd < 0) {
+        return;
+    }
+    json_flush();
+    if (json_fd != STDOUT_FILENO) {
+        close(json_fd);
+    }
+    json_fd = -1;
+}
+
+/**
+ * @brief Writes out the buffered JSON lines. A batch the output does not accept is dropped.
+ */
+void json_flush(void) {
+    int cancel_state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    int sent = 0;
+    while (sent < json_length) {
+        ssize_t written = write(json_fd, json_buffer + sent, json_length - sent);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break;
+        }
+        sent += written;
+    }
+    json_length = 0;
+    json_flushed_ms = monotonic_ms();
+    pthread_setcancelstate(cancel_state, NULL);
+}
+
+/**
+ * @brief Appends literal text, which must already be valid JSON.
+ * @param text The text.
+ */
+void json_text(const char *text) {
+    int length = (int)strlen(text);
+    if (json_length + length > JSON_BUFFER_SIZE) {
+        json_flush();
+    }
+    memcpy(json_buffer + json_length, text, length);
+    json_length += length;
+}
+
+/**
+ * @brief Appends a decimal integer without going through printf.
+ * @param value The integer.
+ */
+void json_integer(long value) {
+    char digits[20];
+    int count = 0;
+    unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    if (json_length + 21 > JSON_BUFFER_SIZE) {
+        json_flush();
+    }
+    if (value < 0) {
+        json_buffer[json_length++] = '-';
+    }
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    while (count > 0) {
+        json_buffer[json_length++] = digits[--count];
+    }
+}
+
+/**
+ * @brief Appends an object key and its colon, preceded by a comma unless the object has just opened.
+ * @param key The key, which needs no escaping.
+ */
+void json_key(const char *key) {
+    if (json_length > 0 && json_buffer[json_length - 1] != '{') {
+        json_text(",");
+    }
+    json_text("\"");
+    json_text(key);
+    json_text("\":");
+}
+
+/**
+ * @brief Appends one frame's JSON object and flushes when the batch is large or a second old.
+ * @param frame The frame number.
+ * @param nearest_exit The nearest exit of every entry, -1 if unreachable.
+ * @param exit_distance The distance from every entry to its nearest exit, -1 if unreachable.
+ * @param stage_ms The duration of every stage in milliseconds.
+ */
+void write_frame_json(long frame, int *nearest_exit, int *exit_distance, const double *stage_ms) {
+    int reachable_entries = 0, path_length = -1;
+    double total_ms = 0;
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        if (exit_distance[i] != -1) {
+            reachable_entries++;
+            if (path_length == -1 || exit_distance[i] < path_length) {
+                path_length = exit_distance[i];
+            }
+        }
+    }
+
+    json_text("{");
+    json_key("frame");
+    json_integer(frame);
+    json_key("seed");
+    json_integer(run_seed);
+    json_key("rows");
+    json_integer(ROWS);
+    json_key("cols");
+    json_integer(COLS);
+    json_key("density");
+    long permille = (long)(density * 1000.0 + 0.5);
+    char fraction[5] = {'.', (char)('0' + permille / 100 % 10), (char)('0' + permille / 10 % 10),
+                        (char)('0' + permille % 10), '\0'};
+    json_integer(permille / 1000);
+    json_text(fraction);
+    json_key("entries");
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        json_text(i == 0 ? "[[" : ",[");
+        json_integer(entry_cells[i] / COLS);
+        json_text(",");
+        json_integer(entry_cells[i] % COLS);
+        json_text("]");
+    }
+    json_text("]");
+    json_key("exits");
+    for (int j = 0; j < NUM_EXITS; j++) {
+        json_text(j == 0 ? "[[" : ",[");
+        json_integer(exit_cells[j] / COLS);
+        json_text(",");
+        json_integer(exit_cells[j] % COLS);
+        json_text("]");
+    }
+    json_text("]");
+    json_key("nearest_exit");
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        json_text(i == 0 ? "[" : ",");
+        json_integer(nearest_exit[i]);
+    }
+    json_text("]");
+    json_key("exit_distance");
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        json_text(i == 0 ? "[" : ",");
+        json_integer(exit_distance[i]);
+    }
+    json_text("]");
+    json_key("reachable_entries");
+    json_integer(reachable_entries);
+    json_key("path_length");
+    json_integer(path_length);
+    json_key("articulation_points");
+    json_integer(articulation_count);
+    json_key("min_cut");
+    json_integer(min_cut_size);
+    json_key("stage_us");
+    json_text("{");
+    for (int stage = 0; stage < JSON_STAGE_COUNT; stage++) {
+        json_key(JSON_STAGE_NAMES[stage]);
+        json_integer((long)(stage_ms[stage] * 1000.0 + 0.5));
+        if (stage != JSON_STAGE_GENERATE) {
+            total_ms += stage_ms[stage];
+        }
+    }
+    json_key("analysis");
+    json_integer((long)(total_ms * 1000.0 + 0.5));
+    json_text("}}\n");
+
+    if (json_length >= JSON_BUFFER_SIZE / 2 || monotonic_ms() - json_flushed_ms >= JSON_FLUSH_MS) {
+        json_flush();
+    }
+}
+
+/**
+ * @brief Runs the frame analysis stages without text reports, timing each, and writes the frame as JSON.
+ *
+ * The pyramid must already be built for this frame.
+ * @param matrix The maze matrix.
+ */
+void analyze_frame_json(char **matrix) {
+    int nearest_exit[NUM_ENTRIES], exit_distance[NUM_ENTRIES];
+    double stage_ms[JSON_STAGE_COUNT] = {0};
+    double start;
+
+    stage_ms[JSON_STAGE_GENERATE] = last_generate_ms;
+    stage_ms[JSON_STAGE_PYRAMID] = pyramid_build_ms;
+    start = monotonic_ms();
+    find_nearest_exits(matrix, nearest_exit, exit_distance);
+    stage_ms[JSON_STAGE_NEAREST] = monotonic_ms() - start;
+    if (NUM_ENTRIES + NUM_EXITS > 2) {
+        start = monotonic_ms();
+        compute_door_distances(matrix);
+        stage_ms[JSON_STAGE_DOORS] = monotonic_ms() - start;
+    }
+    start = monotonic_ms();
+    analyze_articulation_points(matrix);
+    stage_ms[JSON_STAGE_ARTICULATION] = monotonic_ms() - start;
+    start = monotonic_ms();
+    find_minimum_cut(matrix);
+    stage_ms[JSON_STAGE_MIN_CUT] = monotonic_ms() - start;
+    build_landmarks(matrix);
+    stage_ms[JSON_STAGE_LANDMARKS] = landmark_build_ms;
+    build_contraction_hierarchy(matrix);
+    stage_ms[JSON_STAGE_HIERARCHY] = ch_build_ms;
+    write_frame_json(matrix_generation, nearest_exit, exit_distance, stage_ms);
+}
+
+/**
+ * @brief Opens a recording and its index at path.idx and writes their headers.
+ *
+ * Frames are recorded as rows of 64-bit words, like the render buffers, so this is
+ * called after allocate_matrix.
+ * @param path The recording file.
+ * @return true on success, false if either file cannot be created.
+ */
+bool open_recording(const char *path) {
+    char index_path[PATH_MAX];
+    if (snprintf(index_path, sizeof(index_path), "%s.idx", path) >= (int)sizeof(index_path)) {
+        fprintf(stderr, "Recording path %s is too long\n", path);
+        return false;
+    }
+    record_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    record_index_fd = record_fd < 0 ? -1 : open(index_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (record_index_fd < 0) {
+        perror("recording");
+        if (record_fd >= 0) {
+            close(record_fd);
+            record_fd = -1;
+        }
+        return false;
+    }
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORD_MAGIC, 8);
+    header.rows = ROWS;
+    header.cols = COLS;
+    header.entries = NUM_ENTRIES;
+    header.exits = NUM_EXITS;
+    RecordIndexHeader index_header;
+    memset(&index_header, 0, sizeof(index_header));
+    memcpy(index_header.magic, RECORD_INDEX_MAGIC, 8);
+    index_header.entry_size = sizeof(RecordIndexEntry);
+    index_header.block_frames = RECORD_INDEX_BLOCK;
+    struct iovec header_iov = {&header, sizeof(header)};
+    struct iovec index_iov = {&index_header, sizeof(index_header)};
+    write_gathered(record_fd, &header_iov, 1);
+    write_gathered(record_index_fd, &index_iov, 1);
+    record_offset = sizeof(header);
+    record_frames = record_delta_frames = 0;
+
+    size_t words = (size_t)ROWS * render_words;
+    record_current = (unsigned long long *)tracked_malloc(MEMORY_RUNTIME, words * sizeof(unsigned long long));
+    record_previous = (unsigned long long *)tracked_malloc(MEMORY_RUNTIME, words * sizeof(unsigned long long));
+    record_delta_index = (int *)tracked_malloc(MEMORY_RUNTIME, words * sizeof(int));
+    record_delta_words = (unsigned long long *)tracked_malloc(MEMORY_RUNTIME, words * sizeof(unsigned long long));
+    return true;
+}
+
+/**
+ * @brief Packs the open cells of a matrix into render_words words per row, one bit per cell.
+ * @param matrix The maze matrix.
+ * @param words Receives ROWS * render_words words.
+ * @return The number of open cells.
+ */
+long pack_open_cells(char **matrix, unsigned long long *words) {
+    long open_cells = 0;
+    for (int row = 0; row < ROWS; row++) {
+        unsigned long long *open = &words[(size_t)row * render_words];
+        for (int word = 0; word < render_words; word++) {
+            unsigned long long bits = 0;
+            int last = word * 64 + 64 < COLS ? word * 64 + 64 : COLS;
+            for (int col = word * 64; col < last; col++) {
+                bits |= (unsigned long long)(matrix[row][col] != CLOSED) << (col & 63);
+            }
+            open[word] = bits;
+            open_cells += __builtin_popcountll(bits);
+        }
+    }
+    return open_cells;
+}
+
+/**
+ * @brief FNV-1a over packed open cells.
+ * @param words The packed rows.
+ * @param count The number of words.
+ * @return The hash, to be extended with the door cells.
+ */
+unsigned long long fingerprint_words(const unsigned long long *words, size_t count) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t word = 0; word < count; word++) {
+        hash = (hash ^ words[word]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief FNV-1a over the packed open cells of a frame, then its door cells.
+ * @param words The packed rows.
+ * @param count The number of words.
+ * @return The fingerprint.
+ */
+unsigned long long record_fingerprint(const unsigned long long *words, size_t count) {
+    unsigned long long hash = fingerprint_words(words, count);
+    for (int door = 0; door < NUM_ENTRIES; door++) {
+        hash = (hash ^ (unsigned int)entry_cells[door]) * 1099511628211ULL;
+    }
+    for (int door = 0; door < NUM_EXITS; door++) {
+        hash = (hash ^ (unsigned int)exit_cells[door]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Appends the current frame to the recording and its entry to the index.
+ *
+ * Called by the path thread under the matrix lock, after the frame analysis and
+ * before the path is drawn into the matrix. A frame becomes a delta when the changed
+ * words take less room than the whole frame and the last keyframe is fewer than
+ * RECORD_KEYFRAME_INTERVAL frames back.
+ * @param matrix The maze matrix.
+ */
+void record_frame(char **matrix) {
+    if (record_fd < 0) {
+        return;
+    }
+    int cancel_state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    size_t words = (size_t)ROWS * render_words;
+    RecordIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.metrics[RECORD_METRIC_OPEN] = (int)pack_open_cells(matrix, record_current);
+
+    int changed = 0;
+    bool keyframe = record_frames == 0 || record_since_keyframe + 1 >= RECORD_KEYFRAME_INTERVAL;
+    if (!keyframe) {
+        for (size_t word = 0; word < words; word++) {
+            if (record_current[word] != record_previous[word]) {
+                record_delta_index[changed] = (int)word;
+                record_delta_words[changed++] = record_current[word] ^ record_previous[word];
+            }
+        }
+        // Each changed word costs its index as well
+        keyframe = changed * (sizeof(int) + sizeof(unsigned long long)) >= words * sizeof(unsigned long long);
+    }
+    RecordFrameHeader frame = {keyframe ? RECORD_KEYFRAME : RECORD_DELTA, keyframe ? (int)words : changed};
+    struct iovec iov[5] = {
+        {&frame, sizeof(frame)},
+        {entry_cells, NUM_ENTRIES * sizeof(int)},
+        {exit_cells, NUM_EXITS * sizeof(int)},
+        {keyframe ? (void *)record_current : (void *)record_delta_index,
+         keyframe ? words * sizeof(unsigned long long) : changed * sizeof(int)},
+        {record_delta_words, changed * sizeof(unsigned long long)}
+    };
+    int count = keyframe ? 4 : 5;
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+        bytes += iov[i].iov_len;
+    }
+    if (keyframe) {
+        record_keyframe_offset = record_offset;
+        record_since_keyframe = 0;
+    } else {
+        record_since_keyframe++;
+        record_delta_frames++;
+    }
+
+    entry.offset = record_offset;
+    entry.keyframe_offset = record_keyframe_offset;
+    entry.fingerprint = record_fingerprint(record_current, words);
+    entry.generation = matrix_generation;
+    entry.keyframe_distance = record_since_keyframe;
+    entry.metrics[RECORD_METRIC_REGIONS] = pyramid_components;
+    entry.metrics[RECORD_METRIC_ARTICULATION] = articulation_count;
+    entry.metrics[RECORD_METRIC_BLOCKS] = block_count;
+    entry.metrics[RECORD_METRIC_MIN_CUT] = min_cut_size;
+    struct iovec entry_iov = {&entry, sizeof(entry)};
+    if (!write_gathered(record_fd, iov, count) || !write_gathered(record_index_fd, &entry_iov, 1)) {
+        perror("recording");
+        close(record_fd);
+        close(record_index_fd);
+        record_fd = record_index_fd = -1;
+        pthread_setcancelstate(cancel_state, NULL);
+        return;
+    }
+    record_offset += bytes;
+
+    long block = record_frames / RECORD_INDEX_BLOCK;
+    if (block >= record_summary_capacity) {
+        record_summary_capacity = record_summary_capacity ? 2 * record_summary_capacity : 64;
+        record_summaries = (RecordBlockSummary *)tracked_realloc(MEMORY_RUNTIME, record_summaries,
+                                                                 record_summary_capacity * sizeof(RecordBlockSummary));
+    }
+    RecordBlockSummary *summary = &record_summaries[block];
+    for (int metric = 0; metric < RECORD_METRIC_COUNT; metric++) {
+        int value = entry.metrics[metric];
+        bool first = record_frames % RECORD_INDEX_BLOCK == 0;
+        summary->min[metric] = first || value < summary->min[metric] ? value : summary->min[metric];
+        summary->max[metric] = first || value > summary->max[metric] ? value : summary->max[metric];
+    }
+    record_frames++;
+    unsigned long long *swap = record_previous;
+    record_previous = record_current;
+    record_current = swap;
+    pthread_setcancelstate(cancel_state, NULL);
+}
+
+/**
+ * @brief Appends the block summaries to the index, fills in its header and closes the recording.
+ */
+void close_recording(void) {
+    if (record_fd < 0) {
+        return;
+    }
+    long blocks = (record_frames + RECORD_INDEX_BLOCK - 1) / RECORD_INDEX_BLOCK;
+    RecordIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORD_INDEX_MAGIC, 8);
+    header.entry_size = sizeof(RecordIndexEntry);
+    header.block_frames = RECORD_INDEX_BLOCK;
+    header.frames = record_frames;
+    header.summary_offset = sizeof(header) + record_frames * sizeof(RecordIndexEntry);
+    struct iovec summary_iov = {record_summaries, blocks * sizeof(RecordBlockSummary)};
+    if (!write_gathered(record_index_fd, &summary_iov, 1) ||
+        pwrite(record_index_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        perror("recording index");
+    }
+    close(record_fd);
+    close(record_index_fd);
+    record_fd = record_index_fd = -1;
+    tracked_free(record_current);
+    tracked_free(record_previous);
+    tracked_free(record_delta_index);
+    tracked_free(record_delta_words);
+    tracked_free(record_summaries);
+    record_summaries = NULL;
+    record_summary_capacity = 0;
+}
+
+/**
+ * @brief Maps a whole file read-only.
+ * @param path The file.
+ * @param size Set to the file size.
+ * @return The mapping, or NULL if the file cannot be opened or mapped.
+ */
+const unsigned char *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    *size = (size_t)info.st_size;
+    void *mapping = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+    return (const unsigned char *)mapping;
+}
+
+/**
+ * @brief Prints the index entry of one frame.
+ * @param frame The frame number in the recording, from 1.
+ * @param entry Its index entry.
+ */
+void print_record_entry(long frame, const RecordIndexEntry *entry) {
+    printf("Frame %ld (room %ld, fingerprint %016llx):", frame, entry->generation, entry->fingerprint);
+    for (int metric = 0; metric < RECORD_METRIC_COUNT; metric++) {
+        printf(" %s=%d", RECORD_METRIC_NAMES[metric], entry->metrics[metric]);
+    }
+    putchar('\n');
+}
+
+/**
+ * @brief Compares a metric value with a bound.
+ * @param value The value.
+ * @param op '<', '>' or '='.
+ * @param bound The bound.
+ * @return true if the comparison holds.
+ */
+bool record_value_matches(int value, char op, int bound) {
+    return op == '<' ? value < bound : op == '>' ? value > bound : value == bound;
+}
+
+/**
+ * @brief Checks door cells read from a recording: each must lie on the edge of the room.
+ * @param doors The door cells, possibly unaligned.
+ * @param rows The number of rows of the recorded room.
+ * @param cols The number of columns of the recorded room.
+ * @param count The number of door cells.
+ * @return true if every door cell is an edge cell.
+ */
+bool record_doors_valid(const unsigned char *doors, int rows, int cols, int count) {
+    for (int door = 0; door < count; door++) {
+        int cell;
+        memcpy(&cell, doors + door * sizeof(int), sizeof(int));
+        if (cell < 0 || cell >= rows * cols) {
+            return false;
+        }
+        int row = cell / cols, col = cell % cols;
+        if (row != 0 && row != rows - 1 && col != 0 && col != cols - 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Seeks to one frame of a recording and displays it, or lists the frames matching a metric.
+ *
+ * Both files are mapped, so only the pages touched are read. A seek reads one index
+ * entry, then decodes from the frame's keyframe up to the frame and checks the
+ * fingerprint. A search reads only the index blocks whose summary admits a match.
+ * Every size, offset, word index and door cell read from the files is checked before
+ * it is used, and a file that fails a check is rejected.
+ * @param path The recording file; the index is path.idx.
+ * @param query A frame number from 1, or a metric, one of '<', '=', '>' and a value, e.g. "min_cut=0".
+ * @return 0 on success, 1 if the recording or the query is unusable.
+ */
+int play_recording(const char *path, const char *query) {
+    char index_path[PATH_MAX];
+    size_t record_size = 0, index_size = 0;
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    const unsigned char *recording = map_file(path, &record_size);
+    const unsigned char *index = recording == NULL ? NULL : map_file(index_path, &index_size);
+    if (index == NULL) {
+        if (recording != NULL) {
+            munmap((void *)recording, record_size);
+        }
+        return 1;
+    }
+    const RecordHeader *header = (const RecordHeader *)recording;
+    const RecordIndexHeader *index_header = (const RecordIndexHeader *)index;
+    bool valid = record_size >= sizeof(RecordHeader) && index_size >= sizeof(RecordIndexHeader) &&
+                 memcmp(header->magic, RECORD_MAGIC, 8) == 0 && memcmp(index_header->magic, RECORD_INDEX_MAGIC, 8) == 0 &&
+                 index_header->entry_size == (int)sizeof(RecordIndexEntry) &&
+                 index_header->block_frames == RECORD_INDEX_BLOCK;
+    // The room must be one the simulation could have recorded
+    valid = valid && header->rows > 0 && header->cols > 0 && (long)header->rows * header->cols <= INT_MAX &&
+            header->entries > 0 && header->exits > 0 &&
+            (long)header->entries + header->exits <= 2L * header->rows + 2L * header->cols - 4 &&
+            (size_t)header->rows * ((header->cols + 63) / 64) * sizeof(unsigned long long) <= record_size;
+    // An index that was never closed has no summaries, but its entries are complete up to the last one
+    const RecordIndexEntry *entries = (const RecordIndexEntry *)(index + sizeof(RecordIndexHeader));
+    const RecordBlockSummary *summaries = NULL;
+    long frames = (long)((index_size - sizeof(RecordIndexHeader)) / sizeof(RecordIndexEntry));
+    if (valid && index_header->summary_offset != 0) {
+        long blocks = (index_header->frames + RECORD_INDEX_BLOCK - 1) / RECORD_INDEX_BLOCK;
+        valid = index_header->frames >= 0 && index_header->frames <= frames &&
+                index_header->summary_offset >= (long)sizeof(RecordIndexHeader) +
+                                                index_header->frames * (long)sizeof(RecordIndexEntry) &&
+                index_header->summary_offset <= (long)index_size && index_header->summary_offset % 8 == 0 &&
+                blocks <= ((long)index_size - index_header->summary_offset) / (long)sizeof(RecordBlockSummary);
+        frames = index_header->frames;
+        summaries = (const RecordBlockSummary *)(index + index_header->summary_offset);
+    }
+    if (!valid) {
+        fprintf(stderr, "%s is not a recording with an index\n", path);
+        munmap((void *)recording, record_size);
+        munmap((void *)index, index_size);
+        return 1;
+    }
+
+    char *end;
+    long frame = strtol(query, &end, 10);
+    int status = 0;
+    if (*end != '\0') {
+        int metric = 0;
+        size_t name_length = 0;
+        for (; metric < RECORD_METRIC_COUNT; metric++) {
+            name_length = strlen(RECORD_METRIC_NAMES[metric]);
+            if (strncmp(query, RECORD_METRIC_NAMES[metric], name_length) == 0 &&
+                strchr("<=>", query[name_length]) != NULL && query[name_length] != '\0') {
+                break;
+            }
+        }
+        if (metric == RECORD_METRIC_COUNT) {
+            fprintf(stderr, "Unknown query '%s', expected a frame number or a metric (open, regions, "
+                    "articulation, blocks, min_cut) followed by <, = or > and a value\n", query);
+            status = 1;
+        } else {
+            char op = query[name_length];
+            int bound = atoi(query + name_length + 1);
+            long matches = 0, blocks = (frames + RECORD_INDEX_BLOCK - 1) / RECORD_INDEX_BLOCK, blocks_read = 0;
+            for (long block = 0; block < blocks; block++) {
+                if (summaries != NULL) {
+                    const RecordBlockSummary *summary = &summaries[block];
+                    bool possible = op == '<' ? summary->min[metric] < bound
+                                  : op == '>' ? summary->max[metric] > bound
+                                  : summary->min[metric] <= bound && bound <= summary->max[metric];
+                    if (!possible) {
+                        continue;
+                    }
+                }
+                blocks_read++;
+                long last = (block + 1) * RECORD_INDEX_BLOCK < frames ? (block + 1) * RECORD_INDEX_BLOCK : frames;
+                for (long position = block * RECORD_INDEX_BLOCK; position < last; position++) {
+                    if (record_value_matches(entries[position].metrics[metric], op, bound)) {
+                        if (matches++ < RECORD_MATCHES_SHOWN) {
+                            print_record_entry(position + 1, &entries[position]);
+                        }
+                    }
+                }
+            }
+            printf("%ld of %ld frames match %s; %ld of %ld index blocks read\n", matches, frames, query, blocks_read,
+                   blocks);
+        }
+        munmap((void *)recording, record_size);
+        munmap((void *)index, index_size);
+        return status;
+    }
+    if (frame < 1 || frame > frames) {
+        fprintf(stderr, "%s holds frames 1 to %ld\n", path, frames);
+        munmap((void *)recording, record_size);
+        munmap((void *)index, index_size);
+        return 1;
+    }
+
+    ROWS = header->rows;
+    COLS = header->cols;
+    NUM_ENTRIES = header->entries;
+    NUM_EXITS = header->exits;
+    WORKER_COUNT = 1;
+    allocate_matrix(ROWS, COLS);
+    start_worker_pool(WORKER_COUNT);
+    size_t words = (size_t)ROWS * render_words, door_bytes = (size_t)(NUM_ENTRIES + NUM_EXITS) * sizeof(int);
+    unsigned long long *bits = (unsigned long long *)tracked_malloc(MEMORY_RUNTIME, words * sizeof(unsigned long long));
+    const RecordIndexEntry *entry = &entries[frame - 1];
+    // Decoding starts at a keyframe and stops exactly at the frame, so the offsets must be ordered
+    valid = entry->keyframe_offset >= (long)sizeof(RecordHeader) && entry->keyframe_offset <= entry->offset &&
+            entry->offset < (long)record_size;
+    size_t position = valid ? (size_t)entry->keyframe_offset : record_size;
+    long decoded = 0;
+    size_t decoded_end = position;
+    while (valid) {
+        RecordFrameHeader record;
+        if (position > record_size || record_size - position < sizeof(record) + door_bytes) {
+            status = 1;
+            break;
+        }
+        memcpy(&record, recording + position, sizeof(record));
+        const unsigned char *doors = recording + position + sizeof(record);
+        const unsigned char *payload = doors + door_bytes;
+        bool keyframe = record.kind == RECORD_KEYFRAME;
+        valid = (keyframe && (size_t)record.words == words) ||
+                (record.kind == RECORD_DELTA && decoded > 0 && record.words >= 0 && (size_t)record.words <= words);
+        if (!valid) {
+            break;
+        }
+        size_t payload_bytes = keyframe ? words * sizeof(unsigned long long)
+                                        : record.words * (sizeof(int) + sizeof(unsigned long long));
+        if (record_size - position - sizeof(record) - door_bytes < payload_bytes) {
+            status = 1;
+            break;
+        }
+        if (keyframe) {
+            memcpy(bits, payload, payload_bytes);
+        } else {
+            for (int change = 0; change < record.words && valid; change++) {
+                int word;
+                unsigned long long delta;
+                memcpy(&word, payload + change * sizeof(int), sizeof(int));
+                memcpy(&delta, payload + record.words * sizeof(int) + change * sizeof(delta), sizeof(delta));
+                valid = word >= 0 && (size_t)word < words;
+                if (valid) {
+                    bits[word] ^= delta;
+                }
+            }
+        }
+        decoded++;
+        decoded_end = position + sizeof(record) + door_bytes + payload_bytes;
+        if (position == (size_t)entry->offset) {
+            valid = valid && record_doors_valid(doors, ROWS, COLS, NUM_ENTRIES + NUM_EXITS);
+            if (valid) {
+                memcpy(entry_cells, doors, NUM_ENTRIES * sizeof(int));
+                memcpy(exit_cells, doors + NUM_ENTRIES * sizeof(int), NUM_EXITS * sizeof(int));
+            }
+            break;
+        }
+        position = decoded_end;
+        valid = valid && position <= (size_t)entry->offset;
+    }
+
+    if (!valid) {
+        fprintf(stderr, "%s is not a recording with an index\n", path);
+        status = 1;
+    } else if (status != 0) {
+        fprintf(stderr, "Recording %s ends before frame %ld\n", path, frame);
+    } else {
+        print_record_entry(frame, entry);
+        bool intact = record_fingerprint(bits, words) == entry->fingerprint;
+        printf("Decoded %ld records from %zu bytes of the recording, fingerprint %s\n", decoded,
+               decoded_end - (size_t)entry->keyframe_offset, intact ? "matches" : "differs");
+        for (int row = 0; row < ROWS; row++) {
+            for (int col = 0; col < COLS; col++) {
+                bool open = (bits[(size_t)row * render_words + col / 64] >> (col & 63)) & 1;
+                matrix[row][col] = open ? OPEN : CLOSED;
+            }
+        }
+        for (int door = 0; door < NUM_ENTRIES; door++) {
+            matrix[entry_cells[door] / COLS][entry_cells[door] % COLS] = ENTRY;
+        }
+        for (int door = 0; door < NUM_EXITS; door++) {
+            matrix[exit_cells[door] / COLS][exit_cells[door] % COLS] = EXIT;
+        }
+        if (RENDER_MODE == RENDER_ZOOM) {
+            build_pyramid(matrix);
+        }
+        display_matrix(matrix);
+        status = intact ? 0 : 1;
+    }
+    tracked_free(bits);
+    stop_worker_pool();
+    free_matrix(ROWS);
+    munmap((void *)recording, record_size);
+    munmap((void *)index, index_size);
+    return status;
+}
+
+/**
+ * @brief Thread function to find paths through the matrix.
+ * @param arg Unused argument.
+ * @return Unused return value.
+ */
+void *path_finding_thread_func(void *arg) {
+    (void)arg;
+    active_clock->enter(1);
+    while (active_clock->now_ms() < simulation_end_ms) {
+        metrics_lock(&matrix_mutex, HISTOGRAM_LOCK_MATRIX);
+        double start = monotonic_ms();
+        build_pyramid(matrix);
+        if (json_fd >= 0) {
+            analyze_frame_json(matrix);
+            record_frame(matrix);
+            metrics_observe(HISTOGRAM_FRAME_ANALYSIS, (monotonic_ms() - start) / 1000.0);
+            pthread_mutex_unlock(&matrix_mutex);
+            active_clock->sleep_until(1, active_clock->now_ms() + 2000.0);
+            continue;
+        }
+        report_nearest_exits(matrix);
+        report_pyramid();
+        if (NUM_ENTRIES + NUM_EXITS > 2) {
+            compute_door_distances(matrix);
+            report_door_distances();
+        }
+        analyze_articulation_points(matrix);
+        report_articulation_points();
+        find_minimum_cut(matrix);
+        report_minimum_cut();
+        build_landmarks(matrix);
+        report_landmark_queries(matrix);
+        build_contraction_hierarchy(matrix);
+        report_contraction_hierarchy();
+        report_wall_follower(matrix);
+        if (INGEST_RATE > 0) {
+            report_ingestion();
+        }
+        record_frame(matrix);
+        find_path(matrix);
+        metrics_observe(HISTOGRAM_FRAME_ANALYSIS, (monotonic_ms() - start) / 1000.0);
+        pthread_mutex_unlock(&matrix_mutex);
+        active_clock->sleep_until(1, active_clock->now_ms() + 2000.0);
+    }
+    active_clock->leave(1);
+    return NULL;
+}
+
+/**
+ * @brief Main loop of a worker pool thread.
+ * @param arg The worker index, cast to a pointer.
+ * @return Unused return value.
+ */
+void *worker_thread_func(void *arg) {
+    int worker = (int)(long)arg;
+    unsigned long seen_job = 0;
+
+    while (true) {
+        pthread_mutex_lock(&worker_pool.mutex);
+        while (!worker_pool.shutting_down && worker_pool.job_number == seen_job) {
+            pthread_cond_wait(&worker_pool.job_ready, &worker_pool.mutex);
+        }
+        if (worker_pool.shutting_down) {
+            pthread_mutex_unlock(&worker_pool.mutex);
+            return NULL;
+        }
+        seen_job = worker_pool.job_number;
+        pthread_mutex_unlock(&worker_pool.mutex);
+
+        int index;
+        while ((index = __atomic_fetch_add(&worker_pool.next_task, 1, __ATOMIC_RELAXED)) < worker_pool.task_count) {
+            worker_pool.task(index, worker, worker_pool.context);
+        }
+
+        pthread_mutex_lock(&worker_pool.mutex);
+        if (--worker_pool.busy_workers == 0) {
+            pthread_cond_broadcast(&worker_pool.job_done);
+        }
+        pthread_mutex_unlock(&worker_pool.mutex);
+    }
+}
+
+/**
+ * @brief Starts the worker pool threads.
+ * @param thread_count The number of worker threads.
+ */
+void start_worker_pool(int thread_count) {
+    worker_pool.thread_count = thread_count;
+    worker_pool.threads = (pthread_t *)tracked_malloc(MEMORY_RUNTIME, thread_count * sizeof(pthread_t));
+    pthread_mutex_init(&worker_pool.mutex, NULL);
+    pthread_cond_init(&worker_pool.job_ready, NULL);
+    pthread_cond_init(&worker_pool.job_done, NULL);
+    for (int worker = 0; worker < thread_count; worker++) {
+        pthread_create(&worker_pool.threads[worker], NULL, worker_thread_func, (void *)(long)worker);
+    }
+}
+
+/**
+ * @brief Stops and joins the worker pool threads.
+ */
+void stop_worker_pool(void) {
+    pthread_mutex_lock(&worker_pool.mutex);
+    worker_pool.shutting_down = true;
+    pthread_cond_broadcast(&worker_pool.job_ready);
+    pthread_mutex_unlock(&worker_pool.mutex);
+    for (int worker = 0; worker < worker_pool.thread_count; worker++) {
+        pthread_join(worker_pool.threads[worker], NULL);
+    }
+    pthread_cond_destroy(&worker_pool.job_ready);
+    pthread_cond_destroy(&worker_pool.job_done);
+    pthread_mutex_destroy(&worker_pool.mutex);
+    tracked_free(worker_pool.threads);
+}
+
+/**
+ * @brief Runs task(index, worker, context) for every index in [0, task_count) on the pool.
+ *
+ * Blocks until all tasks are done. Jobs from different threads are run one after the other.
+ * Cancellation is held off while a job is in flight so the pool mutex is never left locked.
+ * @param task_count The number of task indices.
+ * @param task The task function.
+ * @param context Shared argument passed to every task call.
+ */
+void run_on_workers(int task_count, WorkerTask task, void *context) {
+    int cancel_state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+
+    pthread_mutex_lock(&worker_pool.mutex);
+    while (worker_pool.job_active) {
+        pthread_cond_wait(&worker_pool.job_done, &worker_pool.mutex);
+    }
+    worker_pool.job_active = true;
+    worker_pool.task = task;
+    worker_pool.context = context;
+    worker_pool.task_count = task_count;
+    worker_pool.next_task = 0;
+    worker_pool.busy_workers = worker_pool.thread_count;
+    worker_pool.job_number++;
+    pthread_cond_broadcast(&worker_pool.job_ready);
+    while (worker_pool.busy_workers > 0) {
+        pthread_cond_wait(&worker_pool.job_done, &worker_pool.mutex);
+    }
+    worker_pool.job_active = false;
+    pthread_cond_broadcast(&worker_pool.job_done);
+    pthread_mutex_unlock(&worker_pool.mutex);
+
+    pthread_setcancelstate(cancel_state, NULL);
+}
+
+/**
+ * @brief Worker task: BFS from one door, filling its row of the door distance matrix.
+ *
+ * Only doors with a higher index are targets, the lower triangle is filled by symmetry.
+ * The search stops once all of them have been reached.
+ * @param door The source door index (entries first, then exits).
+ * @param worker The worker running the task, selects the scratch buffers.
+ * @param context The maze matrix.
+ */
+void door_distance_task(int door, int worker, void *context) {
+    char **matrix = (char **)context;
+    int door_count = NUM_ENTRIES + NUM_EXITS;
+    int *distance = worker_scratch[worker].distance;
+    int *queue = worker_scratch[worker].queue;
+    int source = door < NUM_ENTRIES ? entry_cells[door] : exit_cells[door - NUM_ENTRIES];
+    int remaining = door_count - door - 1;
+    int head = 0, tail = 0;
+
+    for (int cell = 0; cell < ROWS * COLS; cell++) {
+        distance[cell] = -1;
+    }
+    for (int other = door + 1; other < door_count; other++) {
+        door_distances[door * door_count + other] = -1;
+        door_distances[other * door_count + door] = -1;
+    }
+    door_distances[door * door_count + door] = 0;
+    distance[source] = 0;
+    queue[tail++] = source;
+
+    while (head < tail && remaining > 0) {
+        int cell = queue[head++];
+        int row = cell / COLS, col = cell % COLS;
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            if (matrix[next_row][next_col] == CLOSED || distance[next] != -1) {
+                continue;
+            }
+            distance[next] = distance[cell] + 1;
+            queue[tail++] = next;
+            int other = door_at_cell[next];
+            if (other > door) {
+                door_distances[door * door_count + other] = distance[next];
+                door_distances[other * door_count + door] = distance[next];
+                remaining--;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes the dense door-to-door distance matrix on the worker pool.
+ *
+ * Results are written to door_distances, -1 marks unreachable pairs.
+ * @param matrix The maze matrix.
+ */
+void compute_door_distances(char **matrix) {
+    int door_count = NUM_ENTRIES + NUM_EXITS;
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        door_at_cell[entry_cells[i]] = i;
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        door_at_cell[exit_cells[j]] = NUM_ENTRIES + j;
+    }
+    // The last door has no higher-indexed targets, its row is complete by symmetry
+    door_distances[(door_count - 1) * door_count + door_count - 1] = 0;
+    run_on_workers(door_count - 1, door_distance_task, matrix);
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        door_at_cell[entry_cells[i]] = -1;
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        door_at_cell[exit_cells[j]] = -1;
+    }
+}
+
+/**
+ * @brief Prints the door distance matrix, entries as S<i> and exits as E<j>.
+ */
+void report_door_distances(void) {
+    int door_count = NUM_ENTRIES + NUM_EXITS;
+
+    char label[16];
+
+    printf("Door distances:\n     ");
+    for (int door = 0; door < door_count; door++) {
+        snprintf(label, sizeof(label), "%c%d", door < NUM_ENTRIES ? ENTRY : EXIT,
+                 door < NUM_ENTRIES ? door : door - NUM_ENTRIES);
+        printf(" %5s", label);
+    }
+    putchar('\n');
+    for (int door = 0; door < door_count; door++) {
+        snprintf(label, sizeof(label), "%c%d", door < NUM_ENTRIES ? ENTRY : EXIT,
+                 door < NUM_ENTRIES ? door : door - NUM_ENTRIES);
+        printf("%-5s", label);
+        for (int other = 0; other < door_count; other++) {
+            int distance = door_distances[door * door_count + other];
+            if (distance == -1) {
+                printf("     -");
+            } else {
+                printf(" %5d", distance);
+            }
+        }
+        putchar('\n');
+    }
+}
+
+/**
+ * @brief Finds articulation points and biconnected components of the open cells.
+ *
+ * Runs an iterative Tarjan DFS over every non-closed cell, starting from the
+ * first entry point so that the cells separating it from the first exit can be
+ * read off the DFS tree. Results are stored in cut_flags and cut_block, after
+ * which closing_cell_disconnects answers in O(1).
+ * @param matrix The maze matrix.
+ */
+void analyze_articulation_points(char **matrix) {
+    int cell_count = ROWS * COLS;
+    int timer = 0;
+    int entry_cell = entry_cells[0];
+    int exit_cell = exit_cells[0];
+    int entry_tree_end = 0;
+
+    articulation_count = 0;
+    block_count = 0;
+    largest_block = 0;
+    door_separator_count = 0;
+    for (int cell = 0; cell < cell_count; cell++) {
+        cut_discovery[cell] = -1;
+        cut_block[cell] = -1;
+        cut_flags[cell] = 0;
+    }
+
+    for (int i = -1; i < cell_count; i++) {
+        int root = i == -1 ? entry_cell : i;
+        if (matrix[root / COLS][root % COLS] == CLOSED || cut_discovery[root] != -1) {
+            continue;
+        }
+        int depth = 0, block_depth = 0;
+        int root_children = 0;
+
+        cut_discovery[root] = cut_low[root] = timer++;
+        cut_parent[root] = -1;
+        cut_next_dir[root] = 0;
+        cut_dfs_stack[depth++] = root;
+        cut_block_stack[block_depth++] = root;
+
+        while (depth > 0) {
+            int cell = cut_dfs_stack[depth - 1];
+            if (cut_next_dir[cell] < 4) {
+                int d = cut_next_dir[cell]++;
+                int next_row = cell / COLS + ROW_STEP[d], next_col = cell % COLS + COL_STEP[d];
+                if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS ||
+                    matrix[next_row][next_col] == CLOSED) {
+                    continue;
+                }
+                int next = next_row * COLS + next_col;
+                if (cut_discovery[next] == -1) {
+                    cut_discovery[next] = cut_low[next] = timer++;
+                    cut_parent[next] = cell;
+                    cut_next_dir[next] = 0;
+                    cut_dfs_stack[depth++] = next;
+                    cut_block_stack[block_depth++] = next;
+                    if (cell == root) {
+                        root_children++;
+                    }
+                } else if (next != cut_parent[cell] && cut_discovery[next] < cut_low[cell]) {
+                    cut_low[cell] = cut_discovery[next];
+                }
+                continue;
+            }
+
+            // All neighbours explored: retreat to the parent
+            depth--;
+            int parent = cut_parent[cell];
+            if (parent == -1) {
+                continue;
+            }
+            if (cut_low[cell] < cut_low[parent]) {
+                cut_low[parent] = cut_low[cell];
+            }
+            if (cut_low[cell] >= cut_discovery[parent]) {
+                // parent closes a biconnected component made of the cells above it on the stack
+                int size = 1;
+                int member;
+                do {
+                    member = cut_block_stack[--block_depth];
+                    cut_block[member] = block_count;
+                    size++;
+                } while (member != cell);
+                if (cut_block[parent] == -1) {
+                    cut_block[parent] = block_count;
+                }
+                if (size > largest_block) {
+                    largest_block = size;
+                }
+                block_count++;
+                if (parent != root && !(cut_flags[parent] & CUT_ARTICULATION)) {
+                    cut_flags[parent] |= CUT_ARTICULATION;
+                    articulation_count++;
+                }
+            }
+        }
+        if (root_children >= 2) {
+            cut_flags[root] |= CUT_ARTICULATION;
+            articulation_count++;
+        }
+        if (root == entry_cell) {
+            entry_tree_end = timer;
+        }
+    }
+
+    // A cell on the tree path from the exit up to the entry separates them when
+    // the subtree holding the exit has no back edge above it
+    if (matrix[entry_cell / COLS][entry_cell % COLS] == CLOSED || cut_discovery[exit_cell] >= entry_tree_end) {
+        return;
+    }
+    for (int child = exit_cell, cell = cut_parent[exit_cell]; cell != entry_cell; child = cell, cell = cut_parent[cell]) {
+        if (cut_low[child] >= cut_discovery[cell]) {
+            cut_flags[cell] |= CUT_SEPARATES_DOORS;
+            door_separator_count++;
+        }
+    }
+}
+
+/**
+ * @brief Tells whether closing a cell would disconnect the first entry from the first exit.
+ *
+ * Only valid after analyze_articulation_points has run on the current frame.
+ * @param row Row index of the cell.
+ * @param col Column index of the cell.
+ * @return true if every entry-to-exit route goes through the cell.
+ */
+bool closing_cell_disconnects(int row, int col) {
+    return (cut_flags[row * COLS + col] & CUT_SEPARATES_DOORS) != 0;
+}
+
+/**
+ * @brief Prints the articulation-point summary and the cells separating S0 from E0.
+ */
+void report_articulation_points(void) {
+    int shown = 0;
+
+    printf("Articulation points: %d, biconnected components: %d (largest %d cells)\n",
+           articulation_count, block_count, largest_block);
+    if (door_separator_count == 0) {
+        return;
+    }
+    printf("Closing any of %d cells disconnects S0 from E0:", door_separator_count);
+    for (int row = 0; row < ROWS && shown < 10; row++) {
+        for (int col = 0; col < COLS && shown < 10; col++) {
+            if (closing_cell_disconnects(row, col)) {
+                printf(" (%d,%d)", row, col);
+                shown++;
+            }
+        }
+    }
+    printf(door_separator_count > shown ? " ...\n" : "\n");
+}
+
+/**
+ * @brief Tells whether a cell is an entry or exit point, by position.
+ * @param cell The cell index.
+ * @return true if the cell holds a door.
+ */
+bool is_door_cell(int cell) {
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        if (entry_cells[i] == cell) {
+            return true;
+        }
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        if (exit_cells[j] == cell) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Follows one arc of the residual node-split graph.
+ *
+ * Arcs of an input node: 0 is the split arc to its own output, 1-4 are reverse
+ * arcs to the outputs of neighbours that pushed flow into it. Arcs of an output
+ * node: 0-3 lead to the inputs of open neighbours, 4 is the reverse split arc.
+ * Door cells cannot be cut, so their split arc never saturates.
+ * @param matrix The maze matrix.
+ * @param node The node the arc leaves from.
+ * @param row Row index of the node's cell.
+ * @param col Column index of the node's cell.
+ * @param arc The arc number, 0 to 4.
+ * @return The node the arc leads to, or -1 if it has no residual capacity.
+ */
+int flow_arc_target(char **matrix, int node, int row, int col, int arc) {
+    int cell = node >> 1;
+    bool is_output = node & 1;
+
+    if (!is_output && arc == 0) {
+        return (door_at_cell[cell] != -1 || flow_split[cell] == 0) ? node + 1 : -1;
+    }
+    if (is_output && arc == 4) {
+        return flow_split[cell] > 0 ? node - 1 : -1;
+    }
+    int d = is_output ? arc : arc - 1;
+    int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+    if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS ||
+        matrix[next_row][next_col] == CLOSED) {
+        return -1;
+    }
+    int next = next_row * COLS + next_col;
+    if (is_output) {
+        return 2 * next;
+    }
+    return flow_edge[next * 4 + (d ^ 1)] > 0 ? 2 * next + 1 : -1;
+}
+
+/**
+ * @brief Pushes one unit of flow along an arc returned by flow_arc_target.
+ * @param node The node the arc leaves from.
+ * @param arc The arc number, 0 to 4.
+ * @param target The node the arc leads to.
+ */
+void flow_push(int node, int arc, int target) {
+    int cell = node >> 1;
+
+    if (!(node & 1)) {
+        if (arc == 0) {
+            flow_split[cell]++;
+        } else {
+            flow_edge[(target >> 1) * 4 + ((arc - 1) ^ 1)]--;
+        }
+    } else if (arc == 4) {
+        flow_split[cell]--;
+    } else {
+        flow_edge[cell * 4 + arc]++;
+    }
+}
+
+/**
+ * @brief Builds the Dinic level graph from every entry output node.
+ * @param matrix The maze matrix.
+ * @return true if an exit input node is reachable in the residual graph.
+ */
+bool flow_build_levels(char **matrix) {
+    int node_count = 2 * ROWS * COLS;
+    int head = 0, tail = 0;
+    int sink_level = -1;
+
+    for (int node = 0; node < node_count; node++) {
+        flow_level[node] = -1;
+    }
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        flow_level[2 * entry_cells[i] + 1] = 0;
+        flow_queue[tail++] = 2 * entry_cells[i] + 1;
+    }
+    while (head < tail) {
+        int node = flow_queue[head++];
+        if (sink_level != -1 && flow_level[node] >= sink_level) {
+            continue;
+        }
+        int row = (node >> 1) / COLS, col = (node >> 1) % COLS;
+        for (int arc = 0; arc < 5; arc++) {
+            int target = flow_arc_target(matrix, node, row, col, arc);
+            if (target == -1 || flow_level[target] != -1) {
+                continue;
+            }
+            flow_level[target] = flow_level[node] + 1;
+            flow_queue[tail++] = target;
+            int door = door_at_cell[target >> 1];
+            if (!(target & 1) && door >= NUM_ENTRIES && sink_level == -1) {
+                sink_level = flow_level[target];
+            }
+        }
+    }
+    return sink_level != -1;
+}
+
+/**
+ * @brief Finds the minimum set of cells whose closure separates every entry from every exit.
+ *
+ * Runs Dinic's algorithm on the node-split grid graph, where each open cell is an
+ * input/output node pair joined by a unit-capacity arc and neighbouring cells are
+ * joined by unbounded arcs. All state lives in flat per-node arrays; the blocking
+ * flow search is iterative. The cut cells are stored in min_cut_cells.
+ * @param matrix The maze matrix.
+ * @return The cut size, or FLOW_UNBOUNDED if doors touch so no cut exists.
+ */
+int find_minimum_cut(char **matrix) {
+    int cell_count = ROWS * COLS;
+    int flow = 0;
+
+    min_cut_size = 0;
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        door_at_cell[entry_cells[i]] = i;
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        door_at_cell[exit_cells[j]] = NUM_ENTRIES + j;
+    }
+
+    // A chain of adjacent door cells from an entry to an exit can never be cut
+    int head = 0, tail = 0;
+    bool unbounded = false;
+    for (int cell = 0; cell < cell_count; cell++) {
+        flow_split[cell] = 0;
+    }
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        flow_split[entry_cells[i]] = 1;
+        flow_queue[tail++] = entry_cells[i];
+    }
+    while (head < tail && !unbounded) {
+        int cell = flow_queue[head++];
+        for (int d = 0; d < 4; d++) {
+            int next_row = cell / COLS + ROW_STEP[d], next_col = cell % COLS + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            if (door_at_cell[next] == -1 || flow_split[next]) {
+                continue;
+            }
+            if (door_at_cell[next] >= NUM_ENTRIES) {
+                unbounded = true;
+                break;
+            }
+            flow_split[next] = 1;
+            flow_queue[tail++] = next;
+        }
+    }
+    if (unbounded) {
+        min_cut_size = FLOW_UNBOUNDED;
+    } else {
+        for (int cell = 0; cell < cell_count; cell++) {
+            flow_split[cell] = 0;
+            flow_edge[4 * cell] = flow_edge[4 * cell + 1] = flow_edge[4 * cell + 2] = flow_edge[4 * cell + 3] = 0;
+        }
+        while (flow_build_levels(matrix)) {
+            for (int node = 0; node < 2 * cell_count; node++) {
+                flow_next_arc[node] = 0;
+            }
+            // Blocking flow: unit augmenting paths along strictly increasing levels
+            for (int i = 0; i < NUM_ENTRIES; i++) {
+                int depth = 0;
+                flow_path[depth++] = 2 * entry_cells[i] + 1;
+                while (depth > 0) {
+                    int node = flow_path[depth - 1];
+                    int door = door_at_cell[node >> 1];
+                    if (!(node & 1) && door >= NUM_ENTRIES) {
+                        // Reached an exit: augment along the path and restart from the entry
+                        for (int k = 0; k + 1 < depth; k++) {
+                            flow_push(flow_path[k], flow_next_arc[flow_path[k]],
+                                      flow_path[k + 1]);
+                        }
+                        flow++;
+                        depth = 1;
+                        continue;
+                    }
+                    bool advanced = false;
+                    int row = (node >> 1) / COLS, col = (node >> 1) % COLS;
+                    while (flow_next_arc[node] < 5) {
+                        int target = flow_arc_target(matrix, node, row, col, flow_next_arc[node]);
+                        if (target != -1 && flow_level[target] == flow_level[node] + 1) {
+                            flow_path[depth++] = target;
+                            advanced = true;
+                            break;
+                        }
+                        flow_next_arc[node]++;
+                    }
+                    if (!advanced) {
+                        // Dead end: drop the node from the level graph and back off
+                        flow_level[node] = -1;
+                        depth--;
+                        if (depth > 0) {
+                            flow_next_arc[flow_path[depth - 1]]++;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Cut cells: input reachable in the residual graph, output not
+        for (int cell = 0; cell < cell_count; cell++) {
+            if (flow_level[2 * cell] != -1 && flow_level[2 * cell + 1] == -1 && min_cut_size < flow) {
+                min_cut_cells[min_cut_size++] = cell;
+            }
+        }
+    }
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        door_at_cell[entry_cells[i]] = -1;
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        door_at_cell[exit_cells[j]] = -1;
+    }
+    return min_cut_size;
+}
+
+/**
+ * @brief Prints the size and cells of the minimum cut between entries and exits.
+ */
+void report_minimum_cut(void) {
+    if (min_cut_size == FLOW_UNBOUNDED) {
+        printf("Room cannot be sealed: an entry touches an exit.\n");
+        return;
+    }
+    printf("Minimum cut: %d cells", min_cut_size);
+    for (int k = 0; k < min_cut_size && k < 10; k++) {
+        printf(" (%d,%d)", min_cut_cells[k] / COLS, min_cut_cells[k] % COLS);
+    }
+    printf(min_cut_size > 10 ? " ...\n" : "\n");
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return The current time in milliseconds.
+ */
+double monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief Worker task: BFS distance field from one landmark.
+ * @param landmark The landmark index.
+ * @param worker The worker running the task, selects the queue buffer.
+ * @param context The maze matrix.
+ */
+void landmark_task(int landmark, int worker, void *context) {
+    char **matrix = (char **)context;
+    int *distance = landmark_distance + (size_t)landmark * ROWS * COLS;
+    int *queue = worker_scratch[worker].queue;
+    int head = 0, tail = 0;
+
+    for (int cell = 0; cell < ROWS * COLS; cell++) {
+        distance[cell] = -1;
+    }
+    distance[landmark_cells[landmark]] = 0;
+    queue[tail++] = landmark_cells[landmark];
+    while (head < tail) {
+        int cell = queue[head++];
+        int row = cell / COLS, col = cell % COLS;
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            if (matrix[next_row][next_col] == CLOSED || distance[next] != -1) {
+                continue;
+            }
+            distance[next] = distance[cell] + 1;
+            queue[tail++] = next;
+        }
+    }
+}
+
+/**
+ * @brief Picks landmark cells and computes their distance fields on the worker pool.
+ *
+ * Landmarks are spread evenly along the perimeter, each moved forward to the
+ * next open edge cell not already taken. The build time is kept in landmark_build_ms.
+ * @param matrix The maze matrix.
+ */
+void build_landmarks(char **matrix) {
+    double start = monotonic_ms();
+    int edge_length = 2 * (ROWS + COLS) - 4;
+    int edge_cells[edge_length];
+    int counter = 0;
+
+    // Walk the perimeter clockwise so that evenly spaced positions are evenly spread around the room
+    for (int col = 0; col < COLS; col++) {
+        edge_cells[counter++] = col;
+    }
+    for (int row = 1; row < ROWS; row++) {
+        edge_cells[counter++] = row * COLS + COLS - 1;
+    }
+    for (int col = COLS - 2; col >= 0; col--) {
+        edge_cells[counter++] = (ROWS - 1) * COLS + col;
+    }
+    for (int row = ROWS - 2; row > 0; row--) {
+        edge_cells[counter++] = row * COLS;
+    }
+
+    landmark_count = 0;
+    for (int k = 0; k < LANDMARK_COUNT; k++) {
+        int position = (int)((long)k * edge_length / LANDMARK_COUNT);
+        for (int step = 0; step < (edge_length + LANDMARK_COUNT - 1) / LANDMARK_COUNT; step++) {
+            int cell = edge_cells[(position + step) % edge_length];
+            if (matrix[cell / COLS][cell % COLS] != CLOSED) {
+                landmark_cells[landmark_count++] = cell;
+                break;
+            }
+        }
+    }
+    run_on_workers(landmark_count, landmark_task, matrix);
+    landmark_build_ms = monotonic_ms() - start;
+}
+
+/**
+ * @brief Lower bound on the distance between two cells.
+ *
+ * Combines the Manhattan distance with the landmark triangle inequality
+ * |d(L,target) - d(L,cell)| when use_landmarks is set.
+ * @param cell The cell index.
+ * @param target The target cell index.
+ * @param use_landmarks Whether to use the landmark distance fields.
+ * @return The lower bound, or INT_MAX if a landmark proves the target unreachable.
+ */
+int distance_lower_bound(int cell, int target, bool use_landmarks) {
+    int bound = abs(cell / COLS - target / COLS) + abs(cell % COLS - target % COLS);
+
+    if (!use_landmarks) {
+        return bound;
+    }
+    for (int k = 0; k < landmark_count; k++) {
+        const int *distance = landmark_distance + (size_t)k * ROWS * COLS;
+        int to_cell = distance[cell], to_target = distance[target];
+        if ((to_cell == -1) != (to_target == -1)) {
+            // One is in the landmark's component and the other is not
+            return INT_MAX;
+        }
+        if (to_cell != -1 && abs(to_target - to_cell) > bound) {
+            bound = abs(to_target - to_cell);
+        }
+    }
+    return bound;
+}
+
+/**
+ * @brief Moves a heap entry towards the root until the heap order holds.
+ * @param position The entry's position in astar_heap.
+ */
+void astar_heap_up(int position) {
+    int cell = astar_heap[position];
+    while (position > 0) {
+        int parent = (position - 1) / 2;
+        if (astar_f[astar_heap[parent]] <= astar_f[cell]) {
+            break;
+        }
+        astar_heap[position] = astar_heap[parent];
+        astar_heap_pos[astar_heap[position]] = position;
+        position = parent;
+    }
+    astar_heap[position] = cell;
+    astar_heap_pos[cell] = position;
+}
+
+/**
+ * @brief Moves a heap entry towards the leaves until the heap order holds.
+ * @param position The entry's position in astar_heap.
+ * @param size The number of entries in the heap.
+ */
+void astar_heap_down(int position, int size) {
+    int cell = astar_heap[position];
+    while (2 * position + 1 < size) {
+        int child = 2 * position + 1;
+        if (child + 1 < size && astar_f[astar_heap[child + 1]] < astar_f[astar_heap[child]]) {
+            child++;
+        }
+        if (astar_f[cell] <= astar_f[astar_heap[child]]) {
+            break;
+        }
+        astar_heap[position] = astar_heap[child];
+        astar_heap_pos[astar_heap[position]] = position;
+        position = child;
+    }
+    astar_heap[position] = cell;
+    astar_heap_pos[cell] = position;
+}
+
+/**
+ * @brief Finds the shortest distance between two cells with A*.
+ * @param matrix The maze matrix.
+ * @param source The source cell index.
+ * @param target The target cell index.
+ * @param use_landmarks Whether to use the landmark heuristic instead of plain Manhattan distance.
+ * @param expanded Incremented by the number of expanded cells.
+ * @return The distance in steps, or -1 if the target is unreachable.
+ */
+int astar_search(char **matrix, int source, int target, bool use_landmarks, long *expanded) {
+    MAZELOCK_PROBE3(astar__start, source, target, use_landmarks);
+    int size = 0;
+    unsigned int search = ++astar_search_id;
+
+    if (distance_lower_bound(source, target, use_landmarks) == INT_MAX) {
+        MAZELOCK_PROBE4(astar__done, source, target, -1, *expanded);
+        return -1;
+    }
+    astar_stamp[source] = search;
+    astar_g[source] = 0;
+    astar_f[source] = distance_lower_bound(source, target, use_landmarks);
+    astar_heap[size++] = source;
+    astar_heap_pos[source] = 0;
+
+    while (size > 0) {
+        int cell = astar_heap[0];
+        astar_heap_pos[cell] = HEAP_CLOSED;
+        if (--size > 0) {
+            astar_heap[0] = astar_heap[size];
+            astar_heap_down(0, size);
+        }
+        (*expanded)++;
+        if (cell == target) {
+            MAZELOCK_PROBE4(astar__done, source, target, astar_g[cell], *expanded);
+            return astar_g[cell];
+        }
+        int row = cell / COLS, col = cell % COLS;
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS ||
+                matrix[next_row][next_col] == CLOSED) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            int g = astar_g[cell] + 1;
+            if (astar_stamp[next] == search) {
+                if (astar_heap_pos[next] == HEAP_CLOSED || g >= astar_g[next]) {
+                    continue;
+                }
+                astar_f[next] -= astar_g[next] - g;
+                astar_g[next] = g;
+                astar_heap_up(astar_heap_pos[next]);
+                continue;
+            }
+            int h = distance_lower_bound(next, target, use_landmarks);
+            astar_stamp[next] = search;
+            if (h == INT_MAX) {
+                astar_heap_pos[next] = HEAP_CLOSED;
+                continue;
+            }
+            astar_g[next] = g;
+            astar_f[next] = g + h;
+            astar_heap[size] = next;
+            astar_heap_up(size++);
+        }
+    }
+    MAZELOCK_PROBE4(astar__done, source, target, -1, *expanded);
+    return -1;
+}
+
+/**
+ * @brief Runs A* from every entry to every exit, with and without landmarks, and prints the comparison.
+ * @param matrix The maze matrix.
+ */
+void report_landmark_queries(char **matrix) {
+    long manhattan_expanded = 0, landmark_expanded = 0;
+    double manhattan_ms, landmark_ms;
+    double start = monotonic_ms();
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        for (int j = 0; j < NUM_EXITS; j++) {
+            astar_search(matrix, entry_cells[i], exit_cells[j], false, &manhattan_expanded);
+        }
+    }
+    manhattan_ms = monotonic_ms() - start;
+    start = monotonic_ms();
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        for (int j = 0; j < NUM_EXITS; j++) {
+            astar_search(matrix, entry_cells[i], exit_cells[j], true, &landmark_expanded);
+        }
+    }
+    landmark_ms = monotonic_ms() - start;
+
+    printf("Landmarks: %d fields, %.1f MB, built in %.2f ms\n", landmark_count,
+           (double)landmark_count * ROWS * COLS * sizeof(int) / (1024.0 * 1024.0), landmark_build_ms);
+    printf("A* over %d queries: %ld cells expanded in %.2f ms (Manhattan), %ld in %.2f ms (landmarks)\n",
+           NUM_ENTRIES * NUM_EXITS, manhattan_expanded, manhattan_ms, landmark_expanded, landmark_ms);
+}
+
+/**
+ * @brief Adds an undirected edge to the junction graph, or shortens an existing one.
+ *
+ * The caller makes sure both ends have room left in their CH_NODE_EDGES slots.
+ * @param from One end node.
+ * @param to The other end node.
+ * @param weight The edge length in cells.
+ * @param middle The node a shortcut bypasses, -1 for a corridor edge.
+ */
+void ch_add_edge(int from, int to, int weight, int middle) {
+    int ends[2] = {from, to};
+
+    for (int side = 0; side < 2; side++) {
+        ChAdjacency *adjacency = &ch_adjacency[ends[side]];
+        int other = ends[1 - side];
+        bool found = false;
+        for (int e = 0; e < adjacency->count; e++) {
+            if (adjacency->edges[e].to == other) {
+                if (weight < adjacency->edges[e].weight) {
+                    adjacency->edges[e].weight = weight;
+                    adjacency->edges[e].middle = middle;
+                }
+                found = true;
+                break;
+            }
+        }
+        if (found) {
+            continue;
+        }
+        adjacency->edges[adjacency->count++] = (ChEdge){other, weight, middle};
+        if (side == 0) {
+            ch_edge_count++;
+        }
+    }
+}
+
+/**
+ * @brief Collapses corridors of the open cells into a weighted junction graph.
+ *
+ * Every open cell whose number of open neighbours is not two, and every door,
+ * becomes a node. Runs of two-neighbour cells between nodes become single edges
+ * weighted by their length.
+ * @param matrix The maze matrix.
+ */
+void build_junction_graph(char **matrix) {
+    int cell_count = ROWS * COLS;
+
+    junction_count = 0;
+    ch_edge_count = 0;
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        door_at_cell[entry_cells[i]] = i;
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        door_at_cell[exit_cells[j]] = NUM_ENTRIES + j;
+    }
+    for (int cell = 0; cell < cell_count; cell++) {
+        int row = cell / COLS, col = cell % COLS;
+        junction_of_cell[cell] = -1;
+        if (matrix[row][col] == CLOSED) {
+            continue;
+        }
+        int degree = 0;
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row >= 0 && next_row < ROWS && next_col >= 0 && next_col < COLS &&
+                matrix[next_row][next_col] != CLOSED) {
+                degree++;
+            }
+        }
+        if (degree != 2 || door_at_cell[cell] != -1) {
+            junction_cell[junction_count] = cell;
+            ch_adjacency[junction_count].count = 0;
+            junction_of_cell[cell] = junction_count++;
+        }
+    }
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        door_at_cell[entry_cells[i]] = -1;
+    }
+    for (int j = 0; j < NUM_EXITS; j++) {
+        door_at_cell[exit_cells[j]] = -1;
+    }
+    for (int node = 0; node < junction_count; node++) {
+        int start = junction_cell[node];
+        for (int d = 0; d < 4; d++) {
+            int next_row = start / COLS + ROW_STEP[d], next_col = start % COLS + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS ||
+                matrix[next_row][next_col] == CLOSED) {
+                continue;
+            }
+            // Follow the corridor until it reaches another junction
+            int previous = start, cell = next_row * COLS + next_col, length = 1;
+            while (junction_of_cell[cell] == -1) {
+                int row = cell / COLS, col = cell % COLS;
+                for (int step = 0; step < 4; step++) {
+                    int corridor_row = row + ROW_STEP[step], corridor_col = col + COL_STEP[step];
+                    if (corridor_row < 0 || corridor_row >= ROWS || corridor_col < 0 || corridor_col >= COLS ||
+                        matrix[corridor_row][corridor_col] == CLOSED) {
+                        continue;
+                    }
+                    int corridor = corridor_row * COLS + corridor_col;
+                    if (corridor != previous) {
+                        previous = cell;
+                        cell = corridor;
+                        break;
+                    }
+                }
+                length++;
+            }
+            if (junction_of_cell[cell] > node) {
+                ch_add_edge(node, junction_of_cell[cell], length, -1);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Bounded Dijkstra over the remaining nodes, used to find witness paths.
+ *
+ * Tentative distances are left in the worker's scratch, stamped with scratch->search.
+ * They are all lengths of real paths, so any of them can serve as a witness.
+ * @param source The node to search from.
+ * @param excluded The node being contracted, which the search must avoid.
+ * @param max_distance Paths longer than this are not explored.
+ * @param worker The worker running the search.
+ */
+void ch_witness_search(int source, int excluded, int max_distance, int worker) {
+    ChScratch *scratch = &ch_scratch[worker];
+    unsigned int search = ++scratch->search;
+    int size = 0, settled = 0;
+
+    scratch->stamp[source] = search;
+    scratch->distance[source] = 0;
+    scratch->heap_node[size] = source;
+    scratch->heap_distance[size++] = 0;
+
+    while (size > 0 && settled < CH_SETTLE_LIMIT) {
+        int node = scratch->heap_node[0], distance = scratch->heap_distance[0];
+        // Pop the minimum by moving the last entry to the root and sifting it down
+        size--;
+        int position = 0;
+        while (2 * position + 1 < size) {
+            int child = 2 * position + 1;
+            if (child + 1 < size && scratch->heap_distance[child + 1] < scratch->heap_distance[child]) {
+                child++;
+            }
+            if (scratch->heap_distance[size] <= scratch->heap_distance[child]) {
+                break;
+            }
+            scratch->heap_node[position] = scratch->heap_node[child];
+            scratch->heap_distance[position] = scratch->heap_distance[child];
+            position = child;
+        }
+        scratch->heap_node[position] = scratch->heap_node[size];
+        scratch->heap_distance[position] = scratch->heap_distance[size];
+
+        if (distance > scratch->distance[node]) {
+            continue;
+        }
+        settled++;
+        ChAdjacency *adjacency = &ch_adjacency[node];
+        for (int e = 0; e < adjacency->count; e++) {
+            int next = adjacency->edges[e].to;
+            int next_distance = distance + adjacency->edges[e].weight;
+            if (next == excluded || ch_state[next] != CH_REMAINING || next_distance > max_distance) {
+                continue;
+            }
+            if (scratch->stamp[next] == search && scratch->distance[next] <= next_distance) {
+                continue;
+            }
+            scratch->stamp[next] = search;
+            scratch->distance[next] = next_distance;
+            if (size == CH_HEAP_CAPACITY) {
+                continue;
+            }
+            position = size++;
+            while (position > 0 && scratch->heap_distance[(position - 1) / 2] > next_distance) {
+                scratch->heap_node[position] = scratch->heap_node[(position - 1) / 2];
+                scratch->heap_distance[position] = scratch->heap_distance[(position - 1) / 2];
+                position = (position - 1) / 2;
+            }
+            scratch->heap_node[position] = next;
+            scratch->heap_distance[position] = next_distance;
+        }
+    }
+}
+
+/**
+ * @brief Works out the shortcuts needed to contract a node.
+ * @param node The node to contract.
+ * @param worker The worker running the contraction.
+ * @param first Where the shortcuts go in the shared shortcut list, or -1 to only count them.
+ * @return The number of shortcuts needed.
+ */
+int ch_contract_node(int node, int worker, int first) {
+    ChScratch *scratch = &ch_scratch[worker];
+    ChAdjacency *adjacency = &ch_adjacency[node];
+    int shortcuts = 0;
+
+    for (int a = 0; a < adjacency->count; a++) {
+        ChEdge in = adjacency->edges[a];
+        if (ch_state[in.to] != CH_REMAINING) {
+            continue;
+        }
+        int max_distance = 0;
+        for (int b = a + 1; b < adjacency->count; b++) {
+            if (ch_state[adjacency->edges[b].to] == CH_REMAINING &&
+                in.weight + adjacency->edges[b].weight > max_distance) {
+                max_distance = in.weight + adjacency->edges[b].weight;
+            }
+        }
+        if (max_distance == 0) {
+            continue;
+        }
+        ch_witness_search(in.to, node, max_distance, worker);
+        for (int b = a + 1; b < adjacency->count; b++) {
+            ChEdge out = adjacency->edges[b];
+            if (ch_state[out.to] != CH_REMAINING) {
+                continue;
+            }
+            int through = in.weight + out.weight;
+            if (scratch->stamp[out.to] == scratch->search && scratch->distance[out.to] <= through) {
+                continue;
+            }
+            if (first != -1) {
+                ch_shortcut_from[first + shortcuts] = in.to;
+                ch_shortcut_to[first + shortcuts] = out.to;
+                ch_shortcut_weight[first + shortcuts] = through;
+            }
+            shortcuts++;
+        }
+    }
+    return shortcuts;
+}
+
+/**
+ * @brief Worker task: recomputes the contraction priority (edge difference) of a dirty node.
+ * @param index Index into ch_dirty.
+ * @param worker The worker running the task.
+ * @param context Unused.
+ */
+void ch_priority_task(int index, int worker, void *context) {
+    (void)context;
+    int node = ch_dirty[index];
+    int remaining_degree = 0;
+
+    for (int e = 0; e < ch_adjacency[node].count; e++) {
+        if (ch_state[ch_adjacency[node].edges[e].to] == CH_REMAINING) {
+            remaining_degree++;
+        }
+    }
+    ch_priority[node] = ch_contract_node(node, worker, -1) - remaining_degree + ch_deleted_neighbors[node];
+}
+
+/**
+ * @brief Worker task: contracts one node of the current independent set into its part of the shortcut list.
+ * @param index Index into ch_selected.
+ * @param worker The worker running the task.
+ * @param context Unused.
+ */
+void ch_contract_task(int index, int worker, void *context) {
+    (void)context;
+    ch_shortcut_count[index] = ch_contract_node(ch_selected[index], worker, ch_shortcut_first[index]);
+}
+
+/**
+ * @brief Tells whether contracting a node could fit its shortcuts in its neighbours' edge slots.
+ *
+ * Contracting a node adds at most degree - 1 shortcuts to each remaining neighbour.
+ * @param node The node.
+ * @return True if every remaining neighbour has that many free slots.
+ */
+bool ch_fits(int node) {
+    int degree = 0;
+
+    for (int e = 0; e < ch_adjacency[node].count; e++) {
+        degree += ch_state[ch_adjacency[node].edges[e].to] == CH_REMAINING;
+    }
+    for (int e = 0; e < ch_adjacency[node].count; e++) {
+        int other = ch_adjacency[node].edges[e].to;
+        if (ch_state[other] == CH_REMAINING && ch_adjacency[other].count + degree - 1 > CH_NODE_EDGES) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Builds a contraction hierarchy over the junction graph of the current frame.
+ *
+ * Nodes are contracted in rounds. Each round takes the independent set of nodes
+ * whose priority is lower than all their remaining neighbours' and contracts them
+ * in parallel on the worker pool. Witness searches avoid the whole set, so
+ * contracting them at the same time loses no distances.
+ *
+ * A node is only contracted if its shortcuts fit in its neighbours' edge slots,
+ * and nodes that do not fit are left out of the priority comparison. When no node fits, the rest are left uncontracted as a core ranked above all
+ * contracted nodes, which queries search in every direction.
+ * @param matrix The maze matrix.
+ */
+void build_contraction_hierarchy(char **matrix) {
+    double start = monotonic_ms();
+    int remaining = 0, rank = 0;
+
+    build_junction_graph(matrix);
+    for (int node = 0; node < junction_count; node++) {
+        ch_state[node] = CH_REMAINING;
+        ch_rank[node] = -1;
+        ch_deleted_neighbors[node] = 0;
+        ch_dirty[node] = node;
+        ch_remaining_list[remaining++] = node;
+    }
+    if (junction_count > 0) {
+        run_on_workers(junction_count, ch_priority_task, NULL);
+    }
+
+    ch_shortcut_total = 0;
+    ch_rounds = 0;
+    ch_core_rank = junction_count;
+    while (remaining > 0) {
+        int selected_count = 0, dirty_count = 0, kept = 0, shortcut_slots = 0;
+
+        for (int k = 0; k < remaining; k++) {
+            int node = ch_remaining_list[k];
+            bool lowest = true;
+            for (int e = 0; e < ch_adjacency[node].count && lowest; e++) {
+                int other = ch_adjacency[node].edges[e].to;
+                if (ch_state[other] == CH_REMAINING && ch_fits(other) &&
+                    (ch_priority[other] < ch_priority[node] ||
+                     (ch_priority[other] == ch_priority[node] && other < node))) {
+                    lowest = false;
+                }
+            }
+            // Neighbours that cannot fit their own shortcuts do not hold the node back, but its shortcuts must fit
+            // on top of those already promised by nodes selected earlier in this round
+            int degree = 0;
+            for (int e = 0; e < ch_adjacency[node].count; e++) {
+                degree += ch_state[ch_adjacency[node].edges[e].to] == CH_REMAINING;
+            }
+            for (int e = 0; e < ch_adjacency[node].count && lowest; e++) {
+                int other = ch_adjacency[node].edges[e].to;
+                if (ch_state[other] == CH_REMAINING &&
+                    ch_adjacency[other].count + ch_pending[other] + degree - 1 > CH_NODE_EDGES) {
+                    lowest = false;
+                }
+            }
+            if (lowest) {
+                for (int e = 0; e < ch_adjacency[node].count; e++) {
+                    int other = ch_adjacency[node].edges[e].to;
+                    if (ch_state[other] == CH_REMAINING) {
+                        ch_pending[other] += degree - 1;
+                    }
+                }
+                ch_shortcut_first[selected_count] = shortcut_slots;
+                shortcut_slots += degree * (degree - 1) / 2;
+                ch_selected[selected_count++] = node;
+            } else {
+                ch_remaining_list[kept++] = node;
+            }
+        }
+        remaining = kept;
+        if (selected_count == 0) {
+            ch_core_rank = rank;
+            for (int k = 0; k < remaining; k++) {
+                ch_rank[ch_remaining_list[k]] = rank++;
+            }
+            break;
+        }
+        for (int k = 0; k < selected_count; k++) {
+            ch_state[ch_selected[k]] = CH_SELECTED;
+        }
+
+        run_on_workers(selected_count, ch_contract_task, NULL);
+        for (int k = 0; k < selected_count; k++) {
+            for (int s = ch_shortcut_first[k]; s < ch_shortcut_first[k] + ch_shortcut_count[k]; s++) {
+                ch_add_edge(ch_shortcut_from[s], ch_shortcut_to[s], ch_shortcut_weight[s], ch_selected[k]);
+            }
+            ch_shortcut_total += ch_shortcut_count[k];
+        }
+
+        for (int k = 0; k < selected_count; k++) {
+            int node = ch_selected[k];
+            ch_state[node] = CH_CONTRACTED;
+            ch_rank[node] = rank++;
+            for (int e = 0; e < ch_adjacency[node].count; e++) {
+                int other = ch_adjacency[node].edges[e].to;
+                if (ch_state[other] != CH_REMAINING) {
+                    continue;
+                }
+                ch_pending[other] = 0;
+                ch_deleted_neighbors[other]++;
+                if (!ch_is_dirty[other]) {
+                    ch_is_dirty[other] = 1;
+                    ch_dirty[dirty_count++] = other;
+                }
+            }
+        }
+        if (dirty_count > 0) {
+            run_on_workers(dirty_count, ch_priority_task, NULL);
+        }
+        for (int k = 0; k < dirty_count; k++) {
+            ch_is_dirty[ch_dirty[k]] = 0;
+        }
+        ch_rounds++;
+    }
+    ch_build_ms = monotonic_ms() - start;
+}
+
+/**
+ * @brief Pushes a node onto one side's query heap, growing both heaps when needed.
+ * @param side 0 for the source search, 1 for the target search.
+ * @param size Pointer to that heap's entry count.
+ * @param node The node to push.
+ * @param distance Its tentative distance.
+ */
+void ch_query_push(int side, int *size, int node, int distance) {
+    if (*size == ch_query_heap_capacity) {
+        ch_query_heap_capacity = ch_query_heap_capacity ? 2 * ch_query_heap_capacity : 1024;
+        for (int k = 0; k < 2; k++) {
+            ch_query_heap_node[k] = (int *)tracked_realloc(MEMORY_QUEUES, ch_query_heap_node[k], ch_query_heap_capacity * sizeof(int));
+            ch_query_heap_distance[k] = (int *)tracked_realloc(MEMORY_QUEUES, ch_query_heap_distance[k], ch_query_heap_capacity * sizeof(int));
+        }
+    }
+    int *heap_node = ch_query_heap_node[side], *heap_distance = ch_query_heap_distance[side];
+    int position = (*size)++;
+    while (position > 0 && heap_distance[(position - 1) / 2] > distance) {
+        heap_node[position] = heap_node[(position - 1) / 2];
+        heap_distance[position] = heap_distance[(position - 1) / 2];
+        position = (position - 1) / 2;
+    }
+    heap_node[position] = node;
+    heap_distance[position] = distance;
+}
+
+/**
+ * @brief Pops the closest node from one side's query heap.
+ * @param side 0 for the source search, 1 for the target search.
+ * @param size Pointer to that heap's entry count, must be positive.
+ * @param distance Receives the popped node's distance.
+ * @return The popped node.
+ */
+int ch_query_pop(int side, int *size, int *distance) {
+    int *heap_node = ch_query_heap_node[side], *heap_distance = ch_query_heap_distance[side];
+    int node = heap_node[0];
+    int position = 0;
+
+    *distance = heap_distance[0];
+    (*size)--;
+    while (2 * position + 1 < *size) {
+        int child = 2 * position + 1;
+        if (child + 1 < *size && heap_distance[child + 1] < heap_distance[child]) {
+            child++;
+        }
+        if (heap_distance[*size] <= heap_distance[child]) {
+            break;
+        }
+        heap_node[position] = heap_node[child];
+        heap_distance[position] = heap_distance[child];
+        position = child;
+    }
+    heap_node[position] = heap_node[*size];
+    heap_distance[position] = heap_distance[*size];
+    return node;
+}
+
+/**
+ * @brief Finds the edge between two nodes of the hierarchy.
+ * @param from One end node.
+ * @param to The other end node.
+ * @return The edge as stored in from's edge list.
+ */
+ChEdge ch_find_edge(int from, int to) {
+    ChAdjacency *adjacency = &ch_adjacency[from];
+    for (int e = 0; e < adjacency->count; e++) {
+        if (adjacency->edges[e].to == to) {
+            return adjacency->edges[e];
+        }
+    }
+    return (ChEdge){to, INT_MAX, -1};
+}
+
+/**
+ * @brief Shortest distance between two junctions with a bidirectional upward search.
+ *
+ * Both searches only follow edges towards higher-ranked nodes, or between two
+ * nodes of the uncontracted core. Each one stops once
+ * its closest entry is no better than the best meeting point found so far.
+ * Shortcuts on the resulting route are then unpacked back into corridor edges.
+ * @param source The source junction node.
+ * @param target The target junction node.
+ * @param path Receives the junction nodes along the route, or NULL to skip unpacking.
+ * @param path_nodes Receives the number of junction nodes in path.
+ * @return The distance in cells, or -1 if the junctions are not connected.
+ */
+int ch_query(int source, int target, int *path, int *path_nodes) {
+    MAZELOCK_PROBE2(ch__start, source, target);
+    unsigned int query = ++ch_query_id;
+    int ends[2] = {source, target};
+    int sizes[2] = {0, 0};
+    int best = INT_MAX, meet = -1;
+
+    for (int side = 0; side < 2; side++) {
+        ch_query_stamp[side][ends[side]] = query;
+        ch_query_distance[side][ends[side]] = 0;
+        ch_query_parent[side][ends[side]] = -1;
+        ch_query_push(side, &sizes[side], ends[side], 0);
+    }
+
+    while (sizes[0] > 0 || sizes[1] > 0) {
+        int side = sizes[0] == 0 ? 1 : sizes[1] == 0 ? 0 :
+                   (ch_query_heap_distance[0][0] <= ch_query_heap_distance[1][0] ? 0 : 1);
+        int distance;
+        int node = ch_query_pop(side, &sizes[side], &distance);
+        if (distance > ch_query_distance[side][node]) {
+            continue;
+        }
+        if (distance >= best) {
+            sizes[side] = 0;
+            continue;
+        }
+        if (ch_query_stamp[1 - side][node] == query && distance + ch_query_distance[1 - side][node] < best) {
+            best = distance + ch_query_distance[1 - side][node];
+            meet = node;
+        }
+        ChAdjacency *adjacency = &ch_adjacency[node];
+        for (int e = 0; e < adjacency->count; e++) {
+            int next = adjacency->edges[e].to;
+            int next_distance = distance + adjacency->edges[e].weight;
+            if (ch_rank[next] < ch_rank[node] && ch_rank[next] < ch_core_rank) {
+                continue;
+            }
+            if (ch_query_stamp[side][next] == query && ch_query_distance[side][next] <= next_distance) {
+                continue;
+            }
+            ch_query_stamp[side][next] = query;
+            ch_query_distance[side][next] = next_distance;
+            ch_query_parent[side][next] = node;
+            ch_query_push(side, &sizes[side], next, next_distance);
+        }
+    }
+    if (meet == -1) {
+        MAZELOCK_PROBE3(ch__done, source, target, -1);
+        return -1;
+    }
+    if (path == NULL) {
+        MAZELOCK_PROBE3(ch__done, source, target, best);
+        return best;
+    }
+
+    // Upward chain from the source to the meeting node, then down to the target
+    int chain_length = 0;
+    for (int node = meet; node != -1; node = ch_query_parent[0][node]) {
+        ch_query_chain[chain_length++] = node;
+    }
+    for (int low = 0, high = chain_length - 1; low < high; low++, high--) {
+        int swap = ch_query_chain[low];
+        ch_query_chain[low] = ch_query_chain[high];
+        ch_query_chain[high] = swap;
+    }
+    for (int node = ch_query_parent[1][meet]; node != -1; node = ch_query_parent[1][node]) {
+        ch_query_chain[chain_length++] = node;
+    }
+
+    // Replace every shortcut by the two edges around the node it bypasses
+    *path_nodes = 0;
+    path[(*path_nodes)++] = source;
+    for (int k = 0; k + 1 < chain_length; k++) {
+        int current = ch_query_chain[k];
+        int depth = 0;
+        ch_unpack_stack[depth++] = ch_query_chain[k + 1];
+        while (depth > 0) {
+            int next = ch_unpack_stack[depth - 1];
+            ChEdge edge = ch_find_edge(current, next);
+            if (edge.middle == -1) {
+                path[(*path_nodes)++] = next;
+                current = next;
+                depth--;
+            } else {
+                ch_unpack_stack[depth++] = edge.middle;
+            }
+        }
+    }
+    MAZELOCK_PROBE3(ch__done, source, target, best);
+    return best;
+}
+
+/**
+ * @brief Prints the hierarchy size, its build time and entry-to-exit query results.
+ */
+void report_contraction_hierarchy(void) {
+    int queries = 0, connected = 0;
+    int first_distance = -1, first_nodes = 0;
+    double start = monotonic_ms();
+
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        for (int j = 0; j < NUM_EXITS; j++) {
+            int source = junction_of_cell[entry_cells[i]], target = junction_of_cell[exit_cells[j]];
+            int nodes = 0;
+            queries++;
+            if (source == -1 || target == -1) {
+                continue;
+            }
+            int distance = ch_query(source, target, ch_path, &nodes);
+            if (distance != -1) {
+                if (connected++ == 0) {
+                    first_distance = distance;
+                    first_nodes = nodes;
+                }
+            }
+        }
+    }
+    double query_us = (monotonic_ms() - start) * 1000.0 / queries;
+
+    printf("Contraction hierarchy: %d junctions, %d edges (%d shortcuts), built in %.2f ms over %d rounds, %d left in the core\n",
+           junction_count, ch_edge_count, ch_shortcut_total, ch_build_ms, ch_rounds, junction_count - ch_core_rank);
+    printf("CH answered %d door queries in %.2f us each, %d connected", queries, query_us, connected);
+    if (first_distance != -1) {
+        printf(" (first: %d steps over %d junctions)", first_distance, first_nodes);
+    }
+    putchar('\n');
+}
+
+/**
+ * @brief Adds one timing sample to a benchmark stage.
+ * @param stage The stage.
+ * @param ms The sample in milliseconds.
+ */
+void bench_record(BenchStage *stage, double ms) {
+    stage->total_ms += ms;
+    if (ms > stage->max_ms) {
+        stage->max_ms = ms;
+    }
+    stage->samples++;
+}
+
+/**
+ * @brief Generates frames back to back and times every analysis stage.
+ *
+ * Point-to-point engines are compared on the same random junction pairs each frame.
+ * @param frames The number of frames to generate.
+ */
+void run_benchmark(int frames) {
+    enum {
+        STAGE_GENERATE, STAGE_NEAREST_EXITS, STAGE_DOOR_DISTANCES, STAGE_ARTICULATION, STAGE_MINIMUM_CUT,
+        STAGE_LANDMARK_BUILD, STAGE_BFS_QUERY, STAGE_ASTAR_MANHATTAN, STAGE_ASTAR_LANDMARKS, STAGE_IDA_QUERY,
+        STAGE_CH_BUILD, STAGE_CH_QUERY, STAGE_WALL_FOLLOWER, STAGE_PLEDGE, STAGE_PYRAMID_BUILD, STAGE_PYRAMID_QUERY,
+        STAGE_COUNT
+    };
+    BenchStage stages[STAGE_COUNT] = {
+        {"generate", 0, 0, 0}, {"nearest exits (BFS)", 0, 0, 0}, {"door distance matrix", 0, 0, 0},
+        {"articulation points", 0, 0, 0}, {"minimum cut", 0, 0, 0}, {"landmark build", 0, 0, 0},
+        {"BFS query", 0, 0, 0}, {"A* query (Manhattan)", 0, 0, 0}, {"A* query (landmarks)", 0, 0, 0},
+        {"IDA* query", 0, 0, 0}, {"CH build", 0, 0, 0}, {"CH query", 0, 0, 0},
+        {"wall follower S0->E0", 0, 0, 0}, {"Pledge S0->E0", 0, 0, 0}, {"pyramid build", 0, 0, 0},
+        {"pyramid rejection", 0, 0, 0}
+    };
+    const int query_count = 100;
+    int sources[query_count], targets[query_count];
+    int nearest_exit[NUM_ENTRIES], exit_distance[NUM_ENTRIES];
+    long expanded_bfs = 0, expanded_manhattan = 0, expanded_landmarks = 0, expanded_ida = 0;
+    long mismatches = 0, ida_gave_up = 0, unreachable_queries = 0, rejected_queries = 0;
+    long wall_found = 0, pledge_found = 0, exit_reachable = 0;
+    int longest_source = -1, longest_target = -1, longest_distance = -1;
+    double start;
+
+    printf("Benchmark: %d frames of %dx%d, density %.2f, %d entries, %d exits, %d workers\n",
+           frames, ROWS, COLS, density, NUM_ENTRIES, NUM_EXITS, WORKER_COUNT);
+    for (int frame = 0; frame < frames; frame++) {
+        if (frame == ALLOCATION_WARMUP) {
+            allocations_frozen = true;
+        }
+        start = monotonic_ms();
+        if (frame == 0) {
+            generate_matrix(matrix);
+        } else {
+            randomize_matrix(matrix, density);
+        }
+        bench_record(&stages[STAGE_GENERATE], monotonic_ms() - start);
+
+        build_pyramid(matrix);
+        bench_record(&stages[STAGE_PYRAMID_BUILD], pyramid_build_ms);
+
+        start = monotonic_ms();
+        find_nearest_exits(matrix, nearest_exit, exit_distance);
+        bench_record(&stages[STAGE_NEAREST_EXITS], monotonic_ms() - start);
+
+        start = monotonic_ms();
+        compute_door_distances(matrix);
+        bench_record(&stages[STAGE_DOOR_DISTANCES], monotonic_ms() - start);
+
+        start = monotonic_ms();
+        analyze_articulation_points(matrix);
+        bench_record(&stages[STAGE_ARTICULATION], monotonic_ms() - start);
+
+        start = monotonic_ms();
+        find_minimum_cut(matrix);
+        bench_record(&stages[STAGE_MINIMUM_CUT], monotonic_ms() - start);
+
+        start = monotonic_ms();
+        WallFollowResult walk = wall_follow(matrix, entry_cells[0], exit_cells[0], false, false, 16L * ROWS * COLS);
+        bench_record(&stages[STAGE_WALL_FOLLOWER], monotonic_ms() - start);
+        if (NUM_EXITS == 1 && walk.found != (nearest_exit[0] != -1)) {
+            mismatches++;
+        }
+        start = monotonic_ms();
+        WallFollowResult pledge = wall_follow(matrix, entry_cells[0], exit_cells[0], false, true, 16L * ROWS * COLS);
+        bench_record(&stages[STAGE_PLEDGE], monotonic_ms() - start);
+        // A Pledge walk that misses proves nothing, but one that arrives must have had a path to follow
+        if (NUM_EXITS == 1 && pledge.found && nearest_exit[0] == -1) {
+            mismatches++;
+        }
+        wall_found += walk.found;
+        pledge_found += pledge.found;
+        exit_reachable += NUM_EXITS == 1 && nearest_exit[0] != -1;
+
+        build_landmarks(matrix);
+        bench_record(&stages[STAGE_LANDMARK_BUILD], landmark_build_ms);
+        build_contraction_hierarchy(matrix);
+        bench_record(&stages[STAGE_CH_BUILD], ch_build_ms);
+        if (junction_count == 0) {
+            continue;
+        }
+
+        for (int q = 0; q < query_count; q++) {
+            sources[q] = rand() % junction_count;
+            targets[q] = rand() % junction_count;
+        }
+        for (int q = 0; q < query_count; q++) {
+            int source = junction_cell[sources[q]], target = junction_cell[targets[q]];
+            start = monotonic_ms();
+            bool rejected = pyramid_rejects(source, target);
+            bench_record(&stages[STAGE_PYRAMID_QUERY], monotonic_ms() - start);
+            start = monotonic_ms();
+            int breadth_first = bfs_search(matrix, source, target, &expanded_bfs);
+            bench_record(&stages[STAGE_BFS_QUERY], monotonic_ms() - start);
+            unreachable_queries += breadth_first == -1;
+            rejected_queries += rejected;
+            if (rejected && breadth_first != -1) {
+                mismatches++;
+            }
+            if (breadth_first > longest_distance && frame == frames - 1) {
+                longest_source = source;
+                longest_target = target;
+                longest_distance = breadth_first;
+            }
+            start = monotonic_ms();
+            int manhattan = astar_search(matrix, source, target, false, &expanded_manhattan);
+            bench_record(&stages[STAGE_ASTAR_MANHATTAN], monotonic_ms() - start);
+            start = monotonic_ms();
+            int landmarks = astar_search(matrix, source, target, true, &expanded_landmarks);
+            bench_record(&stages[STAGE_ASTAR_LANDMARKS], monotonic_ms() - start);
+            start = monotonic_ms();
+            int nodes;
+            int hierarchy = ch_query(sources[q], targets[q], ch_path, &nodes);
+            bench_record(&stages[STAGE_CH_QUERY], monotonic_ms() - start);
+            start = monotonic_ms();
+            int iterative = ida_star_search(matrix, source, target, 100L * ROWS * COLS, &expanded_ida);
+            bench_record(&stages[STAGE_IDA_QUERY], monotonic_ms() - start);
+            if (iterative == IDA_GAVE_UP) {
+                ida_gave_up++;
+                iterative = breadth_first;
+            }
+            if (manhattan != breadth_first || landmarks != breadth_first || hierarchy != breadth_first ||
+                iterative != breadth_first) {
+                mismatches++;
+            }
+        }
+    }
+    allocations_frozen = false;
+
+    printf("%-24s %12s %12s %10s\n", "stage", "mean us", "max us", "samples");
+    for (int k = 0; k < STAGE_COUNT; k++) {
+        if (stages[k].samples == 0) {
+            continue;
+        }
+        printf("%-24s %12.2f %12.2f %10ld\n", stages[k].name, stages[k].total_ms * 1000.0 / stages[k].samples,
+               stages[k].max_ms * 1000.0, stages[k].samples);
+    }
+    printf("Cells expanded: BFS %ld, A* %ld with Manhattan, %ld with landmarks (%.1f MB of fields), IDA* %ld\n",
+           expanded_bfs, expanded_manhattan, expanded_landmarks,
+           (double)landmark_count * ROWS * COLS * sizeof(int) / (1024.0 * 1024.0), expanded_ida);
+    printf("Search memory: BFS %zu bytes, A* %zu bytes, IDA* %zu bytes (peak stack of %d frames + %d-entry table), "
+           "wall follower constant\n",
+           (size_t)ROWS * COLS * sizeof(int) + ((size_t)ROWS * COLS + 63) / 64 * sizeof(unsigned long long),
+           (size_t)ROWS * COLS * (4 * sizeof(int) + sizeof(unsigned int)),
+           (size_t)ida_peak_depth * sizeof(IdaFrame) + (size_t)IDA_TABLE_SIZE * sizeof(IdaTableEntry),
+           ida_peak_depth, IDA_TABLE_SIZE);
+    if (ida_gave_up > 0) {
+        printf("IDA* gave up on %ld queries after %ld expansions each\n", ida_gave_up, 100L * ROWS * COLS);
+    }
+    printf("Last hierarchy: %d junctions, %d edges, %d shortcuts, %d rounds\n", junction_count, ch_edge_count,
+           ch_shortcut_total, ch_rounds);
+    printf("Wall followers reached E0 from S0 in %ld of %d frames with the left hand and %ld with the Pledge rule",
+           wall_found, frames, pledge_found);
+    if (NUM_EXITS == 1) {
+        printf(" (reachable in %ld)", exit_reachable);
+    }
+    putchar('\n');
+    printf("Pyramid: %ld of %ld unreachable queries rejected from %dx%d block groups without a search\n",
+           rejected_queries, unreachable_queries, 1 << pyramid_label_level, 1 << pyramid_label_level);
+
+    // HDA* scaling on the longest query of the last frame
+    if (longest_distance > 0) {
+        double single_ms = 0;
+        printf("HDA* on a %d-step query:\n%8s %12s %12s %10s\n", longest_distance, "threads", "ms", "expanded",
+               "speedup");
+        for (int threads = 1;; threads *= 2) {
+            if (threads > WORKER_COUNT) {
+                threads = WORKER_COUNT;
+            }
+            long expanded = 0;
+            start = monotonic_ms();
+            int distance = hda_star_search(matrix, longest_source, longest_target, threads, &expanded);
+            double ms = monotonic_ms() - start;
+            if (threads == 1) {
+                single_ms = ms;
+            }
+            if (distance != longest_distance) {
+                mismatches++;
+            }
+            printf("%8d %12.2f %12ld %9.2fx\n", threads, ms, expanded, single_ms / ms);
+            if (threads == WORKER_COUNT) {
+                break;
+            }
+        }
+    }
+    mismatches += benchmark_hierarchy_loops(frames);
+    if (mismatches > 0) {
+        printf("WARNING: %ld point-to-point queries disagreed between engines\n", mismatches);
+    }
+    compare_generators(frames);
+    compare_renderers(frames);
+    benchmark_ingestion();
+    benchmark_handoff();
+    report_allocations();
+    if (ALLOCATION_WARMUP >= 0) {
+        if (allocations_after_warmup > 0) {
+            printf("FAIL: %ld allocations after %d warm-up frames\n", allocations_after_warmup, ALLOCATION_WARMUP);
+        } else {
+            printf("PASS: no allocations after %d warm-up frames\n", ALLOCATION_WARMUP);
+        }
+        printf("Only tracked allocations are counted; libc's own, such as the stacks of the HDA* threads, are not\n");
+    }
+}
+
+/**
+ * @brief Times the contraction hierarchy on the current room with a lattice of corridors cut through it.
+ *
+ * Generated rooms are forests, so contracting their leaves never needs a shortcut. Opening
+ * every CH_LOOP_SPACING-th row and column inside the border closes loops all over the room,
+ * so contractions need shortcuts, and queries climb them and search the core. Every query is
+ * checked against a breadth-first search, and the room is restored afterwards.
+ * @param frames The number of times to build and query the hierarchy.
+ * @return The number of queries whose distance differed from the breadth-first search.
+ */
+long benchmark_hierarchy_loops(int frames) {
+    const int query_count = 100;
+    char *saved = (char *)tracked_malloc(MEMORY_SCRATCH, (size_t)ROWS * COLS);
+    double build_ms = 0, query_ms = 0;
+    long expanded = 0, mismatches = 0, queries = 0;
+
+    for (int row = 1; row < ROWS - 1; row++) {
+        for (int col = 1; col < COLS - 1; col++) {
+            saved[row * COLS + col] = matrix[row][col];
+            if ((row % CH_LOOP_SPACING == 0 || col % CH_LOOP_SPACING == 0) && matrix[row][col] == CLOSED) {
+                matrix[row][col] = OPEN;
+            }
+        }
+    }
+    for (int frame = 0; frame < frames; frame++) {
+        build_contraction_hierarchy(matrix);
+        build_ms += ch_build_ms;
+        for (int q = 0; q < query_count && junction_count > 0; q++) {
+            int source = rand() % junction_count, target = rand() % junction_count, nodes;
+            double start = monotonic_ms();
+            int hierarchy = ch_query(source, target, ch_path, &nodes);
+            query_ms += monotonic_ms() - start;
+            mismatches += hierarchy != bfs_search(matrix, junction_cell[source], junction_cell[target], &expanded);
+            queries++;
+        }
+    }
+    printf("CH with corridors every %d cells: %d junctions, %d edges, %d shortcuts, %d rounds, %d in the core; "
+           "build %.2f ms, query %.2f us\n",
+           CH_LOOP_SPACING, junction_count, ch_edge_count, ch_shortcut_total, ch_rounds, junction_count - ch_core_rank,
+           build_ms / frames, queries > 0 ? query_ms * 1000.0 / queries : 0.0);
+
+    for (int row = 1; row < ROWS - 1; row++) {
+        for (int col = 1; col < COLS - 1; col++) {
+            matrix[row][col] = saved[row * COLS + col];
+        }
+    }
+    tracked_free(saved);
+    return mismatches;
+}
+
+/**
+ * @brief Times every render mode on the current room and compares the bytes each writes per frame.
+ *
+ * Frames are formatted in slices on the worker pool, as for the display, but not written. The
+ * zoomed view fits the whole room on screen.
+ * @param frames The number of times to render the room in each mode.
+ */
+void compare_renderers(int frames) {
+    const char *names[4] = {"classic", "half", "braille", "zoom"};
+    int saved_mode = RENDER_MODE;
+    size_t classic_bytes = 0;
+
+    build_pyramid(matrix);
+
+    printf("%-10s %12s %12s %10s %14s\n", "render", "mean us", "bytes", "vs classic", "screen");
+    for (int mode = RENDER_CLASSIC; mode <= RENDER_ZOOM; mode++) {
+        RENDER_MODE = mode;
+        size_t bytes = 0;
+        double start = monotonic_ms();
+        for (int frame = 0; frame < frames; frame++) {
+            render_frame(matrix, frame, &bytes);
+        }
+        double mean_us = (monotonic_ms() - start) * 1000.0 / frames;
+        if (mode == RENDER_CLASSIC) {
+            classic_bytes = bytes;
+        }
+        char screen[32];
+        snprintf(screen, sizeof(screen), "%dx%d", render_width(), render_lines());
+        printf("%-10s %12.2f %12zu %9.1fx %14s\n", names[mode], mean_us, bytes, (double)classic_bytes / bytes, screen);
+    }
+    RENDER_MODE = saved_mode;
+}
+
+/**
+ * @brief Times the classic and tile generators and compares the rooms they produce.
+ *
+ * Besides the overall density, the share of aligned 4x4 blocks with each open-cell
+ * count shows how evenly open cells are spread.
+ * @param frames The number of rooms to generate with each generator.
+ */
+void compare_generators(int frames) {
+    const char *names[2] = {"classic", "tiles"};
+    long blocks[2][TILE_SIZE * TILE_SIZE + 1] = {{0}};
+    long block_total[2] = {0, 0};
+    double total_ms[2] = {0, 0}, max_ms[2] = {0, 0};
+    double density_sum[2] = {0, 0}, density_min[2] = {1, 1}, density_max[2] = {0, 0};
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (int generator = 0; generator < 2; generator++) {
+            double start = monotonic_ms();
+            if (generator == 0) {
+                randomize_matrix_classic(matrix, density);
+            } else {
+                assemble_tile_matrix(matrix, density);
+            }
+            double ms = monotonic_ms() - start;
+            total_ms[generator] += ms;
+            if (ms > max_ms[generator]) {
+                max_ms[generator] = ms;
+            }
+
+            long open_cells = 0;
+            for (int row = 0; row < ROWS; row++) {
+                for (int col = 0; col < COLS; col++) {
+                    open_cells += matrix[row][col] != CLOSED;
+                }
+            }
+            double room_density = (double)open_cells / ((double)ROWS * COLS);
+            density_sum[generator] += room_density;
+            if (room_density < density_min[generator]) {
+                density_min[generator] = room_density;
+            }
+            if (room_density > density_max[generator]) {
+                density_max[generator] = room_density;
+            }
+
+            for (int top = 0; top + TILE_SIZE <= ROWS; top += TILE_SIZE) {
+                for (int left = 0; left + TILE_SIZE <= COLS; left += TILE_SIZE) {
+                    int open = 0;
+                    for (int row = top; row < top + TILE_SIZE; row++) {
+                        for (int col = left; col < left + TILE_SIZE; col++) {
+                            open += matrix[row][col] != CLOSED;
+                        }
+                    }
+                    blocks[generator][open]++;
+                    block_total[generator]++;
+                }
+            }
+        }
+    }
+
+    printf("Generators (%d tiles in library, built in %.2f ms):\n", tile_count, tile_library_ms);
+    printf("%-8s %12s %12s %9s %9s %9s   %% of 4x4 blocks with 0, 1, 2, ... open cells\n", "", "mean us",
+           "max us", "density", "min", "max");
+    for (int generator = 0; generator < 2; generator++) {
+        printf("%-8s %12.2f %12.2f %9.3f %9.3f %9.3f  ", names[generator], total_ms[generator] * 1000.0 / frames,
+               max_ms[generator] * 1000.0, density_sum[generator] / frames, density_min[generator],
+               density_max[generator]);
+        for (int open = 0; open <= TILE_MAX_OPEN; open++) {
+            printf(" %5.1f", block_total[generator] ? 100.0 * blocks[generator][open] / block_total[generator] : 0.0);
+        }
+        putchar('\n');
+    }
+}
+
+/**
+ * @brief Allocates the scratch buffers of a resumable solver.
+ *
+ * The visited bits take one bit per cell. A solver that must not allocate once running
+ * reserves a queue for the whole room; fleet rooms start empty and grow the queue to
+ * the largest area they have searched, so idle rooms cost almost nothing.
+ * @param state The solver state.
+ * @param queue_capacity The number of queue entries to reserve now.
+ */
+void solver_alloc(SolverState *state, int queue_capacity) {
+    state->queue = queue_capacity > 0 ? (int *)tracked_malloc(MEMORY_QUEUES, (size_t)queue_capacity * sizeof(int)) : NULL;
+    state->queue_capacity = queue_capacity;
+    state->visited = (unsigned long long *)tracked_calloc(MEMORY_SCRATCH, ((size_t)ROWS * COLS + 63) / 64,
+                                                          sizeof(unsigned long long));
+    state->status = SOLVER_IDLE;
+}
+
+/**
+ * @brief Frees the scratch buffers of a resumable solver.
+ * @param state The solver state.
+ */
+void solver_free(SolverState *state) {
+    tracked_free(state->queue);
+    tracked_free(state->visited);
+}
+
+/**
+ * @brief Makes room for a number of queue entries, doubling the queue as needed.
+ * @param state The solver state.
+ * @param count The number of entries the queue must hold.
+ */
+void solver_reserve(SolverState *state, int count) {
+    if (count <= state->queue_capacity) {
+        return;
+    }
+    int capacity = state->queue_capacity > 0 ? state->queue_capacity : 64;
+    while (capacity < count) {
+        capacity = capacity < ROWS * COLS / 2 ? 2 * capacity : ROWS * COLS;
+    }
+    state->queue = (int *)tracked_realloc(MEMORY_QUEUES, state->queue, (size_t)capacity * sizeof(int));
+    state->queue_capacity = capacity;
+}
+
+/**
+ * @brief Starts a new breadth-first solve, clearing the visited bits.
+ * @param state The solver state.
+ * @param matrix The maze matrix.
+ * @param source The source cell index.
+ * @param target The target cell index.
+ */
+void solver_init(SolverState *state, char **matrix, int source, int target) {
+    state->matrix = matrix;
+    state->source = source;
+    state->target = target;
+    memset(state->visited, 0, ((size_t)ROWS * COLS + 63) / 64 * sizeof(unsigned long long));
+    state->head = state->tail = state->layer_end = 0;
+    state->depth = -1;
+    state->expanded = 0;
+    state->result = -1;
+    state->status = SOLVER_RUNNING;
+    state->visited[source >> 6] |= 1ULL << (source & 63);
+    solver_reserve(state, 1);
+    state->queue[state->tail++] = source;
+}
+
+/**
+ * @brief Advances a breadth-first solve by at most budget expanded cells.
+ *
+ * All progress is kept in the state, so a scheduler can interleave many solves
+ * on one thread and resume each where it stopped.
+ * @param state The solver state.
+ * @param budget The maximum number of cells to expand in this call.
+ * @return SOLVER_RUNNING if the budget ran out, otherwise SOLVER_FOUND or SOLVER_UNREACHABLE.
+ */
+int solver_step(SolverState *state, long budget) {
+    MAZELOCK_PROBE3(step__start, state->source, state->target, budget);
+    char **matrix = state->matrix;
+
+    if (state->status != SOLVER_RUNNING) {
+        MAZELOCK_PROBE4(step__done, state->source, state->target, state->status, state->expanded);
+        return state->status;
+    }
+    while (budget-- > 0) {
+        if (state->head == state->tail) {
+            state->status = SOLVER_UNREACHABLE;
+            MAZELOCK_PROBE4(step__done, state->source, state->target, state->status, state->expanded);
+            return state->status;
+        }
+        if (state->head == state->layer_end) {
+            state->depth++;
+            state->layer_end = state->tail;
+        }
+        int cell = state->queue[state->head++];
+        state->expanded++;
+        if (cell == state->target) {
+            state->result = state->depth;
+            state->status = SOLVER_FOUND;
+            MAZELOCK_PROBE4(step__done, state->source, state->target, state->status, state->expanded);
+            return state->status;
+        }
+        int row = cell / COLS, col = cell % COLS;
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            if (matrix[next_row][next_col] == CLOSED || (state->visited[next >> 6] >> (next & 63)) & 1) {
+                continue;
+            }
+            state->visited[next >> 6] |= 1ULL << (next & 63);
+            solver_reserve(state, state->tail + 1);
+            state->queue[state->tail++] = next;
+        }
+    }
+    MAZELOCK_PROBE4(step__done, state->source, state->target, state->status, state->expanded);
+    return state->status;
+}
+
+/**
+ * @brief Shortest distance between two cells with a breadth-first search that stops at the target.
+ * @param matrix The maze matrix.
+ * @param source The source cell index.
+ * @param target The target cell index.
+ * @param expanded Incremented by the number of dequeued cells.
+ * @return The distance in steps, or -1 if the target is unreachable.
+ */
+int bfs_search(char **matrix, int source, int target, long *expanded) {
+    MAZELOCK_PROBE2(bfs__start, source, target);
+    solver_init(&bfs_solver, matrix, source, target);
+    solver_step(&bfs_solver, LONG_MAX);
+    *expanded += bfs_solver.expanded;
+    MAZELOCK_PROBE4(bfs__done, source, target, bfs_solver.result, bfs_solver.expanded);
+    return bfs_solver.result;
+}
+
+/**
+ * @brief Size of the checkpoint file described by a header.
+ * @param header The fixed part of the checkpoint.
+ * @return The size in bytes, header included.
+ */
+size_t checkpoint_size(const CheckpointHeader *header) {
+    size_t size = sizeof(CheckpointHeader);
+    size += (size_t)(header->entries + header->exits + header->entries * header->exits) * sizeof(int);
+    size += ((size_t)header->next_row * header->cols + 7) / 8;
+    if (header->phase == CHECKPOINT_SOLVING) {
+        size += ((size_t)header->rows * header->cols + 7) / 8 + (size_t)header->frontier_count * sizeof(int);
+    }
+    return size;
+}
+
+/**
+ * @brief FNV-1a hash of a checkpoint. The caller zeroes the checksum field first.
+ * @param data The checkpoint.
+ * @param length Its size in bytes.
+ * @return The hash.
+ */
+unsigned long long checkpoint_checksum(const unsigned char *data, size_t length) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Reads and verifies a checkpoint into checkpoint_resume.
+ * @param path The checkpoint file.
+ * @return 1 if a valid checkpoint was read, 0 if there is none, -1 if it cannot be used.
+ */
+int load_checkpoint(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror("checkpoint");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(CheckpointHeader)) {
+        fprintf(stderr, "Checkpoint %s is truncated; remove it to start over\n", path);
+        close(fd);
+        return -1;
+    }
+    checkpoint_resume_length = (size_t)info.st_size;
+    checkpoint_resume = (unsigned char *)tracked_malloc(MEMORY_RUNTIME, checkpoint_resume_length);
+    size_t done = 0;
+    while (done < checkpoint_resume_length) {
+        ssize_t got = read(fd, checkpoint_resume + done, checkpoint_resume_length - done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        done += (size_t)got;
+    }
+    close(fd);
+
+    CheckpointHeader *header = (CheckpointHeader *)checkpoint_resume;
+    unsigned long long stored = header->checksum;
+    header->checksum = 0;
+    // The checksum only catches accidents, so every count and index is range-checked as well
+    long cells = (long)header->rows * header->cols;
+    bool valid = done == checkpoint_resume_length && memcmp(header->magic, CHECKPOINT_MAGIC, 8) == 0 &&
+                 header->rows >= 2 && header->cols >= 2 && cells <= INT_MAX &&
+                 header->entries > 0 && header->exits > 0 &&
+                 header->entries + (long)header->exits <= 2L * (header->rows + header->cols) - 4 &&
+                 (header->phase == CHECKPOINT_GENERATING || header->phase == CHECKPOINT_SOLVING) &&
+                 header->next_row >= 0 && header->next_row <= header->rows &&
+                 (header->phase == CHECKPOINT_GENERATING || header->next_row == header->rows) &&
+                 (long)header->entries * header->exits <= INT_MAX &&
+                 header->pair >= 0 && header->pair < (long)header->entries * header->exits &&
+                 header->frontier_count >= 0 && header->frontier_count <= cells &&
+                 header->frontier_split >= 0 && header->frontier_split <= header->frontier_count &&
+                 header->frontier_distance >= 0 && header->frontier_distance < cells && header->expanded >= 0 &&
+                 checkpoint_size(header) == checkpoint_resume_length &&
+                 checkpoint_checksum(checkpoint_resume, checkpoint_resume_length) == stored;
+    header->checksum = stored;
+    if (valid && header->phase == CHECKPOINT_SOLVING) {
+        const unsigned char *cursor = checkpoint_resume + sizeof(CheckpointHeader);
+        int door_count = header->entries + header->exits, pairs = header->entries * header->exits;
+        for (int door = 0; door < door_count && valid; door++) {
+            int cell;
+            memcpy(&cell, cursor + door * sizeof(int), sizeof(int));
+            int row = cell / header->cols, col = cell % header->cols;
+            valid = cell >= 0 && cell < cells &&
+                    (row == 0 || row == header->rows - 1 || col == 0 || col == header->cols - 1);
+        }
+        cursor += door_count * sizeof(int);
+        for (int pair = 0; pair < header->pair && valid; pair++) {
+            int distance;
+            memcpy(&distance, cursor + pair * sizeof(int), sizeof(int));
+            valid = distance >= -1 && distance < cells;
+        }
+        cursor += pairs * sizeof(int) + ((size_t)header->next_row * header->cols + 7) / 8 + ((size_t)cells + 7) / 8;
+        for (int i = 0; i < header->frontier_count && valid; i++) {
+            int cell;
+            memcpy(&cell, cursor + i * sizeof(int), sizeof(int));
+            valid = cell >= 0 && cell < cells;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "Checkpoint %s is damaged; remove it to start over\n", path);
+        tracked_free(checkpoint_resume);
+        checkpoint_resume = NULL;
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Rebuilds the room, the generator stream and the solver from checkpoint_resume.
+ *
+ * The matrix must be all closed. Rows the checkpoint has not reached stay closed,
+ * as they were when it was taken, so the rest of the run matches one that never stopped.
+ * @param solver The solver to resume the current entry-exit pair in.
+ */
+void restore_checkpoint(SolverState *solver) {
+    const CheckpointHeader *saved = (const CheckpointHeader *)checkpoint_resume;
+    const unsigned char *cursor = checkpoint_resume + sizeof(CheckpointHeader);
+    int door_count = NUM_ENTRIES + NUM_EXITS, pairs = NUM_ENTRIES * NUM_EXITS;
+
+    checkpoint_progress = *saved;
+    checkpoint_progress.checksum = 0;
+    generator_state = saved->generator_state;
+    const unsigned char *doors = cursor;
+    cursor += door_count * sizeof(int);
+    memcpy(checkpoint_results, cursor, pairs * sizeof(int));
+    cursor += pairs * sizeof(int);
+
+    size_t grid_bytes = ((size_t)saved->next_row * COLS + 7) / 8;
+    memcpy(checkpoint_grid_bits, cursor, grid_bytes);
+    cursor += grid_bytes;
+    for (int row = 0; row < saved->next_row; row++) {
+        for (int col = 0; col < COLS; col++) {
+            size_t cell = (size_t)row * COLS + col;
+            matrix[row][col] = (checkpoint_grid_bits[cell >> 3] >> (cell & 7)) & 1 ? OPEN : CLOSED;
+        }
+    }
+    checkpoint_packed_rows = saved->next_row;
+    if (saved->phase != CHECKPOINT_SOLVING) {
+        return;
+    }
+
+    for (int door = 0; door < door_count; door++) {
+        int cell;
+        memcpy(&cell, doors + door * sizeof(int), sizeof(int));
+        if (door < NUM_ENTRIES) {
+            entry_cells[door] = cell;
+            matrix[cell / COLS][cell % COLS] = ENTRY;
+        } else {
+            exit_cells[door - NUM_ENTRIES] = cell;
+            matrix[cell / COLS][cell % COLS] = EXIT;
+        }
+    }
+    // A fresh search stamp, then the saved visited set and frontier in place of the source alone
+    int pair = saved->pair;
+    solver_init(solver, matrix, entry_cells[pair / NUM_EXITS], exit_cells[pair % NUM_EXITS]);
+    int cells = ROWS * COLS;
+    memcpy(checkpoint_visited_bits, cursor, ((size_t)cells + 7) / 8);
+    checkpoint_visited_pair = pair;
+    checkpoint_visited_tail = 0;
+    for (int cell = 0; cell < cells; cell++) {
+        if ((checkpoint_visited_bits[cell >> 3] >> (cell & 7)) & 1) {
+            solver->visited[cell >> 6] |= 1ULL << (cell & 63);
+        }
+    }
+    cursor += ((size_t)cells + 7) / 8;
+    solver_reserve(solver, saved->frontier_count);
+    memcpy(solver->queue, cursor, (size_t)saved->frontier_count * sizeof(int));
+    solver->head = 0;
+    solver->tail = saved->frontier_count;
+    // A frontier of a single distance starts a new layer on the first pop
+    if (saved->frontier_split < saved->frontier_count) {
+        solver->depth = saved->frontier_distance;
+        solver->layer_end = saved->frontier_split;
+    } else {
+        solver->depth = saved->frontier_distance - 1;
+        solver->layer_end = 0;
+    }
+    solver->expanded = saved->expanded;
+}
+
+/**
+ * @brief Copies the progress of the run into the checkpoint buffer and hands it to the writer.
+ *
+ * Runs on the solving thread while the writer is idle. Both bit sets only grow: each
+ * generated row is packed into checkpoint_grid_bits once, and the solver queue lists
+ * the cells visited since the last snapshot, so keeping them up to date follows the
+ * progress made. Copying them into the buffer still costs one bit per cell of the
+ * room. A breadth-first frontier spans at most two distances, so it is saved as cells
+ * plus the index where the second begins.
+ * @param solver The solver of the current entry-exit pair.
+ */
+void snapshot_checkpoint(SolverState *solver) {
+    double start_ms = monotonic_ms();
+    CheckpointHeader *progress = &checkpoint_progress;
+    int cells = ROWS * COLS, door_count = NUM_ENTRIES + NUM_EXITS, pairs = NUM_ENTRIES * NUM_EXITS;
+
+    for (; checkpoint_packed_rows < progress->next_row; checkpoint_packed_rows++) {
+        size_t cell = (size_t)checkpoint_packed_rows * COLS;
+        const char *row = matrix[checkpoint_packed_rows];
+        for (int col = 0; col < COLS; col++, cell++) {
+            checkpoint_grid_bits[cell >> 3] |= (unsigned char)((row[col] == OPEN) << (cell & 7));
+        }
+    }
+    progress->generator_state = generator_state;
+    progress->frontier_count = progress->frontier_split = progress->frontier_distance = 0;
+    progress->expanded = 0;
+    if (progress->phase == CHECKPOINT_SOLVING) {
+        progress->frontier_count = solver->tail - solver->head;
+        if (solver->head == solver->layer_end) {
+            progress->frontier_distance = solver->depth + 1;
+            progress->frontier_split = progress->frontier_count;
+        } else {
+            progress->frontier_distance = solver->depth;
+            progress->frontier_split = solver->layer_end - solver->head;
+        }
+        progress->expanded = solver->expanded;
+        if (checkpoint_visited_pair != progress->pair) {
+            memset(checkpoint_visited_bits, 0, ((size_t)cells + 7) / 8);
+            checkpoint_visited_pair = progress->pair;
+            checkpoint_visited_tail = 0;
+        }
+        for (; checkpoint_visited_tail < solver->tail; checkpoint_visited_tail++) {
+            int cell = solver->queue[checkpoint_visited_tail];
+            checkpoint_visited_bits[cell >> 3] |= (unsigned char)(1 << (cell & 7));
+        }
+    }
+
+    size_t length = checkpoint_size(progress);
+    if (length > checkpoint_capacity) {
+        checkpoint_buffer = (unsigned char *)tracked_realloc(MEMORY_RUNTIME, checkpoint_buffer, length);
+        checkpoint_capacity = length;
+    }
+    unsigned char *cursor = checkpoint_buffer;
+    memcpy(cursor, progress, sizeof(CheckpointHeader));
+    cursor += sizeof(CheckpointHeader);
+    memcpy(cursor, entry_cells, NUM_ENTRIES * sizeof(int));
+    memcpy(cursor + NUM_ENTRIES * sizeof(int), exit_cells, NUM_EXITS * sizeof(int));
+    cursor += door_count * sizeof(int);
+    memcpy(cursor, checkpoint_results, pairs * sizeof(int));
+    cursor += pairs * sizeof(int);
+    size_t grid_bytes = ((size_t)progress->next_row * COLS + 7) / 8;
+    memcpy(cursor, checkpoint_grid_bits, grid_bytes);
+    cursor += grid_bytes;
+    if (progress->phase == CHECKPOINT_SOLVING) {
+        size_t visited_bytes = ((size_t)cells + 7) / 8;
+        memcpy(cursor, checkpoint_visited_bits, visited_bytes);
+        cursor += visited_bytes;
+        memcpy(cursor, solver->queue + solver->head, (size_t)progress->frontier_count * sizeof(int));
+    }
+
+    pthread_mutex_lock(&checkpoint_mutex);
+    checkpoint_length = length;
+    checkpoint_pending = true;
+    pthread_cond_broadcast(&checkpoint_cond);
+    pthread_mutex_unlock(&checkpoint_mutex);
+    checkpoint_snapshot_ms += monotonic_ms() - start_ms;
+}
+
+/**
+ * @brief Writes a checkpoint next to its final path, syncs it and renames it into place.
+ *
+ * The rename replaces the previous checkpoint atomically, so a crash at any point
+ * leaves either the old checkpoint or the new one.
+ * @param data The checkpoint; its checksum field is filled in here.
+ * @param length Its size in bytes.
+ * @return true if the checkpoint replaced the previous one.
+ */
+bool write_checkpoint_file(unsigned char *data, size_t length) {
+    CheckpointHeader *header = (CheckpointHeader *)data;
+    header->checksum = 0;
+    header->checksum = checkpoint_checksum(data, length);
+
+    int fd = open(checkpoint_temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t written = write(fd, data + done, length - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            break;
+        }
+        done += (size_t)written;
+    }
+    bool complete = done == length && fsync(fd) == 0;
+    complete = close(fd) == 0 && complete;
+    return complete && rename(checkpoint_temp_path, CHECKPOINT_PATH) == 0;
+}
+
+/**
+ * @brief Background thread that writes each checkpoint handed to it, until asked to stop.
+ * @param arg Unused.
+ * @return NULL.
+ */
+void *checkpoint_writer_func(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&checkpoint_mutex);
+    while (true) {
+        while (!checkpoint_pending && !checkpoint_writer_stop) {
+            pthread_cond_wait(&checkpoint_cond, &checkpoint_mutex);
+        }
+        if (!checkpoint_pending) {
+            break;
+        }
+        pthread_mutex_unlock(&checkpoint_mutex);
+        double start_ms = monotonic_ms();
+        bool written = write_checkpoint_file(checkpoint_buffer, checkpoint_length);
+        if (!written) {
+            perror("checkpoint");
+        }
+        pthread_mutex_lock(&checkpoint_mutex);
+        checkpoint_write_ms += monotonic_ms() - start_ms;
+        if (written) {
+            checkpoints_written++;
+        } else {
+            checkpoint_failures++;
+        }
+        checkpoint_pending = false;
+        pthread_cond_broadcast(&checkpoint_cond);
+    }
+    pthread_mutex_unlock(&checkpoint_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Waits until the writer has finished the checkpoint handed to it, if any.
+ */
+void wait_for_checkpoint_writer(void) {
+    pthread_mutex_lock(&checkpoint_mutex);
+    while (checkpoint_pending) {
+        pthread_cond_wait(&checkpoint_cond, &checkpoint_mutex);
+    }
+    pthread_mutex_unlock(&checkpoint_mutex);
+}
+
+/**
+ * @brief Called between bands and steps of a checkpointed run; takes a snapshot when one is due.
+ *
+ * A snapshot that falls due while the writer is still busy waits for the next call
+ * rather than stalling the run. After SIGINT or SIGTERM, a last snapshot is taken
+ * and written before returning.
+ * @param solver The solver of the current entry-exit pair.
+ * @param next_checkpoint_ms When the next snapshot is due, advanced here.
+ * @param run_start_ms The start of the run, moved back by the work of earlier processes.
+ * @return false if the run was interrupted and should stop.
+ */
+bool checkpoint_tick(SolverState *solver, double *next_checkpoint_ms, double run_start_ms) {
+    double now_ms = monotonic_ms();
+    if (!checkpoint_interrupted && now_ms < *next_checkpoint_ms) {
+        return true;
+    }
+    if (checkpoint_interrupted) {
+        wait_for_checkpoint_writer();
+    }
+    pthread_mutex_lock(&checkpoint_mutex);
+    bool busy = checkpoint_pending;
+    pthread_mutex_unlock(&checkpoint_mutex);
+    if (busy) {
+        checkpoints_deferred += !checkpoint_overdue;
+        checkpoint_overdue = true;
+        return true;
+    }
+    checkpoint_overdue = false;
+    checkpoint_progress.elapsed_ms = now_ms - run_start_ms;
+    snapshot_checkpoint(solver);
+    *next_checkpoint_ms = now_ms + CHECKPOINT_INTERVAL_S * 1000.0;
+    if (checkpoint_interrupted) {
+        wait_for_checkpoint_writer();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Signal handler for SIGINT and SIGTERM during a checkpointed run.
+ * @param signal_number The signal.
+ */
+void handle_checkpoint_signal(int signal_number) {
+    (void)signal_number;
+    checkpoint_interrupted = 1;
+}
+
+/**
+ * @brief Generates one room and solves every entry-exit pair, checkpointing to CHECKPOINT_PATH.
+ *
+ * Only the grid and one resumable solver are allocated, so the room can be far larger
+ * than the interactive simulation allows. If checkpoint_resume holds a checkpoint,
+ * the run continues from it. The checkpoint is removed once every pair is solved.
+ * @return 0 when finished, 1 if interrupted or the room is too large.
+ */
+int run_checkpointed(void) {
+    if ((long)ROWS * COLS > INT_MAX) {
+        fprintf(stderr, "Rooms of more than %d cells are not supported\n", INT_MAX);
+        return 1;
+    }
+    if (snprintf(checkpoint_temp_path, sizeof(checkpoint_temp_path), "%s.tmp", CHECKPOINT_PATH) >=
+        (int)sizeof(checkpoint_temp_path)) {
+        fprintf(stderr, "Checkpoint path %s is too long\n", CHECKPOINT_PATH);
+        return 1;
+    }
+    int cells = ROWS * COLS, pairs = NUM_ENTRIES * NUM_EXITS;
+    allocate_grid(ROWS, COLS);
+    for (int row = 0; row < ROWS; row++) {
+        memset(matrix[row], CLOSED, COLS);
+    }
+    SolverState solver;
+    solver_alloc(&solver, ROWS * COLS);
+    checkpoint_results = (int *)tracked_malloc(MEMORY_RUNTIME, pairs * sizeof(int));
+    checkpoint_grid_bits = (unsigned char *)tracked_calloc(MEMORY_RUNTIME, ((size_t)cells + 7) / 8, 1);
+    checkpoint_visited_bits = (unsigned char *)tracked_calloc(MEMORY_RUNTIME, ((size_t)cells + 7) / 8, 1);
+
+    CheckpointHeader *progress = &checkpoint_progress;
+    if (checkpoint_resume != NULL) {
+        restore_checkpoint(&solver);
+        tracked_free(checkpoint_resume);
+        checkpoint_resume = NULL;
+        printf("Resuming from %s after %.1f s of earlier work: ", CHECKPOINT_PATH, progress->elapsed_ms / 1000.0);
+        if (progress->phase == CHECKPOINT_GENERATING) {
+            printf("generator at row %d of %d\n", progress->next_row, ROWS);
+        } else {
+            printf("solving entry %d to exit %d, %ld cells expanded\n", progress->pair / NUM_EXITS + 1,
+                   progress->pair % NUM_EXITS + 1, progress->expanded);
+        }
+    } else {
+        memset(progress, 0, sizeof(CheckpointHeader));
+        memcpy(progress->magic, CHECKPOINT_MAGIC, 8);
+        progress->rows = ROWS;
+        progress->cols = COLS;
+        progress->entries = NUM_ENTRIES;
+        progress->exits = NUM_EXITS;
+        progress->density = density;
+        progress->seed = run_seed;
+        progress->phase = CHECKPOINT_GENERATING;
+        printf("Generating and solving a %dx%d room, checkpointing to %s every %g s\n", ROWS, COLS,
+               CHECKPOINT_PATH, CHECKPOINT_INTERVAL_S);
+    }
+    fflush(stdout);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_checkpoint_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    pthread_create(&checkpoint_writer, NULL, checkpoint_writer_func, NULL);
+
+    double start_ms = monotonic_ms(), earlier_ms = progress->elapsed_ms;
+    double next_checkpoint_ms = start_ms + CHECKPOINT_INTERVAL_S * 1000.0;
+    bool running = true;
+    if (progress->phase == CHECKPOINT_GENERATING) {
+        int band = CHECKPOINT_BAND_CELLS / COLS > 0 ? CHECKPOINT_BAND_CELLS / COLS : 1;
+        while (running && progress->next_row < ROWS) {
+            int last_row = progress->next_row + band < ROWS ? progress->next_row + band : ROWS;
+            randomize_rows(matrix, density, progress->next_row, last_row);
+            progress->next_row = last_row;
+            running = checkpoint_tick(&solver, &next_checkpoint_ms, start_ms - earlier_ms);
+        }
+        if (running) {
+            place_entry_exit_points(matrix);
+            progress->phase = CHECKPOINT_SOLVING;
+            progress->pair = 0;
+            solver_init(&solver, matrix, entry_cells[0], exit_cells[0]);
+        }
+    }
+    while (running && progress->pair < pairs) {
+        if (solver_step(&solver, CHECKPOINT_STEP_BUDGET) != SOLVER_RUNNING) {
+            checkpoint_results[progress->pair++] = solver.result;
+            if (progress->pair == pairs) {
+                break;
+            }
+            solver_init(&solver, matrix, entry_cells[progress->pair / NUM_EXITS],
+                        exit_cells[progress->pair % NUM_EXITS]);
+        }
+        running = checkpoint_tick(&solver, &next_checkpoint_ms, start_ms - earlier_ms);
+    }
+    double run_ms = monotonic_ms() - start_ms;
+
+    pthread_mutex_lock(&checkpoint_mutex);
+    checkpoint_writer_stop = true;
+    pthread_cond_broadcast(&checkpoint_cond);
+    pthread_mutex_unlock(&checkpoint_mutex);
+    pthread_join(checkpoint_writer, NULL);
+
+    if (running) {
+        unlink(CHECKPOINT_PATH);
+        printf("Solved in %.1f s of work, %.1f s in this run:\n", (earlier_ms + run_ms) / 1000.0, run_ms / 1000.0);
+        for (int pair = 0; pair < pairs; pair++) {
+            printf("  Entry %d to exit %d: ", pair / NUM_EXITS + 1, pair % NUM_EXITS + 1);
+            if (checkpoint_results[pair] < 0) {
+                printf("unreachable\n");
+            } else {
+                printf("%d steps\n", checkpoint_results[pair]);
+            }
+        }
+    } else {
+        printf("Interrupted; run again with -C %s to resume\n", CHECKPOINT_PATH);
+    }
+    printf("Checkpoints: %ld written, %ld failed, %ld delayed by a busy writer, last one %zu bytes\n",
+           checkpoints_written, checkpoint_failures, checkpoints_deferred, checkpoint_length);
+    printf("Checkpoint overhead: %.1f ms of snapshots on the solving thread (%.2f%% of %.1f s), "
+           "%.1f ms of writing in the background\n", checkpoint_snapshot_ms,
+           run_ms > 0 ? 100.0 * checkpoint_snapshot_ms / run_ms : 0.0, run_ms / 1000.0, checkpoint_write_ms);
+
+    tracked_free(checkpoint_results);
+    tracked_free(checkpoint_grid_bits);
+    tracked_free(checkpoint_visited_bits);
+    tracked_free(checkpoint_buffer);
+    solver_free(&solver);
+    free_grid(ROWS);
+    return running ? 0 : 1;
+}
+
+/**
+ * @brief Shortest distance between two cells with memory-bounded IDA*.
+ *
+ * Uses no per-cell arrays: the search stack holds one frame per step of the current
+ * path, and a fixed IDA_TABLE_SIZE-entry transposition table prunes cells already
+ * reached at an equal or lower cost in the same iteration. The peak stack depth
+ * is kept in ida_peak_depth.
+ * @param matrix The maze matrix.
+ * @param source The source cell index.
+ * @param target The target cell index.
+ * @param max_expansions Expansion budget across all iterations.
+ * @param expanded Incremented by the number of expanded cells.
+ * @return The distance in steps, -1 if unreachable, or IDA_GAVE_UP if the budget ran out.
+ */
+int ida_star_search(char **matrix, int source, int target, long max_expansions, long *expanded) {
+    MAZELOCK_PROBE2(ida__start, source, target);
+    int target_row = target / COLS, target_col = target % COLS;
+    int threshold = abs(source / COLS - target_row) + abs(source % COLS - target_col);
+    long budget = max_expansions;
+
+    while (true) {
+        int next_threshold = INT_MAX;
+        int depth = 0;
+        ida_iteration++;
+
+        if (ida_stack_capacity == 0) {
+            ida_stack_capacity = 64;
+            ida_stack = (IdaFrame *)tracked_malloc(MEMORY_SCRATCH, ida_stack_capacity * sizeof(IdaFrame));
+        }
+        ida_stack[depth++] = (IdaFrame){source, 0, -1};
+        while (depth > 0) {
+            IdaFrame *frame = &ida_stack[depth - 1];
+            if (frame->next_dir == -1) {
+                // First visit: bound, goal and transposition checks
+                int row = frame->cell / COLS, col = frame->cell % COLS;
+                int f = frame->g + abs(row - target_row) + abs(col - target_col);
+                if (f > threshold) {
+                    if (f < next_threshold) {
+                        next_threshold = f;
+                    }
+                    depth--;
+                    continue;
+                }
+                if (frame->cell == target) {
+                    MAZELOCK_PROBE4(ida__done, source, target, frame->g, *expanded);
+                    return frame->g;
+                }
+                IdaTableEntry *entry = &ida_table[(unsigned int)frame->cell * 2654435761u % IDA_TABLE_SIZE];
+                if (entry->iteration == ida_iteration && entry->cell == frame->cell && entry->g <= frame->g) {
+                    depth--;
+                    continue;
+                }
+                *entry = (IdaTableEntry){frame->cell, frame->g, ida_iteration};
+                (*expanded)++;
+                if (--budget < 0) {
+                    MAZELOCK_PROBE4(ida__done, source, target, IDA_GAVE_UP, *expanded);
+                    return IDA_GAVE_UP;
+                }
+                frame->next_dir = 0;
+            }
+            if (frame->next_dir == 4) {
+                depth--;
+                continue;
+            }
+            int d = frame->next_dir++;
+            int next_row = frame->cell / COLS + ROW_STEP[d], next_col = frame->cell % COLS + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS ||
+                matrix[next_row][next_col] == CLOSED) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            if (depth > 1 && ida_stack[depth - 2].cell == next) {
+                continue;
+            }
+            if (depth == ida_stack_capacity) {
+                ida_stack_capacity *= 2;
+                ida_stack = (IdaFrame *)tracked_realloc(MEMORY_SCRATCH, ida_stack, ida_stack_capacity * sizeof(IdaFrame));
+                frame = &ida_stack[depth - 1];
+            }
+            ida_stack[depth++] = (IdaFrame){next, frame->g + 1, -1};
+            if (depth > ida_peak_depth) {
+                ida_peak_depth = depth;
+            }
+        }
+        if (next_threshold == INT_MAX) {
+            MAZELOCK_PROBE4(ida__done, source, target, -1, *expanded);
+            return -1;
+        }
+        threshold = next_threshold;
+    }
+}
+
+/**
+ * @brief Tells whether a cell lies on the outer edge of the room.
+ * @param cell The cell index.
+ * @return true for edge cells.
+ */
+bool is_edge_cell(int cell) {
+    int row = cell / COLS, col = cell % COLS;
+    return row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1;
+}
+
+/**
+ * @brief Walks from start towards target keeping one hand on the wall.
+ *
+ * Needs no visited array and never writes to the matrix: the whole state is the
+ * current cell, the heading and, in Pledge mode, the running turn count. Loops
+ * are caught with Brent's cycle detection on that state, so the extra memory is
+ * constant. In Pledge mode the walker heads in its starting direction whenever the
+ * turn count is back to zero, which keeps it from circling free-standing walls.
+ *
+ * A plain wall walk is only guaranteed to find the target when both ends lie on
+ * the outer edge of the room: it then traces the whole outer boundary of the
+ * start's region, which the target must touch if it is reachable. Otherwise,
+ * and always in Pledge mode, a miss proves nothing.
+ * @param matrix The maze matrix.
+ * @param start The start cell index.
+ * @param target The target cell index.
+ * @param right_hand Keep the right hand on the wall instead of the left.
+ * @param pledge Use the Pledge rule.
+ * @param max_steps Step budget.
+ * @return The walk outcome.
+ */
+WallFollowResult wall_follow(char **matrix, int start, int target, bool right_hand, bool pledge, long max_steps) {
+    MAZELOCK_PROBE3(wall__start, start, target, pledge);
+    WallFollowResult result = {false, false, !pledge && is_edge_cell(start) && is_edge_cell(target), 0};
+    int hand = right_hand ? 1 : 3;
+    int row = start / COLS, col = start % COLS;
+    int heading = 0, turns = 0;
+    bool following = !pledge;
+
+    // Start facing away from the nearest outer wall
+    if (row == 0) {
+        heading = 2;
+    } else if (col == COLS - 1) {
+        heading = 3;
+    } else if (col == 0) {
+        heading = 1;
+    }
+    int preferred = heading;
+
+    // Brent's algorithm: compare against a saved state, re-saved at doubling intervals
+    int saved_cell = start, saved_heading = heading, saved_turns = turns;
+    bool saved_following = following;
+    long power = 1, since_saved = 0;
+
+    while (result.steps < max_steps) {
+        if (row * COLS + col == target) {
+            result.found = true;
+            MAZELOCK_PROBE4(wall__done, start, target, result.found, result.steps);
+            return result;
+        }
+        int turn = -1;
+        if (!following) {
+            int ahead_row = row + HEADING_ROW[preferred], ahead_col = col + HEADING_COL[preferred];
+            if (ahead_row >= 0 && ahead_row < ROWS && ahead_col >= 0 && ahead_col < COLS &&
+                matrix[ahead_row][ahead_col] != CLOSED) {
+                turn = 0;
+            } else {
+                following = true;
+            }
+        }
+        if (turn == -1) {
+            // Try the hand side first, then straight on, then the other side, then back
+            const int order[4] = {hand, 0, 4 - hand, 2};
+            for (int k = 0; k < 4; k++) {
+                int candidate = (heading + order[k]) % 4;
+                int next_row = row + HEADING_ROW[candidate], next_col = col + HEADING_COL[candidate];
+                if (next_row >= 0 && next_row < ROWS && next_col >= 0 && next_col < COLS &&
+                    matrix[next_row][next_col] != CLOSED) {
+                    turn = order[k];
+                    break;
+                }
+            }
+            if (turn == -1) {
+                // Walled in on all four sides
+                result.looped = true;
+                MAZELOCK_PROBE4(wall__done, start, target, result.found, result.steps);
+                return result;
+            }
+        }
+        heading = (heading + turn) % 4;
+        if (pledge) {
+            turns += turn == 3 ? -1 : turn;
+            if (following && turns == 0) {
+                following = false;
+            }
+        }
+        row += HEADING_ROW[heading];
+        col += HEADING_COL[heading];
+        result.steps++;
+
+        if (row * COLS + col == saved_cell && heading == saved_heading && turns == saved_turns &&
+            following == saved_following) {
+            result.looped = true;
+            MAZELOCK_PROBE4(wall__done, start, target, result.found, result.steps);
+            return result;
+        }
+        if (++since_saved == power) {
+            saved_cell = row * COLS + col;
+            saved_heading = heading;
+            saved_turns = turns;
+            saved_following = following;
+            power *= 2;
+            since_saved = 0;
+        }
+    }
+    MAZELOCK_PROBE4(wall__done, start, target, result.found, result.steps);
+    return result;
+}
+
+/**
+ * @brief Runs the left-hand wall follower and the Pledge walker from the first entry to the first exit.
+ * @param matrix The maze matrix.
+ */
+void report_wall_follower(char **matrix) {
+    WallFollowResult result = wall_follow(matrix, entry_cells[0], exit_cells[0], false, false, 16L * ROWS * COLS);
+    WallFollowResult pledge = wall_follow(matrix, entry_cells[0], exit_cells[0], false, true, 16L * ROWS * COLS);
+
+    if (result.found) {
+        printf("Wall follower reached E0 in %ld steps\n", result.steps);
+    } else if (result.guaranteed && result.looped) {
+        printf("Wall follower looped after %ld steps: E0 is unreachable from S0\n", result.steps);
+    } else {
+        printf("Wall follower stopped after %ld steps without reaching E0 (not conclusive for this room)\n",
+               result.steps);
+    }
+    if (pledge.found) {
+        printf("Pledge walker reached E0 in %ld steps\n", pledge.steps);
+    } else {
+        printf("Pledge walker %s after %ld steps without reaching E0 (not conclusive)\n",
+               pledge.looped ? "looped" : "stopped", pledge.steps);
+    }
+}
+
+/**
+ * @brief Picks the worker that owns a cell.
+ * @param cell The cell index.
+ * @return The owning worker index.
+ */
+int hda_owner(int cell) {
+    return (int)((unsigned int)cell * 2654435761u % (unsigned int)hda_thread_count);
+}
+
+/**
+ * @brief Appends a message to a worker's queue without locking.
+ *
+ * Bounded multi-producer queue: each slot's sequence number tells producers
+ * whether it is free for their position and tells the consumer whether it is full.
+ * @param worker The receiving worker.
+ * @param message The message.
+ * @return false if the queue is full.
+ */
+bool hda_queue_push(HdaWorker *worker, HdaMessage message) {
+    unsigned long position = __atomic_load_n(&worker->enqueue_position, __ATOMIC_RELAXED);
+
+    while (true) {
+        HdaSlot *slot = &worker->slots[position & (HDA_QUEUE_SIZE - 1)];
+        long difference = (long)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&worker->enqueue_position, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->message = message;
+                __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = __atomic_load_n(&worker->enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Takes the oldest message from the worker's own queue.
+ * @param worker The receiving worker, which must be the calling thread's.
+ * @param message Receives the message.
+ * @return false if the queue is empty.
+ */
+bool hda_queue_pop(HdaWorker *worker, HdaMessage *message) {
+    HdaSlot *slot = &worker->slots[worker->dequeue_position & (HDA_QUEUE_SIZE - 1)];
+
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != worker->dequeue_position + 1) {
+        return false;
+    }
+    *message = slot->message;
+    __atomic_store_n(&slot->sequence, worker->dequeue_position + HDA_QUEUE_SIZE, __ATOMIC_RELEASE);
+    worker->dequeue_position++;
+    return true;
+}
+
+/**
+ * @brief Sends a node to its owner, parking it in a local buffer when the owner's queue is full.
+ * @param worker The sending worker.
+ * @param cell The cell index.
+ * @param g The cost to reach the cell.
+ */
+void hda_send(HdaWorker *worker, int cell, int g) {
+    int owner = hda_owner(cell);
+    HdaMessage message = {cell, g};
+
+    // Counted before it becomes visible, so the total never drops to zero while work is in flight
+    __atomic_fetch_add(&hda_outstanding, 1, __ATOMIC_RELAXED);
+    if (worker->overflow_count[owner] == 0 && hda_queue_push(&hda_workers[owner], message)) {
+        return;
+    }
+    if (worker->overflow_count[owner] == worker->overflow_capacity[owner]) {
+        worker->overflow_capacity[owner] = worker->overflow_capacity[owner] ? 2 * worker->overflow_capacity[owner] : 256;
+        worker->overflow[owner] = (HdaMessage *)tracked_realloc(MEMORY_QUEUES, worker->overflow[owner],
+                                                        worker->overflow_capacity[owner] * sizeof(HdaMessage));
+    }
+    worker->overflow[owner][worker->overflow_count[owner]++] = message;
+}
+
+/**
+ * @brief Retries the messages parked in a worker's overflow buffers.
+ * @param worker The sending worker.
+ */
+void hda_flush(HdaWorker *worker) {
+    for (int owner = 0; owner < hda_thread_count; owner++) {
+        int sent = 0;
+        while (sent < worker->overflow_count[owner] &&
+               hda_queue_push(&hda_workers[owner], worker->overflow[owner][sent])) {
+            sent++;
+        }
+        memmove(worker->overflow[owner], worker->overflow[owner] + sent,
+                (worker->overflow_count[owner] - sent) * sizeof(HdaMessage));
+        worker->overflow_count[owner] -= sent;
+    }
+}
+
+/**
+ * @brief Accepts a node into a worker's open list if it improves the cell's best cost.
+ * @param worker The owning worker.
+ * @param message The node.
+ */
+void hda_receive(HdaWorker *worker, HdaMessage message) {
+    int cell = message.cell;
+
+    if (hda_stamp[cell] == hda_search_id && hda_g[cell] <= message.g) {
+        __atomic_fetch_sub(&hda_outstanding, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    hda_stamp[cell] = hda_search_id;
+    hda_g[cell] = message.g;
+    int f = message.g + abs(cell / COLS - hda_target / COLS) + abs(cell % COLS - hda_target % COLS);
+
+    if (worker->open_size == worker->open_capacity) {
+        worker->open_capacity = worker->open_capacity ? 2 * worker->open_capacity : 1024;
+        worker->open_cell = (int *)tracked_realloc(MEMORY_QUEUES, worker->open_cell, worker->open_capacity * sizeof(int));
+        worker->open_g = (int *)tracked_realloc(MEMORY_QUEUES, worker->open_g, worker->open_capacity * sizeof(int));
+        worker->open_f = (int *)tracked_realloc(MEMORY_QUEUES, worker->open_f, worker->open_capacity * sizeof(int));
+    }
+    int position = worker->open_size++;
+    while (position > 0 && worker->open_f[(position - 1) / 2] > f) {
+        int parent = (position - 1) / 2;
+        worker->open_cell[position] = worker->open_cell[parent];
+        worker->open_g[position] = worker->open_g[parent];
+        worker->open_f[position] = worker->open_f[parent];
+        position = parent;
+    }
+    worker->open_cell[position] = cell;
+    worker->open_g[position] = message.g;
+    worker->open_f[position] = f;
+}
+
+/**
+ * @brief Expands the best node of a worker's open list.
+ * @param worker The owning worker, whose open list must not be empty.
+ */
+void hda_expand(HdaWorker *worker) {
+    int cell = worker->open_cell[0], g = worker->open_g[0], f = worker->open_f[0];
+    int size = --worker->open_size;
+    int position = 0;
+
+    while (2 * position + 1 < size) {
+        int child = 2 * position + 1;
+        if (child + 1 < size && worker->open_f[child + 1] < worker->open_f[child]) {
+            child++;
+        }
+        if (worker->open_f[size] <= worker->open_f[child]) {
+            break;
+        }
+        worker->open_cell[position] = worker->open_cell[child];
+        worker->open_g[position] = worker->open_g[child];
+        worker->open_f[position] = worker->open_f[child];
+        position = child;
+    }
+    worker->open_cell[position] = worker->open_cell[size];
+    worker->open_g[position] = worker->open_g[size];
+    worker->open_f[position] = worker->open_f[size];
+
+    // Skip stale copies and anything that cannot beat the best route found so far
+    if (g == hda_g[cell] && f < __atomic_load_n(&hda_incumbent, __ATOMIC_RELAXED)) {
+        if (cell == hda_target) {
+            int best = __atomic_load_n(&hda_incumbent, __ATOMIC_RELAXED);
+            while (g < best && !__atomic_compare_exchange_n(&hda_incumbent, &best, g, true,
+                                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+        } else {
+            worker->expanded++;
+            int row = cell / COLS, col = cell % COLS;
+            for (int d = 0; d < 4; d++) {
+                int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+                if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS ||
+                    hda_matrix[next_row][next_col] == CLOSED) {
+                    continue;
+                }
+                int next = next_row * COLS + next_col;
+                int h = abs(next_row - hda_target / COLS) + abs(next_col - hda_target % COLS);
+                if (g + 1 + h < __atomic_load_n(&hda_incumbent, __ATOMIC_RELAXED)) {
+                    hda_send(worker, next, g + 1);
+                }
+            }
+        }
+    }
+    __atomic_fetch_sub(&hda_outstanding, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Main loop of an HDA* worker thread.
+ *
+ * The search is over once no message is queued, parked or open anywhere: every
+ * message is counted in hda_outstanding before it is sent and only uncounted
+ * after it has been dropped or expanded.
+ * @param arg The worker.
+ * @return Unused return value.
+ */
+void *hda_thread_func(void *arg) {
+    HdaWorker *worker = (HdaWorker *)arg;
+    HdaMessage message;
+
+    while (true) {
+        while (hda_queue_pop(worker, &message)) {
+            hda_receive(worker, message);
+        }
+        hda_flush(worker);
+        if (worker->open_size > 0) {
+            hda_expand(worker);
+        } else if (__atomic_load_n(&hda_outstanding, __ATOMIC_ACQUIRE) == 0) {
+            return NULL;
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * @brief Frees the HDA* worker states.
+ */
+void release_hda_workers(void) {
+    for (int k = 0; k < hda_thread_count; k++) {
+        for (int owner = 0; owner < hda_thread_count; owner++) {
+            tracked_free(hda_workers[k].overflow[owner]);
+        }
+        tracked_free(hda_workers[k].overflow);
+        tracked_free(hda_workers[k].overflow_count);
+        tracked_free(hda_workers[k].overflow_capacity);
+        tracked_free(hda_workers[k].slots);
+        tracked_free(hda_workers[k].open_cell);
+        tracked_free(hda_workers[k].open_g);
+        tracked_free(hda_workers[k].open_f);
+    }
+    tracked_free(hda_workers);
+    hda_workers = NULL;
+    hda_thread_count = 0;
+}
+
+/**
+ * @brief Shortest distance between two cells with hash-distributed parallel A*.
+ *
+ * Every cell is owned by one thread, chosen by hashing its index. A thread keeps
+ * its own open list and the best known cost of its cells, and hands generated
+ * nodes to their owners through lock-free queues. The search goes on after the
+ * target is first reached, pruning against that incumbent, until no work is left,
+ * so the result is optimal.
+ * @param matrix The maze matrix.
+ * @param source The source cell index.
+ * @param target The target cell index.
+ * @param thread_count The number of search threads.
+ * @param expanded Incremented by the number of expanded cells.
+ * @return The distance in steps, or -1 if the target is unreachable.
+ */
+int hda_star_search(char **matrix, int source, int target, int thread_count, long *expanded) {
+    MAZELOCK_PROBE3(hda__start, source, target, thread_count);
+    pthread_t threads[thread_count];
+
+    if (thread_count != hda_thread_count) {
+        release_hda_workers();
+        hda_thread_count = thread_count;
+        hda_workers = (HdaWorker *)tracked_aligned_alloc(MEMORY_QUEUES, 64, thread_count * sizeof(HdaWorker));
+        if (hda_workers == NULL) {
+            MAZELOCK_PROBE4(hda__done, source, target, -1, *expanded);
+            return -1;
+        }
+        memset(hda_workers, 0, thread_count * sizeof(HdaWorker));
+        for (int k = 0; k < thread_count; k++) {
+            hda_workers[k].id = k;
+            hda_workers[k].slots = (HdaSlot *)tracked_malloc(MEMORY_QUEUES, HDA_QUEUE_SIZE * sizeof(HdaSlot));
+            hda_workers[k].overflow = (HdaMessage **)tracked_calloc(MEMORY_QUEUES, thread_count, sizeof(HdaMessage *));
+            hda_workers[k].overflow_count = (int *)tracked_calloc(MEMORY_QUEUES, thread_count, sizeof(int));
+            hda_workers[k].overflow_capacity = (int *)tracked_calloc(MEMORY_QUEUES, thread_count, sizeof(int));
+        }
+    }
+    for (int k = 0; k < thread_count; k++) {
+        HdaWorker *worker = &hda_workers[k];
+        for (unsigned long slot = 0; slot < HDA_QUEUE_SIZE; slot++) {
+            worker->slots[slot].sequence = slot;
+        }
+        worker->enqueue_position = worker->dequeue_position = 0;
+        worker->open_size = 0;
+        worker->expanded = 0;
+    }
+
+    hda_matrix = matrix;
+    hda_target = target;
+    hda_incumbent = INT_MAX;
+    hda_outstanding = 0;
+    hda_search_id++;
+    hda_send(&hda_workers[0], source, 0);
+
+    for (int k = 0; k < thread_count; k++) {
+        pthread_create(&threads[k], NULL, hda_thread_func, &hda_workers[k]);
+    }
+    for (int k = 0; k < thread_count; k++) {
+        pthread_join(threads[k], NULL);
+        *expanded += hda_workers[k].expanded;
+    }
+    MAZELOCK_PROBE4(hda__done, source, target, hda_incumbent == INT_MAX ? -1 : hda_incumbent, *expanded);
+    return hda_incumbent == INT_MAX ? -1 : hda_incumbent;
+}
+
+/**
+ * @brief Real clock: current monotonic time.
+ * @return The time in milliseconds.
+ */
+double real_now_ms(void) {
+    return monotonic_ms();
+}
+
+/**
+ * @brief Real clock: sleeps until the deadline has passed.
+ * @param participant Unused participant number.
+ * @param deadline_ms The deadline in milliseconds.
+ */
+void real_sleep_until(int participant, double deadline_ms) {
+    (void)participant;
+    double remaining_ms = deadline_ms - monotonic_ms();
+    if (remaining_ms > 0) {
+        long remaining_us = (long)(remaining_ms * 1000.0);
+        struct timespec pause = {remaining_us / 1000000, (remaining_us % 1000000) * 1000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/**
+ * @brief Real clock: work already takes real time, so there is nothing to account for.
+ * @param participant Unused participant number.
+ * @param ms Unused duration.
+ */
+void real_spend(int participant, double ms) {
+    (void)participant;
+    (void)ms;
+}
+
+/**
+ * @brief Real clock: participants run freely, so joining and leaving do nothing.
+ * @param participant Unused participant number.
+ */
+void real_participant_noop(int participant) {
+    (void)participant;
+}
+
+/**
+ * @brief Simulated clock: grants the earliest-deadline waiting participant the right to run.
+ *
+ * Nothing is granted while another participant runs or has not arrived yet. Ties go to
+ * the lowest participant number, so every run with the same seed replays identically.
+ * Must be called with sim_mutex held.
+ */
+void simulated_schedule(void) {
+    int next = -1;
+
+    if (sim_running != -1) {
+        return;
+    }
+    for (int participant = 0; participant < sim_participants; participant++) {
+        if (sim_state[participant] == SIM_ARRIVING) {
+            return;
+        }
+        if (sim_state[participant] == SIM_WAITING &&
+            (next == -1 || sim_deadline[participant] < sim_deadline[next])) {
+            next = participant;
+        }
+    }
+    if (next == -1) {
+        return;
+    }
+    if (sim_deadline[next] > sim_now_ms) {
+        sim_now_ms = sim_deadline[next];
+    }
+    sim_running = next;
+    pthread_cond_broadcast(&sim_cond);
+}
+
+/**
+ * @brief Simulated clock: waits with sim_mutex held until the participant is granted the clock.
+ * @param participant The participant number.
+ */
+void simulated_wait_turn(int participant) {
+    simulated_schedule();
+    while (sim_running != participant) {
+        pthread_cond_wait(&sim_cond, &sim_mutex);
+    }
+    sim_state[participant] = SIM_RUNNING;
+}
+
+/**
+ * @brief Simulated clock: current simulated time.
+ * @return The time in milliseconds since the simulation started.
+ */
+double simulated_now_ms(void) {
+    pthread_mutex_lock(&sim_mutex);
+    double now = sim_now_ms;
+    pthread_mutex_unlock(&sim_mutex);
+    return now;
+}
+
+/**
+ * @brief Simulated clock: gives up the clock until the deadline is the earliest one.
+ * @param participant The running participant.
+ * @param deadline_ms The deadline in milliseconds.
+ */
+void simulated_sleep_until(int participant, double deadline_ms) {
+    pthread_mutex_lock(&sim_mutex);
+    sim_state[participant] = SIM_WAITING;
+    sim_deadline[participant] = deadline_ms;
+    sim_running = -1;
+    simulated_wait_turn(participant);
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+/**
+ * @brief Simulated clock: accounts for work that would have taken ms of real time.
+ * @param participant The running participant.
+ * @param ms The duration of the work in milliseconds.
+ */
+void simulated_spend(int participant, double ms) {
+    simulated_sleep_until(participant, simulated_now_ms() + ms);
+}
+
+/**
+ * @brief Simulated clock: a participant thread starts and waits for its first turn.
+ * @param participant The participant number.
+ */
+void simulated_enter(int participant) {
+    pthread_mutex_lock(&sim_mutex);
+    sim_state[participant] = SIM_WAITING;
+    sim_deadline[participant] = sim_now_ms;
+    simulated_wait_turn(participant);
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+/**
+ * @brief Simulated clock: a participant thread finishes and hands the clock on.
+ * @param participant The participant number.
+ */
+void simulated_leave(int participant) {
+    pthread_mutex_lock(&sim_mutex);
+    sim_state[participant] = SIM_GONE;
+    if (sim_running == participant) {
+        sim_running = -1;
+    }
+    simulated_schedule();
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+/**
+ * @brief Resets the simulated clock to time zero for the given number of participants.
+ *
+ * Must be called before any participant thread is started.
+ * @param participants The number of participant threads.
+ */
+void simulated_clock_setup(int participants) {
+    sim_participants = participants;
+    sim_state = (int *)tracked_malloc(MEMORY_RUNTIME, participants * sizeof(int));
+    sim_deadline = (double *)tracked_malloc(MEMORY_RUNTIME, participants * sizeof(double));
+    for (int participant = 0; participant < participants; participant++) {
+        sim_state[participant] = SIM_ARRIVING;
+    }
+    sim_now_ms = 0;
+    sim_running = -1;
+}
+
+/**
+ * @brief Frees the simulated clock's participant table.
+ */
+void simulated_clock_release(void) {
+    tracked_free(sim_state);
+    tracked_free(sim_deadline);
+    sim_state = NULL;
+    sim_deadline = NULL;
+    sim_participants = 0;
+}
+
+/**
+ * @brief Appends a room to the tail of a job class queue. Must be called with fleet_queue_mutex held.
+ * @param r The room index.
+ * @param job_class The job class.
+ * @param generation The generation of the room's job the entry stands for.
+ */
+void fleet_queue_append(int r, int job_class, unsigned long generation) {
+    fleet[r].queued_class = job_class;
+    fleet[r].queued_generation = generation;
+    fleet[r].queue_next = -1;
+    fleet[r].queue_prev = fleet_queue_tail[job_class];
+    if (fleet_queue_tail[job_class] == -1) {
+        fleet_queue_head[job_class] = r;
+    } else {
+        fleet[fleet_queue_tail[job_class]].queue_next = r;
+    }
+    fleet_queue_tail[job_class] = r;
+    __atomic_store_n(&fleet_queue_length[job_class], fleet_queue_length[job_class] + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Unlinks a room from the queue it is in. Must be called with fleet_queue_mutex held.
+ * @param r The room index.
+ */
+void fleet_queue_remove(int r) {
+    int job_class = fleet[r].queued_class;
+    if (job_class == JOB_NONE) {
+        return;
+    }
+    if (fleet[r].queue_prev == -1) {
+        fleet_queue_head[job_class] = fleet[r].queue_next;
+    } else {
+        fleet[fleet[r].queue_prev].queue_next = fleet[r].queue_next;
+    }
+    if (fleet[r].queue_next == -1) {
+        fleet_queue_tail[job_class] = fleet[r].queue_prev;
+    } else {
+        fleet[fleet[r].queue_next].queue_prev = fleet[r].queue_prev;
+    }
+    fleet[r].queued_class = JOB_NONE;
+    __atomic_store_n(&fleet_queue_length[job_class], fleet_queue_length[job_class] - 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Fills a room with its next layout and sets its doors and fingerprint.
+ *
+ * Without a pool, every room is freshly generated. With one, the first FLEET_POOL_SIZE
+ * rooms fill the pool; after that a room is a copy of a random pooled layout, and one
+ * draw in FLEET_POOL_REFRESH generates a fresh layout over a random slot, so the pool
+ * keeps changing. Only the generation thread calls this.
+ * @param room The room, with its mutex held.
+ */
+void fleet_place_layout(Room *room) {
+    size_t words = (size_t)fleet_layout_words;
+
+    room->fingerprint = 0;
+    if (FLEET_POOL_SIZE == 0) {
+        randomize_matrix(room->matrix, density);
+        room->entry_cell = entry_cells[0];
+        room->exit_cell = exit_cells[0];
+        return;
+    }
+    int slot = -1;
+    if (fleet_pool_count < FLEET_POOL_SIZE) {
+        slot = fleet_pool_count++;
+    } else if (fleet_pool_draws % FLEET_POOL_REFRESH == 0) {
+        slot = rand() % FLEET_POOL_SIZE;
+    }
+    fleet_pool_draws++;
+
+    if (slot >= 0) {
+        FleetLayout *layout = &fleet_pool[slot];
+        unsigned long long *bits = &fleet_pool_words[slot * words];
+        randomize_matrix(room->matrix, density);
+        pack_open_cells(room->matrix, bits);
+        layout->entry_cell = entry_cells[0];
+        layout->exit_cell = exit_cells[0];
+        unsigned long long hash = fingerprint_words(bits, words);
+        hash = (hash ^ (unsigned int)layout->entry_cell) * 1099511628211ULL;
+        hash = (hash ^ (unsigned int)layout->exit_cell) * 1099511628211ULL;
+        // Zero marks a free cache slot
+        layout->fingerprint = hash != 0 ? hash : 1;
+        fleet_pool_generated++;
+    } else {
+        slot = rand() % fleet_pool_count;
+        const unsigned long long *bits = &fleet_pool_words[slot * words];
+        for (int row = 0; row < ROWS; row++) {
+            const unsigned long long *open = &bits[(size_t)row * render_words];
+            for (int col = 0; col < COLS; col++) {
+                room->matrix[row][col] = (open[col >> 6] >> (col & 63)) & 1 ? OPEN : CLOSED;
+            }
+        }
+        const FleetLayout *layout = &fleet_pool[slot];
+        room->matrix[layout->entry_cell / COLS][layout->entry_cell % COLS] = ENTRY;
+        room->matrix[layout->exit_cell / COLS][layout->exit_cell % COLS] = EXIT;
+    }
+    room->entry_cell = fleet_pool[slot].entry_cell;
+    room->exit_cell = fleet_pool[slot].exit_cell;
+    room->fingerprint = fleet_pool[slot].fingerprint;
+}
+
+/**
+ * @brief Looks up the solution of a layout in the fleet solution cache.
+ * @param fingerprint The layout fingerprint, not zero.
+ * @param distance Set to the cached distance, or -1 for an unreachable exit.
+ * @return true on a hit.
+ */
+bool solution_cache_lookup(unsigned long long fingerprint, int *distance) {
+    bool found = false;
+
+    pthread_mutex_lock(&solution_cache_mutex);
+    int mask = solution_cache_capacity - 1;
+    for (int slot = (int)(fingerprint & mask); solution_cache[slot].fingerprint != 0; slot = (slot + 1) & mask) {
+        if (solution_cache[slot].fingerprint == fingerprint) {
+            *distance = solution_cache[slot].distance;
+            found = true;
+            break;
+        }
+    }
+    if (found) {
+        solution_cache_hits++;
+    } else {
+        solution_cache_misses++;
+    }
+    pthread_mutex_unlock(&solution_cache_mutex);
+    return found;
+}
+
+/**
+ * @brief Stores the solution of a layout in the fleet solution cache.
+ *
+ * Linear probing over a power-of-two table. When it is three quarters full it is
+ * cleared and starts again; the pool refills it within a rotation or two.
+ * @param fingerprint The layout fingerprint, not zero.
+ * @param distance The distance, or -1 for an unreachable exit.
+ */
+void solution_cache_insert(unsigned long long fingerprint, int distance) {
+    pthread_mutex_lock(&solution_cache_mutex);
+    if (solution_cache_count * 4 >= solution_cache_capacity * 3) {
+        memset(solution_cache, 0, solution_cache_capacity * sizeof(SolutionCacheEntry));
+        solution_cache_count = 0;
+    }
+    int mask = solution_cache_capacity - 1;
+    int slot = (int)(fingerprint & mask);
+    while (solution_cache[slot].fingerprint != 0 && solution_cache[slot].fingerprint != fingerprint) {
+        slot = (slot + 1) & mask;
+    }
+    solution_cache_count += solution_cache[slot].fingerprint == 0;
+    solution_cache[slot].fingerprint = fingerprint;
+    solution_cache[slot].distance = distance;
+    pthread_mutex_unlock(&solution_cache_mutex);
+}
+
+/**
+ * @brief Adjusts the solver step budget so a slice takes about FLEET_SLICE_TARGET_MS.
+ *
+ * The cost per cell is a moving average over slices; the budget is rounded to the
+ * nearest power of two, so small jitter does not change it. Must be called with
+ * fleet_queue_mutex held.
+ * @param expanded The number of cells the slice expanded.
+ * @param slice_ms The time the slice took.
+ */
+void fleet_tune_step_budget(long expanded, double slice_ms) {
+    if (expanded < FLEET_TUNE_MIN_CELLS) {
+        return;
+    }
+    double sample = slice_ms / expanded;
+    fleet_ms_per_cell = fleet_ms_per_cell == 0 ? sample : fleet_ms_per_cell + (sample - fleet_ms_per_cell) / 16;
+    if (fleet_ms_per_cell <= 0) {
+        return;
+    }
+    double cells = FLEET_SLICE_TARGET_MS / fleet_ms_per_cell;
+    int budget = FLEET_MIN_STEP_BUDGET;
+    while (budget < FLEET_MAX_STEP_BUDGET && budget * 1.4142135 < cells) {
+        budget *= 2;
+    }
+    __atomic_store_n(&fleet_step_budget, budget, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Maps a warm-restart snapshot and adopts its pool, cache and step budget.
+ *
+ * The file is mapped privately and its arrays are used in place. The pooled layouts
+ * and the cache are checked before use, which reads them once; a snapshot that fails
+ * a check, or was taken with other room or pool settings, is ignored.
+ * @param path The snapshot file.
+ * @return true if the snapshot was adopted.
+ */
+bool load_warm_snapshot(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            perror(path);
+        }
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(WarmSnapshotHeader)) {
+        close(fd);
+        fprintf(stderr, "Warm snapshot %s is truncated; starting cold\n", path);
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+
+    const WarmSnapshotHeader *header = (const WarmSnapshotHeader *)mapping;
+    long file_size = (long)size;
+    // Counts are bounded by the file size and offsets lie inside it before any of them are multiplied or added
+    bool valid = memcmp(header->magic, WARM_SNAPSHOT_MAGIC, 8) == 0 && header->size == file_size &&
+                 header->pool_size >= 0 && header->pool_size <= file_size / (long)sizeof(FleetLayout) &&
+                 header->words >= 0 &&
+                 (header->pool_size == 0 || header->words <= file_size / (long)sizeof(unsigned long long) / header->pool_size) &&
+                 header->cache_capacity > 0 && header->cache_capacity <= file_size / (long)sizeof(SolutionCacheEntry) &&
+                 header->pool_count >= 0 && header->pool_count <= header->pool_size &&
+                 header->cache_count >= 0 && header->cache_count < header->cache_capacity &&
+                 header->pool_offset >= (long)sizeof(WarmSnapshotHeader) && header->pool_offset <= file_size &&
+                 header->words_offset >= 0 && header->words_offset <= file_size &&
+                 header->cache_offset >= 0 && header->cache_offset <= file_size &&
+                 header->pool_offset % 8 == 0 && header->words_offset % 8 == 0 && header->cache_offset % 8 == 0 &&
+                 header->pool_offset + header->pool_size * (long)sizeof(FleetLayout) <= header->words_offset &&
+                 header->words_offset + (long)header->pool_size * header->words * (long)sizeof(unsigned long long) <=
+                     header->cache_offset &&
+                 header->cache_offset + header->cache_capacity * (long)sizeof(SolutionCacheEntry) <= file_size;
+    if (!valid) {
+        munmap(mapping, size);
+        fprintf(stderr, "Warm snapshot %s is damaged; starting cold\n", path);
+        return false;
+    }
+    if (header->rows != ROWS || header->cols != COLS || header->density != density ||
+        header->entries != NUM_ENTRIES || header->exits != NUM_EXITS || header->pool_size != FLEET_POOL_SIZE ||
+        header->words != fleet_layout_words || header->cache_capacity != solution_cache_capacity) {
+        munmap(mapping, size);
+        fprintf(stderr, "Warm snapshot %s was taken with other settings; starting cold\n", path);
+        return false;
+    }
+
+    // The header alone does not vouch for the arrays: every pooled layout must have its
+    // doors on the edge and match its fingerprint, and the cache must keep a free slot
+    const unsigned char *base = (const unsigned char *)mapping;
+    const FleetLayout *pool = (const FleetLayout *)(base + header->pool_offset);
+    const unsigned long long *pool_words = (const unsigned long long *)(base + header->words_offset);
+    const SolutionCacheEntry *cache = (const SolutionCacheEntry *)(base + header->cache_offset);
+    valid = header->step_budget >= FLEET_MIN_STEP_BUDGET && header->step_budget <= FLEET_MAX_STEP_BUDGET &&
+            header->ms_per_cell >= 0 && header->ms_per_cell < 1e9;
+    for (int slot = 0; slot < header->pool_count && valid; slot++) {
+        int doors[2] = {pool[slot].entry_cell, pool[slot].exit_cell};
+        for (int door = 0; door < 2 && valid; door++) {
+            int row = doors[door] / COLS, col = doors[door] % COLS;
+            valid = doors[door] >= 0 && doors[door] < ROWS * COLS &&
+                    (row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1);
+        }
+        if (valid) {
+            unsigned long long hash = fingerprint_words(&pool_words[(size_t)slot * header->words], header->words);
+            hash = (hash ^ (unsigned int)doors[0]) * 1099511628211ULL;
+            hash = (hash ^ (unsigned int)doors[1]) * 1099511628211ULL;
+            valid = doors[0] != doors[1] && pool[slot].fingerprint == (hash != 0 ? hash : 1);
+        }
+    }
+    int used = 0;
+    for (int slot = 0; slot < header->cache_capacity && valid; slot++) {
+        used += cache[slot].fingerprint != 0;
+        valid = cache[slot].fingerprint == 0 || (cache[slot].distance >= -1 && cache[slot].distance < ROWS * COLS);
+    }
+    if (!valid || used != header->cache_count) {
+        munmap(mapping, size);
+        fprintf(stderr, "Warm snapshot %s is damaged; starting cold\n", path);
+        return false;
+    }
+
+    warm_mapping = (unsigned char *)mapping;
+    warm_mapping_size = size;
+    fleet_pool = (FleetLayout *)(warm_mapping + header->pool_offset);
+    fleet_pool_words = (unsigned long long *)(warm_mapping + header->words_offset);
+    solution_cache = (SolutionCacheEntry *)(warm_mapping + header->cache_offset);
+    fleet_pool_count = header->pool_count;
+    solution_cache_count = header->cache_count;
+    fleet_step_budget = header->step_budget;
+    fleet_ms_per_cell = header->ms_per_cell;
+    return true;
+}
+
+/**
+ * @brief Writes the pool, the cache and the step budget to a warm-restart snapshot.
+ *
+ * The snapshot goes to a temporary file that is synced and renamed over the old one,
+ * so a crash while writing leaves the previous snapshot.
+ * @param path The snapshot file.
+ */
+void write_warm_snapshot(const char *path) {
+    WarmSnapshotHeader header;
+    size_t pool_bytes = (size_t)FLEET_POOL_SIZE * sizeof(FleetLayout);
+    size_t words_bytes = (size_t)FLEET_POOL_SIZE * fleet_layout_words * sizeof(unsigned long long);
+    size_t cache_bytes = (size_t)solution_cache_capacity * sizeof(SolutionCacheEntry);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WARM_SNAPSHOT_MAGIC, 8);
+    header.rows = ROWS;
+    header.cols = COLS;
+    header.entries = NUM_ENTRIES;
+    header.exits = NUM_EXITS;
+    header.density = density;
+    header.pool_size = FLEET_POOL_SIZE;
+    header.pool_count = fleet_pool_count;
+    header.words = fleet_layout_words;
+    header.cache_capacity = solution_cache_capacity;
+    header.cache_count = solution_cache_count;
+    header.step_budget = fleet_step_budget;
+    header.ms_per_cell = fleet_ms_per_cell;
+    // Every section size is a multiple of 8 bytes, so the sections stay aligned
+    header.pool_offset = sizeof(header);
+    header.words_offset = header.pool_offset + (long)pool_bytes;
+    header.cache_offset = header.words_offset + (long)words_bytes;
+    header.size = header.cache_offset + (long)cache_bytes;
+
+    size_t path_length = strlen(path);
+    char temp_path[path_length + 5];
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".tmp", 5);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(temp_path);
+        return;
+    }
+    struct iovec iov[4] = {
+        {&header, sizeof(header)},
+        {fleet_pool, pool_bytes},
+        {fleet_pool_words, words_bytes},
+        {solution_cache, cache_bytes}
+    };
+    bool complete = write_gathered(fd, iov, 4) && fsync(fd) == 0;
+    complete = close(fd) == 0 && complete;
+    if (!complete || rename(temp_path, path) != 0) {
+        perror(path);
+        unlink(temp_path);
+    }
+}
+
+/**
+ * @brief Regenerates a room and queues its solve, if the job is admitted.
+ *
+ * A routine job is refused while the room still has a job in flight, so rotations
+ * shed load instead of piling up work when the solvers are saturated. An urgent job
+ * replaces a routine one in flight, and is refused only when the room already has an
+ * urgent job or the number of urgent jobs in flight has reached the solver count.
+ * @param r The room index.
+ * @param job_class The job class.
+ * @return true if the job was admitted, false otherwise.
+ */
+bool fleet_submit(int r, int job_class) {
+    Room *room = &fleet[r];
+    bool admitted;
+
+    metrics_lock(&room->mutex, HISTOGRAM_LOCK_ROOM);
+    metrics_lock(&fleet_queue_mutex, HISTOGRAM_LOCK_FLEET_QUEUE);
+    if (job_class == JOB_ROUTINE) {
+        admitted = room->job_class == JOB_NONE;
+    } else {
+        admitted = room->job_class != JOB_URGENT && fleet_urgent_in_flight < fleet_solver_count;
+    }
+    if (!admitted) {
+        fleet_stats[job_class].rejected++;
+        pthread_mutex_unlock(&fleet_queue_mutex);
+        pthread_mutex_unlock(&room->mutex);
+        return false;
+    }
+    if (room->job_class == JOB_ROUTINE) {
+        fleet_stats[JOB_ROUTINE].superseded++;
+    }
+    fleet_stats[job_class].admitted++;
+    fleet_urgent_in_flight += job_class == JOB_URGENT;
+    pthread_mutex_unlock(&fleet_queue_mutex);
+
+    fleet_place_layout(room);
+    solver_init(&room->solver, room->matrix, room->entry_cell, room->exit_cell);
+    // A solved layout needs no search; the job still goes through the queue like any other
+    int distance;
+    room->cached = room->fingerprint != 0 && solution_cache_lookup(room->fingerprint, &distance);
+    if (room->cached) {
+        room->solver.result = distance;
+        room->solver.status = distance >= 0 ? SOLVER_FOUND : SOLVER_UNREACHABLE;
+    }
+    room->job_class = job_class;
+    unsigned long generation = ++room->job_generation;
+    room->submitted_ms = active_clock->now_ms();
+    pthread_mutex_unlock(&room->mutex);
+    metrics_count(METRIC_FRAMES, 1);
+    MAZELOCK_PROBE2(room__publish, r, job_class);
+
+    // A solver may have queued the old job again in the meantime
+    metrics_lock(&fleet_queue_mutex, HISTOGRAM_LOCK_FLEET_QUEUE);
+    fleet_queue_remove(r);
+    fleet_queue_append(r, job_class, generation);
+    pthread_mutex_unlock(&fleet_queue_mutex);
+    return true;
+}
+
+/**
+ * @brief Prints the admission and SLO figures of each job class.
+ * @param title The line title.
+ * @param stats The totals to print.
+ */
+void print_fleet_stats(const char *title, const FleetClassStats *stats) {
+    printf("%s:", title);
+    for (int job_class = 0; job_class < JOB_CLASS_COUNT; job_class++) {
+        const FleetClassStats *totals = &stats[job_class];
+        printf(" %s %ld admitted, %ld rejected, %ld done (%ld reachable), SLO %.0f ms met %.1f%%, "
+               "latency mean %.3f ms, max %.3f ms%s",
+               totals->name, totals->admitted, totals->rejected, totals->completed, totals->reachable, totals->slo_ms,
+               totals->completed ? 100.0 * totals->within_slo / totals->completed : 100.0,
+               totals->completed ? totals->latency_total_ms / totals->completed : 0.0, totals->latency_max_ms,
+               job_class + 1 < JOB_CLASS_COUNT ? ";" : "");
+    }
+    if (stats[JOB_ROUTINE].superseded > 0) {
+        printf(" (%ld routine jobs superseded by urgent ones)", stats[JOB_ROUTINE].superseded);
+    }
+    putchar('\n');
+}
+
+/**
+ * @brief Fleet thread: submits a routine job for every room each rotation, and urgent jobs as they come.
+ *
+ * Urgent jobs arrive at random intervals averaging 1/URGENT_RATE seconds, or when 'u'
+ * is pressed. This thread is clock participant 0.
+ * @param arg Unused argument.
+ * @return Unused return value.
+ */
+void *fleet_generation_thread_func(void *arg) {
+    (void)arg;
+    long rotation = 0;
+    double next_rotation_ms, next_urgent_ms = DBL_MAX;
+    FleetClassStats last_stats[JOB_CLASS_COUNT];
+
+    active_clock->enter(0);
+    next_rotation_ms = active_clock->now_ms();
+    if (URGENT_RATE > 0) {
+        next_urgent_ms = next_rotation_ms + 2000.0 / URGENT_RATE * rand() / RAND_MAX;
+    }
+    while (!fleet_stopping) {
+        double now_ms = active_clock->now_ms();
+        if (now_ms >= simulation_end_ms) {
+            fleet_stopping = true;
+            break;
+        }
+        while (now_ms >= next_urgent_ms) {
+            fleet_submit(rand() % FLEET_SIZE, JOB_URGENT);
+            next_urgent_ms += 2000.0 / URGENT_RATE * rand() / RAND_MAX;
+        }
+        if (fleet_urgent_requested) {
+            fleet_urgent_requested = false;
+            fleet_submit(rand() % FLEET_SIZE, JOB_URGENT);
+        }
+        if (now_ms >= next_rotation_ms) {
+            // A simulated day has tens of thousands of rotations; only the final totals are printed
+            if (rotation > 0 && !active_clock->simulated) {
+                FleetClassStats delta[JOB_CLASS_COUNT];
+                char title[48];
+                metrics_lock(&fleet_queue_mutex, HISTOGRAM_LOCK_FLEET_QUEUE);
+                memcpy(delta, fleet_stats, sizeof(delta));
+                for (int job_class = 0; job_class < JOB_CLASS_COUNT; job_class++) {
+                    fleet_stats[job_class].latency_window_max_ms = 0;
+                }
+                pthread_mutex_unlock(&fleet_queue_mutex);
+                for (int job_class = 0; job_class < JOB_CLASS_COUNT; job_class++) {
+                    FleetClassStats current = delta[job_class];
+                    delta[job_class].latency_max_ms = delta[job_class].latency_window_max_ms;
+                    delta[job_class].admitted -= last_stats[job_class].admitted;
+                    delta[job_class].rejected -= last_stats[job_class].rejected;
+                    delta[job_class].superseded -= last_stats[job_class].superseded;
+                    delta[job_class].completed -= last_stats[job_class].completed;
+                    delta[job_class].reachable -= last_stats[job_class].reachable;
+                    delta[job_class].within_slo -= last_stats[job_class].within_slo;
+                    delta[job_class].latency_total_ms -= last_stats[job_class].latency_total_ms;
+                    last_stats[job_class] = current;
+                }
+                snprintf(title, sizeof(title), "Fleet rotation %ld", rotation);
+                print_fleet_stats(title, delta);
+            } else if (rotation == 0) {
+                memcpy(last_stats, fleet_stats, sizeof(last_stats));
+            }
+            for (int r = 0; r < FLEET_SIZE; r++) {
+                fleet_submit(r, JOB_ROUTINE);
+            }
+            rotation++;
+            next_rotation_ms += FLEET_ROTATION_MS;
+        }
+
+        double wake_ms = next_rotation_ms < next_urgent_ms ? next_rotation_ms : next_urgent_ms;
+        if (!active_clock->simulated && wake_ms > now_ms + FLEET_POLL_MS) {
+            wake_ms = now_ms + FLEET_POLL_MS;
+        }
+        fleet_next_event_ms = wake_ms;
+        active_clock->sleep_until(0, wake_ms);
+    }
+    active_clock->leave(0);
+    return NULL;
+}
+
+/**
+ * @brief Fleet thread: serves time slices of queued solves, urgent ones first.
+ *
+ * After each slice an unfinished job goes back to the tail of its class queue, so
+ * jobs of one class take turns and a newly queued urgent job preempts routine work
+ * at the next slice boundary. Each slice is charged to the clock, so simulated
+ * latencies include queueing. A queue entry carries the generation of the job it was
+ * queued for; a solver that finds the room on a newer job, or on none, drops the entry,
+ * since the newer job has its own. Solver thread index is clock participant index + 1.
+ * @param arg The solver thread index, cast to a pointer.
+ * @return Unused return value.
+ */
+void *fleet_solver_thread_func(void *arg) {
+    int index = (int)(long)arg;
+
+    active_clock->enter(index + 1);
+    while (!fleet_stopping) {
+        int r = -1;
+        unsigned long generation = 0;
+        metrics_lock(&fleet_queue_mutex, HISTOGRAM_LOCK_FLEET_QUEUE);
+        for (int job_class = 0; job_class < JOB_CLASS_COUNT && r == -1; job_class++) {
+            r = fleet_queue_head[job_class];
+        }
+        if (r != -1) {
+            generation = fleet[r].queued_generation;
+            fleet_queue_remove(r);
+        }
+        pthread_mutex_unlock(&fleet_queue_mutex);
+
+        if (r == -1) {
+            // With nothing queued, a simulated solver can sleep until the generator's next event
+            double now_ms = active_clock->now_ms();
+            active_clock->sleep_until(index + 1, active_clock->simulated && fleet_next_event_ms > now_ms ?
+                                                 fleet_next_event_ms : now_ms + 1.0);
+            continue;
+        }
+
+        Room *room = &fleet[r];
+        metrics_lock(&room->mutex, HISTOGRAM_LOCK_ROOM);
+        if (room->job_class == JOB_NONE || room->job_generation != generation) {
+            pthread_mutex_unlock(&room->mutex);
+            continue;
+        }
+        int job_class = room->job_class;
+        long expanded_before = room->solver.expanded;
+        double slice_start_ms = monotonic_ms();
+        int status = solver_step(&room->solver, __atomic_load_n(&fleet_step_budget, __ATOMIC_RELAXED));
+        long expanded = room->solver.expanded - expanded_before;
+        double slice_ms = active_clock->simulated ? expanded * SIMULATED_CELL_COST_MS : monotonic_ms() - slice_start_ms;
+        double submitted_ms = room->submitted_ms;
+        unsigned long long solved_fingerprint = 0;
+        if (status != SOLVER_RUNNING) {
+            room->job_class = JOB_NONE;
+            if (!room->cached) {
+                solved_fingerprint = room->fingerprint;
+            }
+        }
+        int distance = room->solver.result;
+        pthread_mutex_unlock(&room->mutex);
+        // The simulated clock can wait on the generator, which may be waiting on this room, so the
+        // slice is only charged once the room is released
+        active_clock->spend(index + 1, expanded * SIMULATED_CELL_COST_MS);
+        double latency_ms = active_clock->now_ms() - submitted_ms;
+        if (solved_fingerprint != 0) {
+            solution_cache_insert(solved_fingerprint, distance);
+        }
+
+        metrics_lock(&fleet_queue_mutex, HISTOGRAM_LOCK_FLEET_QUEUE);
+        fleet_tune_step_budget(expanded, slice_ms);
+        if (status == SOLVER_RUNNING) {
+            if (room->queued_class == JOB_NONE) {
+                fleet_queue_append(r, job_class, generation);
+            }
+        } else {
+            FleetClassStats *stats = &fleet_stats[job_class];
+            stats->completed++;
+            stats->reachable += status == SOLVER_FOUND;
+            stats->within_slo += latency_ms <= stats->slo_ms;
+            stats->latency_total_ms += latency_ms;
+            if (latency_ms > stats->latency_max_ms) {
+                stats->latency_max_ms = latency_ms;
+            }
+            if (latency_ms > stats->latency_window_max_ms) {
+                stats->latency_window_max_ms = latency_ms;
+            }
+            fleet_urgent_in_flight -= job_class == JOB_URGENT;
+            metrics_observe(job_class == JOB_URGENT ? HISTOGRAM_SOLVE_URGENT : HISTOGRAM_SOLVE_ROUTINE,
+                            latency_ms / 1000.0);
+        }
+        pthread_mutex_unlock(&fleet_queue_mutex);
+    }
+    active_clock->leave(index + 1);
+    return NULL;
+}
+
+/**
+ * @brief Allocates the fleet's rooms and starts the generation and solver threads.
+ *
+ * With -H, the layout pool, solution cache and step budget come from the warm-restart
+ * snapshot when there is a usable one, so the fleet starts at its steady-state latency.
+ */
+void start_fleet(void) {
+    const FleetClassStats empty_stats[JOB_CLASS_COUNT] = {
+        {"urgent", URGENT_SLO_MS, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+        {"routine", FLEET_ROTATION_MS, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+    };
+
+    fleet = (Room *)tracked_calloc(MEMORY_GRID, FLEET_SIZE, sizeof(Room));
+    for (int r = 0; r < FLEET_SIZE; r++) {
+        pthread_mutex_init(&fleet[r].mutex, NULL);
+        fleet[r].matrix = (char **)tracked_malloc(MEMORY_GRID, ROWS * sizeof(char *));
+        for (int row = 0; row < ROWS; row++) {
+            fleet[r].matrix[row] = (char *)tracked_malloc(MEMORY_GRID, COLS * sizeof(char));
+            memset(fleet[r].matrix[row], CLOSED, COLS);
+        }
+        solver_alloc(&fleet[r].solver, 0);
+        fleet[r].job_class = JOB_NONE;
+        fleet[r].queued_class = JOB_NONE;
+    }
+    for (int job_class = 0; job_class < JOB_CLASS_COUNT; job_class++) {
+        fleet_queue_head[job_class] = fleet_queue_tail[job_class] = -1;
+        fleet_queue_length[job_class] = 0;
+    }
+    memcpy(fleet_stats, empty_stats, sizeof(fleet_stats));
+
+    fleet_layout_words = ROWS * render_words;
+    solution_cache_capacity = 64;
+    while (solution_cache_capacity < 4 * FLEET_POOL_SIZE) {
+        solution_cache_capacity *= 2;
+    }
+    fleet_pool_count = solution_cache_count = 0;
+    fleet_pool_draws = fleet_pool_generated = solution_cache_hits = solution_cache_misses = 0;
+    fleet_step_budget = SOLVER_STEP_BUDGET;
+    fleet_ms_per_cell = 0;
+    double load_start_ms = monotonic_ms();
+    if (WARM_SNAPSHOT_PATH != NULL && load_warm_snapshot(WARM_SNAPSHOT_PATH)) {
+        printf("Warm start from %s in %.2f ms: %d pooled layouts, %d cached solutions, step budget %d\n",
+               WARM_SNAPSHOT_PATH, monotonic_ms() - load_start_ms, fleet_pool_count, solution_cache_count,
+               fleet_step_budget);
+    } else {
+        if (WARM_SNAPSHOT_PATH != NULL) {
+            printf("Cold start; %s will be written on exit\n", WARM_SNAPSHOT_PATH);
+        }
+        fleet_pool = (FleetLayout *)tracked_calloc(MEMORY_CACHES, FLEET_POOL_SIZE, sizeof(FleetLayout));
+        fleet_pool_words = (unsigned long long *)tracked_calloc(MEMORY_CACHES, (size_t)FLEET_POOL_SIZE *
+                                                                fleet_layout_words, sizeof(unsigned long long));
+        solution_cache = (SolutionCacheEntry *)tracked_calloc(MEMORY_CACHES, solution_cache_capacity,
+                                                              sizeof(SolutionCacheEntry));
+    }
+    fleet_urgent_in_flight = 0;
+    fleet_solver_count = WORKER_COUNT < FLEET_SIZE ? WORKER_COUNT : FLEET_SIZE;
+    fleet_solver_threads = (pthread_t *)tracked_malloc(MEMORY_RUNTIME, fleet_solver_count * sizeof(pthread_t));
+    fleet_stopping = false;
+    fleet_next_event_ms = 0;
+    if (active_clock->simulated) {
+        simulated_clock_setup(1 + fleet_solver_count);
+    }
+    pthread_create(&fleet_generation_thread, NULL, fleet_generation_thread_func, NULL);
+    for (int t = 0; t < fleet_solver_count; t++) {
+        pthread_create(&fleet_solver_threads[t], NULL, fleet_solver_thread_func, (void *)(long)t);
+    }
+}
+
+/**
+ * @brief Stops the fleet threads, prints the totals and frees the rooms.
+ *
+ * A simulated fleet stops by itself when its time is up, so this only waits for it.
+ */
+void stop_fleet(void) {
+    if (!active_clock->simulated) {
+        fleet_stopping = true;
+    }
+    pthread_join(fleet_generation_thread, NULL);
+    for (int t = 0; t < fleet_solver_count; t++) {
+        pthread_join(fleet_solver_threads[t], NULL);
+    }
+    tracked_free(fleet_solver_threads);
+    if (active_clock->simulated) {
+        simulated_clock_release();
+    }
+    print_fleet_stats("Fleet total", fleet_stats);
+    if (FLEET_POOL_SIZE > 0) {
+        printf("Layout pool: %d of %d layouts, %ld generated for %ld rooms; solution cache: %ld hits, %ld misses; "
+               "step budget %d\n", fleet_pool_count, FLEET_POOL_SIZE, fleet_pool_generated, fleet_pool_draws,
+               solution_cache_hits, solution_cache_misses, fleet_step_budget);
+    }
+    if (WARM_SNAPSHOT_PATH != NULL) {
+        write_warm_snapshot(WARM_SNAPSHOT_PATH);
+    }
+    if (warm_mapping != NULL) {
+        munmap(warm_mapping, warm_mapping_size);
+        warm_mapping = NULL;
+    } else {
+        tracked_free(fleet_pool);
+        tracked_free(fleet_pool_words);
+        tracked_free(solution_cache);
+    }
+    for (int r = 0; r < FLEET_SIZE; r++) {
+        for (int row = 0; row < ROWS; row++) {
+            tracked_free(fleet[r].matrix[row]);
+        }
+        tracked_free(fleet[r].matrix);
+        solver_free(&fleet[r].solver);
+        pthread_mutex_destroy(&fleet[r].mutex);
+    }
+    tracked_free(fleet);
+}
+
+/**
+ * @brief Whether a pipeline stage may go on with a frame.
+ * @param counter The counter of the stage it waits on.
+ * @param target The count the counter must reach.
+ * @param frame The frame the stage wants to work on.
+ * @return true if the counter has reached the target, or the generator ended before the frame.
+ */
+bool pipeline_ready(StageCounter *counter, unsigned long target, long frame) {
+    return __atomic_load_n(&counter->sequence, __ATOMIC_SEQ_CST) >= target ||
+           frame >= __atomic_load_n(&pipeline_end, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Waits for a counter to reach a target: spins first, then parks.
+ *
+ * Each counter has a single waiter. It sets the parked flag under the mutex before its
+ * last check, and the stage that advances the counter reads the flag after the increment,
+ * so either the waiter sees the new count or the advancing stage sees the flag and wakes it.
+ * @param stage The waiting stage.
+ * @param counter The counter to wait on.
+ * @param target The count to wait for.
+ * @param frame The frame the stage wants to work on.
+ */
+void pipeline_wait(int stage, StageCounter *counter, unsigned long target, long frame) {
+    for (long spin = 0; spin < pipeline_spin_budget; spin++) {
+        if (pipeline_ready(counter, target, frame)) {
+            return;
+        }
+        CPU_RELAX();
+    }
+    pthread_mutex_lock(&counter->mutex);
+    __atomic_store_n(&counter->parked, 1, __ATOMIC_SEQ_CST);
+    if (!pipeline_ready(counter, target, frame)) {
+        __atomic_store_n(&pipeline_parks[stage], pipeline_parks[stage] + 1, __ATOMIC_RELAXED);
+        do {
+            pthread_cond_wait(&counter->cond, &counter->mutex);
+        } while (!pipeline_ready(counter, target, frame));
+    }
+    __atomic_store_n(&counter->parked, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&counter->mutex);
+}
+
+/**
+ * @brief Hands one more frame on, waking the next stage if it has parked.
+ * @param counter The counter of the stage handing the frame on.
+ */
+void pipeline_advance(StageCounter *counter) {
+    __atomic_add_fetch(&counter->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&counter->parked, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&counter->mutex);
+        pthread_cond_broadcast(&counter->cond);
+        pthread_mutex_unlock(&counter->mutex);
+    }
+}
+
+/**
+ * @brief Wakes every parked stage, so it can see that the generator has ended.
+ */
+void pipeline_wake_all(void) {
+    for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+        pthread_mutex_lock(&pipeline_counters[stage].mutex);
+        pthread_cond_broadcast(&pipeline_counters[stage].cond);
+        pthread_mutex_unlock(&pipeline_counters[stage].mutex);
+    }
+}
+
+/**
+ * @brief qsort comparison of two doubles, ascending.
+ * @param a The first double.
+ * @param b The second double.
+ * @return Negative, zero or positive.
+ */
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints the distribution of both handoff latencies over a range of frames.
+ *
+ * Only the last PIPELINE_SAMPLES frames of the range are kept.
+ * @param first The first frame.
+ * @param last One past the last frame.
+ */
+void report_handoff_latency(long first, long last) {
+    if (last - first > PIPELINE_SAMPLES) {
+        first = last - PIPELINE_SAMPLES;
+    }
+    long count = last - first;
+    if (count <= 0) {
+        return;
+    }
+    for (int handoff = 0; handoff < PIPELINE_STAGES - 1; handoff++) {
+        for (long frame = first; frame < last; frame++) {
+            pipeline_sorted_us[frame - first] = pipeline_latency_us[handoff][frame & (PIPELINE_SAMPLES - 1)];
+        }
+        qsort(pipeline_sorted_us, count, sizeof(double), compare_doubles);
+        printf("  %9s -> %-9s p50 %8.2f us, p90 %8.2f us, p99 %8.2f us, p99.9 %8.2f us, max %8.2f us\n",
+               PIPELINE_STAGE_NAMES[handoff], PIPELINE_STAGE_NAMES[handoff + 1], pipeline_sorted_us[count / 2],
+               pipeline_sorted_us[count * 9 / 10], pipeline_sorted_us[count * 99 / 100],
+               pipeline_sorted_us[count * 999 / 1000], pipeline_sorted_us[count - 1]);
+    }
+}
+
+/**
+ * @brief Pipeline thread: runs one stage on every frame, pinned to its own CPU.
+ *
+ * The generator fills a slot once the publisher has freed it, the solver finds the
+ * distance from its first entry to its first exit, and the publisher counts the frame
+ * and, unless quiet, prints the latencies once a second. Each stage stamps the slot
+ * just before handing it on, and the next stage measures the handoff when it sees it.
+ * The time the publisher spends printing is left out of the solver-to-publisher samples.
+ * @param arg The stage, cast to a pointer.
+ * @return Unused return value.
+ */
+void *pipeline_stage_func(void *arg) {
+    int stage = (int)(long)arg;
+    cpu_set_t cpus;
+    double report_us = monotonic_ms() * 1000.0, resumed_us = 0;
+    long report_frame = 0, report_parks[PIPELINE_STAGES] = {0, 0, 0};
+
+    CPU_ZERO(&cpus);
+    CPU_SET(pipeline_cpus[stage], &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Cannot pin the pipeline %s to CPU %d\n", PIPELINE_STAGE_NAMES[stage], pipeline_cpus[stage]);
+    }
+    for (long frame = 0;; frame++) {
+        PipelineSlot *slot = &pipeline_slots[frame % PIPELINE_DEPTH];
+        if (stage == PIPELINE_GENERATOR) {
+            if (__atomic_load_n(&pipeline_stopping, __ATOMIC_RELAXED) || frame == pipeline_frame_limit) {
+                __atomic_store_n(&pipeline_end, frame, __ATOMIC_SEQ_CST);
+                pipeline_wake_all();
+                break;
+            }
+            // The slot is free once the publisher is done with the frame PIPELINE_DEPTH back
+            if (frame >= PIPELINE_DEPTH) {
+                pipeline_wait(stage, &pipeline_counters[PIPELINE_PUBLISHER], frame - PIPELINE_DEPTH + 1, frame);
+            }
+            randomize_matrix(slot->matrix, density);
+            slot->entry_cell = entry_cells[0];
+            slot->exit_cell = exit_cells[0];
+        } else {
+            pipeline_wait(stage, &pipeline_counters[stage - 1], frame + 1, frame);
+            if (frame >= __atomic_load_n(&pipeline_end, __ATOMIC_SEQ_CST)) {
+                break;
+            }
+            double now_us = monotonic_ms() * 1000.0;
+            double handoff_us = slot->handoff_us > resumed_us ? slot->handoff_us : resumed_us;
+            pipeline_latency_us[stage - 1][frame & (PIPELINE_SAMPLES - 1)] = now_us - handoff_us;
+            if (stage == PIPELINE_SOLVER) {
+                solver_init(&pipeline_solver, slot->matrix, slot->entry_cell, slot->exit_cell);
+                solver_step(&pipeline_solver, LONG_MAX);
+                slot->distance = pipeline_solver.result;
+            } else {
+                metrics_count(METRIC_FRAMES, 1);
+                if (!pipeline_quiet && now_us - report_us >= 1000000.0) {
+                    long parks[PIPELINE_STAGES];
+                    for (int k = 0; k < PIPELINE_STAGES; k++) {
+                        parks[k] = __atomic_load_n(&pipeline_parks[k], __ATOMIC_RELAXED);
+                    }
+                    printf("Pipeline: %ld frames in %.2f s, last distance %d, parked %ld/%ld/%ld times\n",
+                           frame + 1 - report_frame, (now_us - report_us) / 1000000.0, slot->distance,
+                           parks[PIPELINE_GENERATOR] - report_parks[PIPELINE_GENERATOR],
+                           parks[PIPELINE_SOLVER] - report_parks[PIPELINE_SOLVER],
+                           parks[PIPELINE_PUBLISHER] - report_parks[PIPELINE_PUBLISHER]);
+                    memcpy(report_parks, parks, sizeof(parks));
+                    report_handoff_latency(report_frame, frame + 1);
+                    report_frame = frame + 1;
+                    report_us = now_us;
+                    resumed_us = monotonic_ms() * 1000.0;
+                }
+            }
+        }
+        if (stage != PIPELINE_PUBLISHER) {
+            slot->handoff_us = monotonic_ms() * 1000.0;
+        }
+        pipeline_advance(&pipeline_counters[stage]);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocates the pipeline ring and starts one pinned thread per stage.
+ *
+ * The stages take the highest-numbered CPUs the process may run on, one each, and
+ * share CPUs only when there are fewer CPUs than stages. Sharing stages never spin.
+ * @param spin_budget How many times a waiting stage checks its counter before it parks.
+ * @param frame_limit The number of frames to run, or LONG_MAX to run until stop_pipeline.
+ * @param quiet true to print nothing while running.
+ */
+void start_pipeline(long spin_budget, long frame_limit, bool quiet) {
+    cpu_set_t allowed;
+    int allowed_cpus[PIPELINE_STAGES], allowed_count = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = CPU_SETSIZE - 1; cpu >= 0 && allowed_count < PIPELINE_STAGES; cpu--) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                allowed_cpus[allowed_count++] = cpu;
+            }
+        }
+    }
+    if (allowed_count == 0) {
+        allowed_cpus[allowed_count++] = 0;
+    }
+    // A stage spinning on a shared CPU only holds up the stage it waits for, so it parks at once instead
+    if (allowed_count < PIPELINE_STAGES && spin_budget > 0) {
+        fprintf(stderr, "Only %d CPUs for %d pipeline stages: parking at once instead of spinning %ld times\n",
+                allowed_count, PIPELINE_STAGES, spin_budget);
+        spin_budget = 0;
+    }
+    for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+        pipeline_cpus[stage] = allowed_cpus[stage % allowed_count];
+        pipeline_counters[stage].sequence = 0;
+        pipeline_counters[stage].parked = 0;
+        pthread_mutex_init(&pipeline_counters[stage].mutex, NULL);
+        pthread_cond_init(&pipeline_counters[stage].cond, NULL);
+        pipeline_parks[stage] = 0;
+    }
+    for (int k = 0; k < PIPELINE_DEPTH; k++) {
+        pipeline_slots[k].matrix = (char **)tracked_malloc(MEMORY_GRID, ROWS * sizeof(char *));
+        for (int row = 0; row < ROWS; row++) {
+            pipeline_slots[k].matrix[row] = (char *)tracked_malloc(MEMORY_GRID, COLS * sizeof(char));
+            memset(pipeline_slots[k].matrix[row], CLOSED, COLS);
+        }
+    }
+    for (int handoff = 0; handoff < PIPELINE_STAGES - 1; handoff++) {
+        pipeline_latency_us[handoff] = (double *)tracked_malloc(MEMORY_RUNTIME, PIPELINE_SAMPLES * sizeof(double));
+    }
+    pipeline_sorted_us = (double *)tracked_malloc(MEMORY_RUNTIME, PIPELINE_SAMPLES * sizeof(double));
+    solver_alloc(&pipeline_solver, ROWS * COLS);
+    pipeline_spin_budget = spin_budget;
+    pipeline_frame_limit = frame_limit;
+    pipeline_end = LONG_MAX;
+    pipeline_stopping = false;
+    pipeline_quiet = quiet;
+    for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+        pthread_create(&pipeline_threads[stage], NULL, pipeline_stage_func, (void *)(long)stage);
+    }
+}
+
+/**
+ * @brief Stops the pipeline after the frames already generated, and waits for its threads.
+ * @return The number of frames that went through the pipeline.
+ */
+long stop_pipeline(void) {
+    __atomic_store_n(&pipeline_stopping, true, __ATOMIC_RELAXED);
+    for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+        pthread_join(pipeline_threads[stage], NULL);
+    }
+    return pipeline_end;
+}
+
+/**
+ * @brief Frees the pipeline ring and latency samples of a stopped pipeline.
+ */
+void free_pipeline(void) {
+    for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+        pthread_mutex_destroy(&pipeline_counters[stage].mutex);
+        pthread_cond_destroy(&pipeline_counters[stage].cond);
+    }
+    for (int k = 0; k < PIPELINE_DEPTH; k++) {
+        for (int row = 0; row < ROWS; row++) {
+            tracked_free(pipeline_slots[k].matrix[row]);
+        }
+        tracked_free(pipeline_slots[k].matrix);
+    }
+    for (int handoff = 0; handoff < PIPELINE_STAGES - 1; handoff++) {
+        tracked_free(pipeline_latency_us[handoff]);
+    }
+    tracked_free(pipeline_sorted_us);
+    solver_free(&pipeline_solver);
+}
+
+/**
+ * @brief Runs the pipeline on the current room settings, first parking at once and then
+ * spinning, and prints the distribution of each handoff latency.
+ *
+ * Each run lasts PIPELINE_BENCH_FRAMES frames or PIPELINE_BENCH_MS, whichever comes first.
+ */
+void benchmark_handoff(void) {
+    long budgets[2] = {0, PIPELINE_SPINS >= 0 ? PIPELINE_SPINS : PIPELINE_DEFAULT_SPINS};
+
+    for (int run = 0; run < 2; run++) {
+        start_pipeline(budgets[run], PIPELINE_BENCH_FRAMES, true);
+        double start = monotonic_ms();
+        while (__atomic_load_n(&pipeline_counters[PIPELINE_PUBLISHER].sequence, __ATOMIC_RELAXED) <
+                   PIPELINE_BENCH_FRAMES && monotonic_ms() - start < PIPELINE_BENCH_MS) {
+            usleep(1000);
+        }
+        long frames = stop_pipeline();
+        double elapsed = monotonic_ms() - start;
+        printf("Stage handoff, spin budget %ld: %ld frames in %.2f ms on CPUs %d/%d/%d, parked %ld/%ld/%ld times\n",
+               pipeline_spin_budget, frames, elapsed, pipeline_cpus[PIPELINE_GENERATOR], pipeline_cpus[PIPELINE_SOLVER],
+               pipeline_cpus[PIPELINE_PUBLISHER], pipeline_parks[PIPELINE_GENERATOR], pipeline_parks[PIPELINE_SOLVER],
+               pipeline_parks[PIPELINE_PUBLISHER]);
+        report_handoff_latency(0, frames);
+        free_pipeline();
+    }
+}
+
+/**
+ * @brief Queues a sensor report that a cell has opened or closed. Safe to call from any thread.
+ *
+ * Bounded multi-producer queue with per-slot sequence numbers, like the HDA* queues.
+ * @param row Row index of the cell.
+ * @param col Column index of the cell.
+ * @param open true if the cell is now open, false if it is closed.
+ * @return false if the cell is outside the room, or the queue was full and the report was dropped.
+ */
+bool ingest_cell_change(int row, int col, bool open) {
+    if (row < 0 || row >= ROWS || col < 0 || col >= COLS) {
+        return false;
+    }
+    unsigned long position = __atomic_load_n(&ingest_enqueue_position, __ATOMIC_RELAXED);
+
+    while (true) {
+        IngestSlot *slot = &ingest_slots[position & (INGEST_QUEUE_SIZE - 1)];
+        long difference = (long)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&ingest_enqueue_position, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->change = (row * COLS + col) * 2 + open;
+                __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (difference < 0) {
+            __atomic_fetch_add(&ingest_dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            position = __atomic_load_n(&ingest_enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Takes queued sensor reports and keeps only the last one for each cell.
+ *
+ * The distinct cells go to ingest_batch_cells and their final state to ingest_open.
+ * Must only be called from the single consumer thread.
+ * @param max_events The maximum number of reports to take.
+ * @return The number of distinct cells in the batch.
+ */
+int ingest_drain_batch(int max_events) {
+    int count = 0;
+    long events_before = ingest_events;
+
+    ingest_batch++;
+    for (int taken = 0; taken < max_events; taken++) {
+        IngestSlot *slot = &ingest_slots[ingest_dequeue_position & (INGEST_QUEUE_SIZE - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != ingest_dequeue_position + 1) {
+            break;
+        }
+        int cell = slot->change / 2;
+        __atomic_store_n(&slot->sequence, ingest_dequeue_position + INGEST_QUEUE_SIZE, __ATOMIC_RELEASE);
+        ingest_dequeue_position++;
+        ingest_events++;
+        if (ingest_stamp[cell] != ingest_batch) {
+            ingest_stamp[cell] = ingest_batch;
+            ingest_batch_cells[count++] = cell;
+        }
+        ingest_open[cell] = slot->change & 1;
+    }
+    metrics_count(METRIC_INGEST_REPORTS, ingest_events - events_before);
+    return count;
+}
 
-    for (int row = 0; row < ROWS; row++) {
-        for (int col = 0; col < COLS; col++) {
-            if (row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1) {
-                if (counter == entry_position && !entry_placed) {
-                    matrix[row][col] = ENTRY;
-                    entry_placed = true;
-                } else if (counter == exit_position && !exit_placed) {
-                    matrix[row][col] = EXIT;
-                    exit_placed = true;
-                }
-                counter++;
+/**
+ * @brief Floods the reachable set outwards from the cells already in reach_queue.
+ * @param matrix The maze matrix.
+ * @param head Index of the first queued cell.
+ * @param tail One past the last queued cell.
+ */
+void reachability_flood(char **matrix, int head, int tail) {
+    while (head < tail) {
+        int cell = reach_queue[head++];
+        int row = cell / COLS, col = cell % COLS;
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row < 0 || next_row >= ROWS || next_col < 0 || next_col >= COLS) {
+                continue;
+            }
+            int next = next_row * COLS + next_col;
+            if (!reachable[next] && matrix[next_row][next_col] != CLOSED) {
+                reachable[next] = true;
+                reach_queue[tail++] = next;
             }
         }
     }
 }
 
 /**
- * @brief Count the number of open cells adjacent to the given cell.
- * @param matrix The matrix containing the cells.
- * @param row The row index of the cell to check.
- * @param col The column index of the cell to check.
- * @return The number of open cells adjacent to the given cell.
+ * @brief Recomputes the set of cells reachable from any entry point from scratch.
+ * @param matrix The maze matrix.
  */
-int count_adjacent_open_cells(char **matrix, int row, int col) {
-    int count = 0;
-    // Check adjacent cells (up, down, left, and right)
-    if (row > 0 && matrix[row - 1][col] == OPEN) count++;
-    if (row < ROWS - 1 && matrix[row + 1][col] == OPEN) count++;
-    if (col > 0 && matrix[row][col - 1] == OPEN) count++;
-    if (col < COLS - 1 && matrix[row][col + 1] == OPEN) count++;
+void reachability_full(char **matrix) {
+    int tail = 0;
 
-    return count;
+    memset(reachable, 0, (size_t)ROWS * COLS * sizeof(bool));
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        if (!reachable[entry_cells[i]]) {
+            reachable[entry_cells[i]] = true;
+            reach_queue[tail++] = entry_cells[i];
+        }
+    }
+    reachability_flood(matrix, 0, tail);
+    ingest_full_updates++;
 }
 
 /**
- * @brief Checks if placing an open cell at the specified location is valid.
+ * @brief Applies a coalesced batch to the grid in one pass, then updates reachability once.
+ *
+ * Opening cells can only grow the reachable set, so the flood continues from the
+ * opened cells that touch it. Closing a reachable cell may cut off others, which
+ * needs a full recomputation, as does a room regenerated since the last batch.
+ * Door cells are never changed. Must be called with matrix_mutex held.
  * @param matrix The maze matrix.
- * @param row Row index of the cell.
- * @param col Column index of the cell.
- * @return true if the placement is valid, false otherwise.
+ * @param count The number of distinct cells in the batch.
  */
-bool is_valid_open_cell_placement(char **matrix, int row, int col) {
-    if (matrix[row][col] == ENTRY || matrix[row][col] == EXIT) {
-        return false;
-    }
+void ingest_apply_batch(char **matrix, int count) {
+    double start = monotonic_ms();
+    bool needs_full = reach_generation != matrix_generation;
+    int tail = 0;
 
-    int adjacent_open_cells = count_adjacent_open_cells(matrix, row, col);
-    if (adjacent_open_cells > 1) {
-        return false;
+    for (int i = 0; i < count; i++) {
+        int cell = ingest_batch_cells[i];
+        int row = cell / COLS, col = cell % COLS;
+        bool was_open = matrix[row][col] != CLOSED;
+        if (ingest_open[cell] == was_open || is_door_cell(cell)) {
+            continue;
+        }
+        matrix[row][col] = ingest_open[cell] ? OPEN : CLOSED;
+        ingest_applied++;
+        // Closing cells keeps the pyramid a valid over-approximation; opening one may join its groups
+        pyramid_valid &= !ingest_open[cell];
+        if (!ingest_open[cell]) {
+            needs_full |= reachable[cell];
+            reachable[cell] = false;
+            continue;
+        }
+        for (int d = 0; d < 4; d++) {
+            int next_row = row + ROW_STEP[d], next_col = col + COL_STEP[d];
+            if (next_row >= 0 && next_row < ROWS && next_col >= 0 && next_col < COLS &&
+                reachable[next_row * COLS + next_col]) {
+                reachable[cell] = true;
+                reach_queue[tail++] = cell;
+                break;
+            }
+        }
     }
+    ingest_distinct += count;
+    ingest_batches++;
 
-    // New check: Ensure that no more than two open cells are in a straight line or diagonal.
-    if ((row > 0 && row < ROWS - 1 && matrix[row - 1][col] == OPEN && matrix[row + 1][col] == OPEN) ||
-        (col > 0 && col < COLS - 1 && matrix[row][col - 1] == OPEN && matrix[row][col + 1] == OPEN) ||
-        (row > 0 && row < ROWS - 1 && col > 0 && col < COLS - 1 && matrix[row - 1][col - 1] == OPEN && matrix[row + 1][col + 1] == OPEN) ||
-        (row > 0 && row < ROWS - 1 && col > 0 && col < COLS - 1 && matrix[row - 1][col + 1] == OPEN && matrix[row + 1][col - 1] == OPEN)) {
-        return false;
+    if (needs_full) {
+        reachability_full(matrix);
+        reach_generation = matrix_generation;
+    } else {
+        reachability_flood(matrix, 0, tail);
     }
+    ingest_update_ms += monotonic_ms() - start;
+}
 
-    // Check cells two steps away
-    if (row > 1 && matrix[row - 2][col] == OPEN && matrix[row - 1][col] == OPEN) {
-        return false;
-    }
+/**
+ * @brief Ingestion thread: applies the queued sensor reports every batch window.
+ * @param arg Unused argument.
+ * @return Unused return value.
+ */
+void *ingest_thread_func(void *arg) {
+    (void)arg;
 
-    if (row < ROWS - 2 && matrix[row + 2][col] == OPEN && matrix[row + 1][col] == OPEN) {
-        return false;
+    while (!ingest_stopping) {
+        usleep(INGEST_BATCH_MS * 1000);
+        int count = ingest_drain_batch(INGEST_QUEUE_SIZE);
+        if (count > 0 || reach_generation != matrix_generation) {
+            metrics_lock(&matrix_mutex, HISTOGRAM_LOCK_MATRIX);
+            ingest_apply_batch(matrix, count);
+            pthread_mutex_unlock(&matrix_mutex);
+        }
     }
+    return NULL;
+}
 
-    if (col > 1 && matrix[row][col - 2] == OPEN && matrix[row][col - 1] == OPEN) {
-        return false;
-    }
+/**
+ * @brief Sensor simulation thread: reports random cells opening or closing at INGEST_RATE per second.
+ *
+ * Reports are drawn from a small set of sensor cells, so batches have duplicates to coalesce.
+ * @param arg Unused argument.
+ * @return Unused return value.
+ */
+void *sensor_thread_func(void *arg) {
+    (void)arg;
+    // A stream of its own, derived from run_seed like the generator's, so -s replays the same reports
+    unsigned int seed = (unsigned int)(((run_seed + 2ULL) * 0x9E3779B97F4A7C15ULL) >> 32);
+    int sensor_cells = ROWS * COLS < 1024 ? ROWS * COLS : 1024;
+    double due = 0;
 
-    if (col < COLS - 2 && matrix[row][col + 2] == OPEN && matrix[row][col + 1] == OPEN) {
-        return false;
+    while (!ingest_stopping) {
+        usleep(1000);
+        for (due += INGEST_RATE / 1000.0; due >= 1.0; due -= 1.0) {
+            int cell = (int)((unsigned int)(rand_r(&seed) % sensor_cells) * 2654435761u % (unsigned int)(ROWS * COLS));
+            ingest_cell_change(cell / COLS, cell % COLS, rand_r(&seed) & 1);
+        }
     }
+    return NULL;
+}
 
-    return true;
+/**
+ * @brief Starts the sensor simulation and ingestion threads.
+ */
+void start_ingestion(void) {
+    ingest_stopping = false;
+    pthread_create(&ingest_thread, NULL, ingest_thread_func, NULL);
+    pthread_create(&sensor_thread, NULL, sensor_thread_func, NULL);
 }
 
+/**
+ * @brief Stops the sensor simulation and ingestion threads.
+ */
+void stop_ingestion(void) {
+    ingest_stopping = true;
+    pthread_join(sensor_thread, NULL);
+    pthread_join(ingest_thread, NULL);
+}
 
+/**
+ * @brief Prints the ingestion totals and whether the first exit is reachable.
+ */
+void report_ingestion(void) {
+    printf("Sensors: %ld reports in %ld batches, %ld after coalescing, %ld applied, %ld dropped, "
+           "%.3f ms per batch update (%ld full); exit 0 %s\n",
+           ingest_events, ingest_batches, ingest_distinct, ingest_applied,
+           __atomic_load_n(&ingest_dropped, __ATOMIC_RELAXED), ingest_batches ? ingest_update_ms / ingest_batches : 0.0,
+           ingest_full_updates, reach_generation == -1 ? "not yet known" :
+           reachable[exit_cells[0]] ? "reachable" : "unreachable");
+}
 
 /**
- * @brief Randomizes the given matrix based on the density.
- * @param matrix The maze matrix.
- * @param density The density of open cells in the matrix.
+ * @brief Producer task for benchmark_ingestion: pushes random reports over a set of sensor cells.
+ * @param arg The producer index, cast to a pointer.
+ * @return Unused return value.
  */
-void randomize_matrix(char **matrix, double density) {
-    int entry_row = -1, entry_col = -1, exit_row = -1, exit_col = -1;
+void *ingest_producer_func(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg + 1;
+    int sensor_cells = ROWS * COLS < 4096 ? ROWS * COLS : 4096;
 
-    // Fill the matrix with open and closed cells based on the density
-    for (int row = 0; row < ROWS; row++) {
-        for (int col = 0; col < COLS; col++) {
-            if ((row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1) &&
-                (matrix[row][col] == ENTRY || matrix[row][col] == EXIT)) {
-                continue;
-            }
-            double random_value = (double)rand() / (double)RAND_MAX;
-            if (random_value <= density && is_valid_open_cell_placement(matrix, row, col)) {
-                matrix[row][col] = OPEN;
-            } else {
-                matrix[row][col] = CLOSED;
-            }
+    for (int event = 0; event < 250000; event++) {
+        int cell = (int)((unsigned int)(rand_r(&seed) % sensor_cells) * 2654435761u % (unsigned int)(ROWS * COLS));
+        while (!ingest_cell_change(cell / COLS, cell % COLS, rand_r(&seed) & 1)) {
+            sched_yield();
         }
     }
+    return NULL;
+}
 
-    // Find entry and exit points
-    for (int row = 0; row < ROWS; row++) {
-        for (int col = 0; col < COLS; col++) {
-            if (matrix[row][col] == ENTRY) {
-                entry_row = row;
-                entry_col = col;
-            } else if (matrix[row][col] == EXIT) {
-                exit_row = row;
-                exit_col = col;
-            }
-        }
+/**
+ * @brief Measures ingestion throughput with one producer per worker and compares batch updates with full ones.
+ */
+void benchmark_ingestion(void) {
+    int producers = WORKER_COUNT;
+    pthread_t threads[producers];
+    long events_before = ingest_events, dropped_before = ingest_dropped;
+
+    ingest_batches = ingest_distinct = ingest_applied = ingest_full_updates = 0;
+    ingest_update_ms = 0;
+    reachability_full(matrix);
+    reach_generation = matrix_generation;
+    ingest_full_updates = 0;
+
+    double start = monotonic_ms();
+    for (int p = 0; p < producers; p++) {
+        pthread_create(&threads[p], NULL, ingest_producer_func, (void *)(long)p);
     }
-    // Remove the previous entry and exit points only if they have been found
-    if (entry_row != -1 && entry_col != -1) {
-        matrix[entry_row][entry_col] = CLOSED;
+    while (ingest_events < events_before + 250000L * producers) {
+        int count = ingest_drain_batch(INGEST_QUEUE_SIZE);
+        if (count > 0) {
+            ingest_apply_batch(matrix, count);
+        } else {
+            sched_yield();
+        }
     }
-    if (exit_row != -1 && exit_col != -1) {
-        matrix[exit_row][exit_col] = CLOSED;
+    double elapsed = monotonic_ms() - start;
+    for (int p = 0; p < producers; p++) {
+        pthread_join(threads[p], NULL);
     }
-    // Place new entry and exit points
-    place_entry_exit_points(matrix);
+    long full_updates = ingest_full_updates;
+
+    double full_start = monotonic_ms();
+    reachability_full(matrix);
+    double full_ms = monotonic_ms() - full_start;
+    printf("Ingestion: %ld reports from %d producers in %.2f ms (%.0f per second), %ld retried on a full queue\n",
+           ingest_events - events_before, producers, elapsed, (ingest_events - events_before) * 1000.0 / elapsed,
+           ingest_dropped - dropped_before);
+    printf("%ld batches, %.1f reports and %.1f distinct cells per batch, %ld cells changed, "
+           "%.3f ms per batch update (%ld full) vs %.3f ms for one full reachability pass\n",
+           ingest_batches, (double)(ingest_events - events_before) / ingest_batches,
+           (double)ingest_distinct / ingest_batches, ingest_applied, ingest_update_ms / ingest_batches,
+           full_updates, full_ms);
 }
 
 /**
- * @brief Generates a new matrix.
- * @param matrix The matrix.
+ * @brief Returns the calling thread's metric slot, claiming one on first use.
+ * @return The slot.
  */
-void generate_matrix(char **matrix) {
-    for (int row = 0; row < ROWS; row++) {
-        for (int col = 0; col < COLS; col++) {
-            matrix[row][col] = CLOSED;
+MetricSlot *metrics_slot(void) {
+    if (metric_slot == -1) {
+        metric_slot = __atomic_fetch_add(&metric_slots_used, 1, __ATOMIC_RELAXED);
+        if (metric_slot >= METRIC_SLOTS) {
+            metric_slot = METRIC_SLOTS - 1;
         }
     }
-    randomize_matrix(matrix, density);
+    return &metric_slots[metric_slot];
 }
 
 /**
- * @brief Displays the matrix (room) on the console.
- * @param matrix The matrix.
+ * @brief Adds to one of the calling thread's counters.
+ * @param counter The counter.
+ * @param amount The amount to add.
  */
-void display_matrix(char **matrix) {
-    matrix_count++;
-    printf("\nMatrix %d\n", matrix_count);
-    for (int i = 0; i < (COLS * 2); i++) {
-        putchar('-');
+void metrics_count(int counter, unsigned long amount) {
+    __atomic_fetch_add(&metrics_slot()->counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records one observation in one of the calling thread's histograms.
+ * @param histogram The histogram.
+ * @param seconds The observed duration in seconds.
+ */
+void metrics_observe(int histogram, double seconds) {
+    MetricSlot *slot = metrics_slot();
+    int bucket = 0;
+
+    while (bucket < HISTOGRAM_BUCKETS && seconds > HISTOGRAM_BOUNDS[bucket]) {
+        bucket++;
     }
-    putchar('\n');
-    for (int row = 0; row < ROWS; row++) {
-        for (int col = 0; col < COLS; col++) {
-            switch (matrix[row][col]) {
-                case OPEN:
-                    fputs(ANSI_BRIGHT_WHITE "■" ANSI_RESET, stdout);
-                    break;
-                case CLOSED:
-                    fputs(ANSI_BRIGHT_BLACK "■" ANSI_RESET, stdout);
-                    break;
-                case ENTRY:
-                case EXIT:
-                    fputs(ANSI_GREEN "■" ANSI_RESET, stdout);
-                    break;
-                case PATH:
-                    fputs(ANSI_RED "■" ANSI_RESET, stdout);
-                    break;
-                case VISITED:
-                    fputs(ANSI_RESET "■", stdout);
-                    break;
-            }
-            putchar(' ');
-        }
-        putchar('\n');
+    __atomic_fetch_add(&slot->buckets[histogram][bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->sum_ns[histogram], (unsigned long)(seconds * 1e9), __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Locks a mutex and records how long the caller waited for it.
+ *
+ * The clock is only read when the lock is contended; an uncontended lock counts as a zero wait.
+ * @param mutex The mutex.
+ * @param histogram The histogram that records the wait.
+ */
+void metrics_lock(pthread_mutex_t *mutex, int histogram) {
+    if (pthread_mutex_trylock(mutex) == 0) {
+        metrics_observe(histogram, 0);
+        return;
     }
+    double start = monotonic_ms();
+    pthread_mutex_lock(mutex);
+    metrics_observe(histogram, (monotonic_ms() - start) / 1000.0);
 }
 
 /**
- * @brief Thread function to generate and display the matrix.
- * @param arg Unused argument.
- * @return Unused return value.
+ * @brief Appends formatted text to a scrape buffer, growing it as needed.
+ * @param buffer The buffer.
+ * @param format The printf format.
  */
-void* matrix_generation_thread_func(void* arg) {
-    (void)arg;
-    // Generate the initial matrix
-    pthread_mutex_lock(&matrix_mutex);
-    generate_matrix(matrix);
-    pthread_mutex_unlock(&matrix_mutex);
+void metrics_append(MetricsBuffer *buffer, const char *format, ...) {
     while (true) {
-        pthread_mutex_lock(&matrix_mutex);
-        randomize_matrix(matrix, density);
-        pthread_mutex_unlock(&matrix_mutex);
-        display_matrix(matrix);
-        sleep(2);
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+        va_end(args);
+        if (written >= 0 && buffer->length + written < buffer->capacity) {
+            buffer->length += written;
+            return;
+        }
+        buffer->capacity = buffer->capacity * 2 + (written > 0 ? written : 0);
+        buffer->data = (char *)tracked_realloc(MEMORY_RUNTIME, buffer->data, buffer->capacity);
     }
 }
 
 /**
- * @brief Performs a depth-first search to find a path through the maze.
- * @param matrix The matrix.
- * @param row Row index of the starting cell.
- * @param col Column index of the starting cell.
- * @return A Path structure representing the found path, or an invalid path if not found.
+ * @brief Writes every metric in the Prometheus text format.
+ *
+ * Counters and histograms are summed over the thread slots with relaxed reads, so a
+ * scrape never takes a lock that the simulation threads use. Gauges are read directly.
+ * @param buffer The buffer to append to.
  */
+void metrics_render(MetricsBuffer *buffer) {
+    int slots = __atomic_load_n(&metric_slots_used, __ATOMIC_RELAXED);
+    unsigned long counters[METRIC_COUNTER_COUNT] = {0};
 
-Path dfs(char **matrix, int row, int col) {
-    Path path = {.found = false};
-
-    if (row < 0 || row >= ROWS || col < 0 || col >= COLS) {
-        return path;
+    if (slots > METRIC_SLOTS) {
+        slots = METRIC_SLOTS;
     }
-    if (matrix[row][col] == EXIT) {
-        path.start_x = row;
-        path.start_y = col;
-        path.end_x = row;
-        path.end_y = col;
-        path.found = true;
-        return path;
-    } else if (matrix[row][col] == CLOSED || matrix[row][col] == VISITED) {
-        return path;
+    for (int slot = 0; slot < slots; slot++) {
+        for (int counter = 0; counter < METRIC_COUNTER_COUNT; counter++) {
+            counters[counter] += __atomic_load_n(&metric_slots[slot].counters[counter], __ATOMIC_RELAXED);
+        }
     }
-    matrix[row][col] = VISITED;
-    Path directions[] = {dfs(matrix, row - 1, col), dfs(matrix, row + 1, col),
-                         dfs(matrix, row, col - 1), dfs(matrix, row, col + 1)};
+    metrics_append(buffer, "# TYPE mazelock_frames_total counter\nmazelock_frames_total %lu\n", counters[METRIC_FRAMES]);
+    metrics_append(buffer, "# TYPE mazelock_ingest_reports_total counter\nmazelock_ingest_reports_total %lu\n",
+                   counters[METRIC_INGEST_REPORTS]);
 
-    for (int i = 0; i < 4; i++) {
-        if (directions[i].found) {
-            path.start_x = row;
-            path.start_y = col;
-            path.end_x = directions[i].end_x;
-            path.end_y = directions[i].end_y;
-            path.found = true;
-            break;
+    metrics_append(buffer, "# TYPE mazelock_queue_depth gauge\n");
+    metrics_append(buffer, "mazelock_queue_depth{queue=\"urgent\"} %d\n",
+                   __atomic_load_n(&fleet_queue_length[JOB_URGENT], __ATOMIC_RELAXED));
+    metrics_append(buffer, "mazelock_queue_depth{queue=\"routine\"} %d\n",
+                   __atomic_load_n(&fleet_queue_length[JOB_ROUTINE], __ATOMIC_RELAXED));
+    metrics_append(buffer, "mazelock_queue_depth{queue=\"ingest\"} %lu\n",
+                   __atomic_load_n(&ingest_enqueue_position, __ATOMIC_RELAXED) -
+                   __atomic_load_n(&ingest_dequeue_position, __ATOMIC_RELAXED));
+
+    for (int histogram = 0; histogram < HISTOGRAM_COUNT; histogram++) {
+        const char *name = HISTOGRAM_NAMES[histogram];
+        const char *labels = strchr(name, '{');
+        int name_length = labels ? (int)(labels - name) : (int)strlen(name);
+        // Labels without their closing brace, so that le can be appended
+        int label_length = labels ? (int)strlen(labels) - 2 : 0;
+        unsigned long buckets[HISTOGRAM_BUCKETS + 1] = {0}, sum_ns = 0, cumulative = 0;
+
+        for (int slot = 0; slot < slots; slot++) {
+            for (int bucket = 0; bucket <= HISTOGRAM_BUCKETS; bucket++) {
+                buckets[bucket] += __atomic_load_n(&metric_slots[slot].buckets[histogram][bucket], __ATOMIC_RELAXED);
+            }
+            sum_ns += __atomic_load_n(&metric_slots[slot].sum_ns[histogram], __ATOMIC_RELAXED);
+        }
+        if (histogram == 0 || strncmp(name, HISTOGRAM_NAMES[histogram - 1], name_length + 1) != 0) {
+            metrics_append(buffer, "# TYPE %.*s histogram\n", name_length, name);
+        }
+        for (int bucket = 0; bucket <= HISTOGRAM_BUCKETS; bucket++) {
+            cumulative += buckets[bucket];
+            metrics_append(buffer, "%.*s_bucket{%.*s%sle=\"", name_length, name, label_length,
+                           labels ? labels + 1 : "", labels ? "," : "");
+            if (bucket < HISTOGRAM_BUCKETS) {
+                metrics_append(buffer, "%g\"} %lu\n", HISTOGRAM_BOUNDS[bucket], cumulative);
+            } else {
+                metrics_append(buffer, "+Inf\"} %lu\n", cumulative);
+            }
         }
+        metrics_append(buffer, "%.*s_sum%s %.9f\n", name_length, name, labels ? labels : "", sum_ns / 1e9);
+        metrics_append(buffer, "%.*s_count%s %lu\n", name_length, name, labels ? labels : "", cumulative);
     }
-
-    return path;
 }
 
 /**
- * @brief Finds a path through the maze and prints the result.
- * @param matrix The maze matrix.
+ * @brief Metrics thread: answers every connection with the current metrics over HTTP.
+ * @param arg Unused argument.
+ * @return Unused return value.
  */
-void find_path(char **matrix) {
-    int entry_row = -1, entry_col = -1;
-    bool entry_found = false;
-    for (int row = 0; row < ROWS; row++) {
-        for (int col = 0; col < COLS; col++) {
-            if (row == 0 || row == ROWS - 1 || col == 0 || col == COLS - 1) {
-                if (matrix[row][col] == ENTRY) {
-                    entry_row = row;
-                    entry_col = col;
-                    entry_found = true;
+void *metrics_thread_func(void *arg) {
+    (void)arg;
+    MetricsBuffer body = {NULL, 0, 0}, header = {NULL, 0, 0};
+    struct pollfd listener = {metrics_socket, POLLIN, 0};
+    char request[1024];
+
+    while (!metrics_stopping) {
+        if (poll(&listener, 1, 200) <= 0) {
+            continue;
+        }
+        int client = accept(metrics_socket, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        // The request is not parsed: every path returns the metrics
+        struct pollfd readable = {client, POLLIN, 0};
+        if (poll(&readable, 1, 1000) > 0) {
+            ssize_t ignored = read(client, request, sizeof(request));
+            (void)ignored;
+        }
+        body.length = header.length = 0;
+        metrics_render(&body);
+        metrics_append(&header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: %zu\r\n\r\n", body.length);
+        for (MetricsBuffer *part = &header; part != NULL; part = part == &header ? &body : NULL) {
+            size_t sent = 0;
+            while (sent < part->length) {
+                ssize_t written = write(client, part->data + sent, part->length - sent);
+                if (written <= 0) {
                     break;
                 }
+                sent += written;
             }
         }
-        if (entry_found) {
-            break;
-        }
+        close(client);
     }
-    if (entry_row != -1 && entry_col != -1) {
-        Path path = dfs(matrix, entry_row, entry_col);
-        if (path.found) {
-            printf("Partial path found from (%d,%d) to (%d,%d)\n", path.start_x, path.start_y, path.end_x, path.end_y);
-        } else {
-            printf("No path found.\n");
+    tracked_free(body.data);
+    tracked_free(header.data);
+    return NULL;
+}
+
+/**
+ * @brief Opens the metrics endpoint and starts the thread that serves it.
+ *
+ * A socket left at the path by an earlier run is replaced; any other file there is left alone.
+ * @param endpoint A port number on the loopback interface, or a Unix socket path starting with '/'.
+ * @return true on success, false if the endpoint could not be opened.
+ */
+bool start_metrics_server(const char *endpoint) {
+    if (endpoint[0] == '/') {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, endpoint, sizeof(address.sun_path) - 1);
+        struct stat existing;
+        if (lstat(endpoint, &existing) == 0) {
+            if (!S_ISSOCK(existing.st_mode)) {
+                fprintf(stderr, "metrics endpoint: %s exists and is not a socket\n", endpoint);
+                return false;
+            }
+            unlink(endpoint);
+        }
+        metrics_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (metrics_socket >= 0 && bind(metrics_socket, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            close(metrics_socket);
+            metrics_socket = -1;
         }
     } else {
-        printf("Entry point not found.\n");
+        struct sockaddr_in address;
+        int reuse = 1;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((unsigned short)atoi(endpoint));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (metrics_socket >= 0) {
+            setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (bind(metrics_socket, (struct sockaddr *)&address, sizeof(address)) != 0) {
+                close(metrics_socket);
+                metrics_socket = -1;
+            }
+        }
+    }
+    if (metrics_socket < 0 || listen(metrics_socket, 8) != 0) {
+        perror("metrics endpoint");
+        if (metrics_socket >= 0) {
+            close(metrics_socket);
+            metrics_socket = -1;
+        }
+        return false;
     }
+    metrics_stopping = false;
+    pthread_create(&metrics_thread, NULL, metrics_thread_func, NULL);
+    if (json_fd != STDOUT_FILENO) {
+        printf("Serving metrics on %s%s\n", endpoint[0] == '/' ? "" : "127.0.0.1:", endpoint);
+    }
+    return true;
 }
+
 /**
- * @brief Thread function to find paths through the matrix.
- * @param arg Unused argument.
- * @return Unused return value.
+ * @brief Stops the metrics thread and closes the endpoint, if it was started.
  */
-void *path_finding_thread_func(void *arg) {
-    (void)arg;
-    while (true) {
-        pthread_mutex_lock(&matrix_mutex);
-        find_path(matrix);
-        pthread_mutex_unlock(&matrix_mutex);
-        sleep(2);
+void stop_metrics_server(void) {
+    if (metrics_socket < 0) {
+        return;
+    }
+    metrics_stopping = true;
+    pthread_join(metrics_thread, NULL);
+    close(metrics_socket);
+    metrics_socket = -1;
+    if (METRICS_ENDPOINT[0] == '/') {
+        unlink(METRICS_ENDPOINT);
     }
 }